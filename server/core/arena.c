@@ -0,0 +1,175 @@
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2014
+ */
+
+/**
+ * @file arena.c  - The huge page arena for buffer data
+ *
+ * The region is mapped with MAP_HUGETLB first, which only succeeds if the
+ * administrator has reserved enough huge pages. Otherwise an ordinary
+ * mapping is asked to be backed by transparent huge pages with madvise,
+ * and if the kernel does not support that either the region is used with
+ * normal pages, which still keeps the buffers close together.
+ *
+ * Objects are carved from the region by moving the offset of the first
+ * free byte with an atomic add, so allocating never takes a lock.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <arena.h>
+#include <atomic.h>
+#include <dcb.h>
+#include <skygw_utils.h>
+#include <log_manager.h>
+
+extern int lm_enabled_logfiles_bitmask;
+
+static	char		*arena_base = NULL;
+static	size_t		arena_size = 0;
+static	size_t		arena_used = 0;
+static	arena_mode_t	arena_mode = ARENA_NONE;
+static	ARENA_STATS	arena_stats;
+
+/**
+ * Reserve the arena. Called once at startup, before the polling threads
+ * are started.
+ *
+ * @param megabytes	The size of the arena in megabytes, 0 for no arena
+ */
+void
+arena_init(size_t megabytes)
+{
+size_t	size = megabytes * 1024 * 1024;
+void	*base = MAP_FAILED;
+
+	if (size == 0 || arena_base != NULL)
+		return;
+	size = (size + ARENA_HUGE_PAGE - 1) & ~((size_t)ARENA_HUGE_PAGE - 1);
+
+#ifdef MAP_HUGETLB
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (base != MAP_FAILED)
+		arena_mode = ARENA_HUGETLB;
+#endif
+	if (base == MAP_FAILED)
+	{
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED)
+		{
+			LOGIF(LE, (skygw_log_write_flush(
+				LOGFILE_ERROR,
+				"Error : Failed to map a buffer arena of %lu "
+				"bytes due error %d, %s. Buffers are allocated "
+				"from the heap.",
+				(unsigned long)size,
+				errno,
+				strerror(errno))));
+			return;
+		}
+		arena_mode = ARENA_PAGES;
+#ifdef MADV_HUGEPAGE
+		if (madvise(base, size, MADV_HUGEPAGE) == 0)
+			arena_mode = ARENA_THP;
+#endif
+	}
+	arena_base = (char *)base;
+	arena_size = size;
+	arena_used = 0;
+	memset(&arena_stats, 0, sizeof(arena_stats));
+
+	LOGIF(LM, (skygw_log_write(
+		LOGFILE_MESSAGE,
+		"Reserved a buffer arena of %lu bytes backed by %s.",
+		(unsigned long)size,
+		arena_mode == ARENA_HUGETLB ? "reserved huge pages" :
+		arena_mode == ARENA_THP ? "transparent huge pages" :
+		"normal pages")));
+}
+
+/**
+ * Carve an object from the arena. The object is never returned to the
+ * arena, the caller keeps it for reuse.
+ *
+ * @param size	The size of the object
+ * @return	The object or NULL if there is no arena or it is full
+ */
+void *
+arena_alloc(size_t size)
+{
+size_t	offset;
+
+	if (arena_base == NULL)
+		return NULL;
+	size = (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+	if (arena_used + size > arena_size)
+	{
+		atomic_add(&arena_stats.n_fallbacks, 1);
+		return NULL;
+	}
+	offset = __sync_fetch_and_add(&arena_used, size);
+	if (offset + size > arena_size)
+	{
+		/*< Another thread took the rest, the tail stays unused */
+		atomic_add(&arena_stats.n_fallbacks, 1);
+		return NULL;
+	}
+	atomic_add(&arena_stats.n_allocs, 1);
+	return arena_base + offset;
+}
+
+/**
+ * Return whether memory was carved from the arena
+ *
+ * @param ptr	The memory
+ * @return	Non-zero if the memory is in the arena
+ */
+int
+arena_contains(void *ptr)
+{
+	return arena_base != NULL &&
+		(char *)ptr >= arena_base && (char *)ptr < arena_base + arena_size;
+}
+
+/**
+ * Print the occupancy of the arena to a DCB
+ *
+ * @param dcb	The DCB to print to
+ */
+void
+dprintArena(DCB *dcb)
+{
+size_t	used = arena_used < arena_size ? arena_used : arena_size;
+
+	if (arena_base == NULL)
+	{
+		dcb_printf(dcb, "No buffer arena, buffers are allocated from the heap\n");
+		return;
+	}
+	dcb_printf(dcb, "Buffer arena backed by:	%s\n",
+		arena_mode == ARENA_HUGETLB ? "reserved huge pages" :
+		arena_mode == ARENA_THP ? "transparent huge pages" :
+		"normal pages");
+	dcb_printf(dcb, "Arena size:		%lu bytes\n", (unsigned long)arena_size);
+	dcb_printf(dcb, "Arena used:		%lu bytes (%d%%)\n",
+		(unsigned long)used, (int)(used * 100 / arena_size));
+	dcb_printf(dcb, "Objects in the arena:	%d\n", arena_stats.n_allocs);
+	dcb_printf(dcb, "Heap fallbacks:		%d\n", arena_stats.n_fallbacks);
+}
@@ -35,16 +35,109 @@
  * @endverbatim
  */
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <buffer.h>
 #include <atomic.h>
+#include <slab.h>
+#include <arena.h>
+#include <dcb.h>
 #include <skygw_debug.h>
 
+/**
+ * The memory of a buffer allocated by gwbuf_alloc. The header, the shared
+ * buffer and the data that follows them are a single allocation, which is
+ * released when the last GWBUF that refers to the data is freed. Clones
+ * have headers of their own from the clone pool.
+ */
+typedef struct {
+	GWBUF		hdr;		/*< The header of the original buffer */
+	SHARED_BUF	sbuf;		/*< The shared buffer, data follows it */
+} GWBUF_BLOCK;
+
+#define	GWBUF_BLOCK_OF(s)	((GWBUF_BLOCK *)((char *)(s) - offsetof(GWBUF_BLOCK, sbuf)))
+
+#define	GWBUF_N_POOLS	4
+
+/**
+ * The facts about a packet, referred to by the first buffer of the packet
+ * and its clones. The facts describe the packet that starts at start, so
+ * they are ignored once the buffer has been consumed past that point. A
+ * block that is shared by clones is never changed, recording a fact then
+ * gives the buffer a copy of its own.
+ */
+typedef struct gwbuf_info {
+	int		refcount;		/*< Buffers that refer to the block */
+	void		*start;			/*< Start of the packet */
+	unsigned int	set;			/*< Bitmap of the facts that are set */
+	long		value[GWBUF_INFO_MAX];	/*< The facts */
+} GWBUF_INFO;
+
+/**
+ * The size classes of the buffer pools. A buffer is allocated from the
+ * pool of the smallest class its data fits in, larger buffers come from
+ * the heap.
+ */
+static	unsigned int	pool_size[GWBUF_N_POOLS] = { 256, 4096, 16384, 32768 };
+static	char		*pool_name[GWBUF_N_POOLS] = {
+				"GWBUF 256", "GWBUF 4K", "GWBUF 16K", "GWBUF 32K" };
+static	SLAB_CACHE	*pools[GWBUF_N_POOLS];
+static	SLAB_CACHE	*clone_pool = NULL;
+static	SLAB_CACHE	*info_pool = NULL;
+static	int		n_heap_allocs = 0;	/*< Buffers too large for the pools */
+
+/**
+ * Return the pool of a size class, the pool is created on first use
+ *
+ * @param i	The size class
+ * @return	The pool or NULL if it can not be created
+ */
+static SLAB_CACHE *
+gwbuf_pool(int i)
+{
+	if (pools[i] == NULL)
+	{
+		pools[i] = slab_cache_alloc(pool_name[i],
+				sizeof(GWBUF_BLOCK) + pool_size[i]);
+		slab_cache_use_arena(pools[i]);
+	}
+	return pools[i];
+}
+
+/**
+ * Allocate the header of a buffer that shares the data of another one
+ *
+ * @return	A zeroed header or NULL if no memory is available
+ */
+static GWBUF *
+gwbuf_alloc_clone()
+{
+	if (clone_pool == NULL)
+		clone_pool = slab_cache_alloc("GWBUF clone", sizeof(GWBUF));
+	return (GWBUF *)slab_alloc(clone_pool);
+}
+
+/**
+ * Release the reference of a buffer to its packet facts
+ *
+ * @param buf	The buffer
+ */
+static void
+gwbuf_info_release(GWBUF *buf)
+{
+GWBUF_INFO	*info = buf->info;
+
+	buf->info = NULL;
+	if (info != NULL && atomic_add(&info->refcount, -1) == 1)
+		slab_free(info_pool, info);
+}
+
 /**
  * Allocate a new gateway buffer structure of size bytes.
  *
- * For now we allocate memory directly from malloc for buffer the management
- * structure and the actual data buffer itself. We may swap at a future date
- * to a more effecient mechanism.
+ * The header, shared buffer and data area are allocated together, from
+ * the per thread free lists of the pool of the size class the data fits
+ * in, or with a single malloc for data larger than the largest class.
  *
  * @param	size The size in bytes of the data area required
  * @return	Pointer to the buffer structure or NULL if memory could not
@@ -53,33 +146,42 @@
 GWBUF	*
 gwbuf_alloc(unsigned int size)
 {
+GWBUF_BLOCK	*block = NULL;
+SLAB_CACHE	*cache = NULL;
 GWBUF		*rval;
 SHARED_BUF	*sbuf;
+int		i;
 
-	// Allocate the buffer header
-	if ((rval = (GWBUF *)malloc(sizeof(GWBUF))) == NULL)
+	for (i = 0; i < GWBUF_N_POOLS; i++)
 	{
-		return NULL;
+		if (size <= pool_size[i])
+		{
+			cache = gwbuf_pool(i);
+			break;
+		}
 	}
-
-	// Allocate the shared data buffer
-	if ((sbuf = (SHARED_BUF *)malloc(sizeof(SHARED_BUF))) == NULL)
+	if (cache != NULL)
 	{
-		free(rval);
-		return NULL;
+		block = (GWBUF_BLOCK *)slab_alloc_nozero(cache);
 	}
-
-	// Allocate the space for the actual data
-	if ((sbuf->data = (unsigned char *)malloc(size)) == NULL)
+	else
+	{
+		block = (GWBUF_BLOCK *)malloc(sizeof(GWBUF_BLOCK) + size);
+		atomic_add(&n_heap_allocs, 1);
+	}
+	if (block == NULL)
 	{
-		free(rval);
-		free(sbuf);
 		return NULL;
 	}
+	rval = &block->hdr;
+	sbuf = &block->sbuf;
+	sbuf->data = (unsigned char *)(block + 1);
+	sbuf->refcount = 1;
+	sbuf->cache = cache;
 	rval->start = sbuf->data;
 	rval->end = rval->start + size;
-	sbuf->refcount = 1;
 	rval->sbuf = sbuf;
+	rval->info = NULL;
 	rval->next = NULL;
         rval->gwbuf_type = GWBUF_TYPE_UNDEFINED;
 	rval->command = 0;
@@ -88,20 +190,29 @@ SHARED_BUF	*sbuf;
 }
 
 /**
- * Free a gateway buffer
+ * Free a gateway buffer. The data is released with the last buffer that
+ * refers to it. The header of the original buffer is part of the data
+ * allocation, so it is only released with the data.
  *
  * @param buf The buffer to free
  */
 void
 gwbuf_free(GWBUF *buf)
 {
+SHARED_BUF	*sbuf = buf->sbuf;
+GWBUF_BLOCK	*block = GWBUF_BLOCK_OF(sbuf);
+bool		clone = (buf != &block->hdr);
+
 	CHK_GWBUF(buf);
-	if (atomic_add(&buf->sbuf->refcount, -1) == 1)
+	gwbuf_info_release(buf);
+	if (atomic_add(&sbuf->refcount, -1) == 1)
+	{
+		slab_free(sbuf->cache, block);
+	}
+	if (clone)
 	{
-                free(buf->sbuf->data);
-                free(buf->sbuf);
+		slab_free(clone_pool, buf);
 	}
-	free(buf);
 }
 
 /**
@@ -119,7 +230,7 @@ gwbuf_clone(GWBUF *buf)
 {
 GWBUF	*rval;
 
-	if ((rval = (GWBUF *)malloc(sizeof(GWBUF))) == NULL)
+	if ((rval = gwbuf_alloc_clone()) == NULL)
 	{
 		return NULL;
 	}
@@ -128,6 +239,8 @@ GWBUF	*rval;
 	rval->sbuf = buf->sbuf;
 	rval->start = buf->start;
 	rval->end = buf->end;
+	if ((rval->info = buf->info) != NULL)
+		atomic_add(&rval->info->refcount, 1);
         rval->gwbuf_type = buf->gwbuf_type;
 	rval->next = NULL;
         CHK_GWBUF(rval);
@@ -145,7 +258,7 @@ GWBUF *gwbuf_clone_portion(
         CHK_GWBUF(buf);
         ss_dassert(start_offset+length <= GWBUF_LENGTH(buf));
         
-        if ((clonebuf = (GWBUF *)malloc(sizeof(GWBUF))) == NULL)
+        if ((clonebuf = gwbuf_alloc_clone()) == NULL)
         {
                 return NULL;
         }
@@ -154,6 +267,7 @@ GWBUF *gwbuf_clone_portion(
         clonebuf->start = (void *)((char*)buf->start)+start_offset;
         clonebuf->end = (void *)((char *)clonebuf->start)+length;
         clonebuf->gwbuf_type = buf->gwbuf_type; /*< clone the type for now */ 
+        clonebuf->info = NULL;
         clonebuf->next = NULL;
         CHK_GWBUF(clonebuf);
         return clonebuf;
@@ -315,5 +429,406 @@ bool gwbuf_set_type(
         return succp;
 }
 
+/**
+ * Move a cursor past the buffers it has read to the end of, so that the
+ * buffer of the cursor has data left unless the end of the list is reached.
+ *
+ * @param cur	The cursor
+ */
+static void
+gwbuf_cursor_normalize(GWBUF_CURSOR *cur)
+{
+	while (cur->buf && cur->offset >= GWBUF_LENGTH(cur->buf))
+	{
+		cur->offset -= GWBUF_LENGTH(cur->buf);
+		cur->buf = cur->buf->next;
+	}
+}
+
+/**
+ * Set a cursor to the start of a linked list of buffers
+ *
+ * @param cur	The cursor
+ * @param head	The head of the linked list, may be NULL
+ */
+void
+gwbuf_cursor_init(GWBUF_CURSOR *cur, GWBUF *head)
+{
+	cur->buf = head;
+	cur->offset = 0;
+	gwbuf_cursor_normalize(cur);
+}
 
+/**
+ * Move a cursor forward. A cursor that reaches the end of the list stays
+ * there.
+ *
+ * @param cur	The cursor
+ * @param len	The number of bytes to move by
+ * @return	Non-zero if the list had len bytes left to skip
+ */
+int
+gwbuf_cursor_skip(GWBUF_CURSOR *cur, unsigned int len)
+{
+int	rval;
 
+	if (cur->buf == NULL)
+		return len == 0;
+	cur->offset += len;
+	gwbuf_cursor_normalize(cur);
+	rval = cur->buf != NULL || cur->offset == 0;
+	if (cur->buf == NULL)
+		cur->offset = 0;
+	return rval;
+}
+
+/**
+ * Copy bytes from the position of a cursor without moving it. The copy
+ * stops at the end of the list.
+ *
+ * @param cur	The cursor
+ * @param len	The number of bytes to copy
+ * @param dest	Where to copy the bytes to
+ * @return	The number of bytes copied
+ */
+unsigned int
+gwbuf_cursor_peek(GWBUF_CURSOR *cur, unsigned int len, unsigned char *dest)
+{
+GWBUF		*buf = cur->buf;
+unsigned int	offset = cur->offset, n, copied = 0;
+
+	while (buf && copied < len)
+	{
+		n = GWBUF_LENGTH(buf) - offset;
+		if (n > len - copied)
+			n = len - copied;
+		memcpy(dest + copied, (unsigned char *)GWBUF_DATA(buf) + offset, n);
+		copied += n;
+		offset = 0;
+		buf = buf->next;
+	}
+	return copied;
+}
+
+/**
+ * Copy bytes from the position of a cursor and move the cursor past them
+ *
+ * @param cur	The cursor
+ * @param len	The number of bytes to copy
+ * @param dest	Where to copy the bytes to
+ * @return	The number of bytes copied
+ */
+unsigned int
+gwbuf_cursor_read(GWBUF_CURSOR *cur, unsigned int len, unsigned char *dest)
+{
+unsigned int	n;
+
+	n = gwbuf_cursor_peek(cur, len, dest);
+	gwbuf_cursor_skip(cur, n);
+	return n;
+}
+
+/**
+ * Read a MySQL length encoded integer and move the cursor past it. The
+ * cursor is not moved if the integer is not complete or the first byte
+ * is the NULL (0xfb) or error (0xff) marker.
+ *
+ * @param cur	The cursor
+ * @param val	Where to store the value
+ * @return	The number of bytes read, 0 if no integer was read
+ */
+int
+gwbuf_cursor_read_lenenc(GWBUF_CURSOR *cur, unsigned long *val)
+{
+unsigned char	bytes[9];
+int		len, i;
+
+	if (gwbuf_cursor_peek(cur, 1, bytes) != 1)
+		return 0;
+	switch (bytes[0])
+	{
+	case 0xfb:
+	case 0xff:
+		return 0;
+	case 0xfc:
+		len = 3;
+		break;
+	case 0xfd:
+		len = 4;
+		break;
+	case 0xfe:
+		len = 9;
+		break;
+	default:
+		*val = bytes[0];
+		gwbuf_cursor_skip(cur, 1);
+		return 1;
+	}
+	if (gwbuf_cursor_peek(cur, len, bytes) != len)
+		return 0;
+	*val = 0;
+	for (i = len - 1; i > 0; i--)
+		*val = (*val << 8) | bytes[i];
+	gwbuf_cursor_skip(cur, len);
+	return len;
+}
+
+/**
+ * Return a pointer to bytes at the position of a cursor that can be read
+ * as a contiguous block, without moving the cursor. The bytes are only
+ * copied, into the scratch area, if they span more than one buffer.
+ *
+ * @param cur		The cursor
+ * @param len		The number of bytes
+ * @param scratch	An area of at least len bytes for the copy
+ * @return		The bytes or NULL if the list has fewer bytes left
+ */
+unsigned char *
+gwbuf_cursor_contiguous(GWBUF_CURSOR *cur, unsigned int len,
+			unsigned char *scratch)
+{
+	if (cur->buf && GWBUF_LENGTH(cur->buf) - cur->offset >= len)
+		return (unsigned char *)GWBUF_DATA(cur->buf) + cur->offset;
+	if (gwbuf_cursor_peek(cur, len, scratch) != len)
+		return NULL;
+	return scratch;
+}
+
+/**
+ * Copy data from anywhere in a linked list of buffers
+ *
+ * @param head		The head of the linked list
+ * @param offset	Offset of the first byte to copy
+ * @param len		The number of bytes to copy
+ * @param dest		Where to copy the bytes to
+ * @return		The number of bytes copied, less than len if the
+ *			list ends before
+ */
+unsigned int
+gwbuf_copy_data(GWBUF *head, unsigned int offset, unsigned int len,
+		unsigned char *dest)
+{
+GWBUF_CURSOR	cur;
+
+	gwbuf_cursor_init(&cur, head);
+	if (!gwbuf_cursor_skip(&cur, offset))
+		return 0;
+	return gwbuf_cursor_peek(&cur, len, dest);
+}
+
+/**
+ * Split a linked list of buffers in two without copying data. Buffers that
+ * are wholly before the split point are moved to the new list, a buffer
+ * that the split point falls into is shared by both lists.
+ *
+ * @param head		The head of the linked list, set to the rest of the
+ *			list or NULL if nothing is left
+ * @param length	The number of bytes to split off
+ * @return		The list of the first length bytes
+ */
+GWBUF *
+gwbuf_split(GWBUF **head, unsigned int length)
+{
+GWBUF	*rval = NULL, *tail = NULL, *buf = *head, *part;
+
+	while (buf && length > 0)
+	{
+		if (GWBUF_LENGTH(buf) <= length)
+		{
+			length -= GWBUF_LENGTH(buf);
+			part = buf;
+			buf = buf->next;
+			part->next = NULL;
+		}
+		else
+		{
+			if ((part = gwbuf_clone_portion(buf, 0, length)) == NULL)
+				break;
+			/*< The facts stay with the packet that is split off */
+			if (rval == NULL)
+			{
+				part->info = buf->info;
+				buf->info = NULL;
+			}
+			GWBUF_CONSUME(buf, length);
+			length = 0;
+		}
+		if (tail)
+			tail->next = part;
+		else
+			rval = part;
+		tail = part;
+	}
+	*head = buf;
+	return rval;
+}
+
+/**
+ * Take the first complete MySQL packet off a linked list of buffers. The
+ * packet may span any number of buffers and may share its last buffer with
+ * the next packet, no data is copied. The length and the command of the
+ * packet are recorded in a block of facts that belongs to the packet.
+ *
+ * @param head	The head of the linked list, set to the rest of the list
+ * @return	The packet or NULL if the list does not hold a complete packet
+ */
+GWBUF *
+gwbuf_mysql_next_packet(GWBUF **head)
+{
+unsigned char	hdr[5];
+unsigned int	len;
+GWBUF		*packet;
+
+	if (*head == NULL || gwbuf_copy_data(*head, 0, 5, hdr) < 3)
+		return NULL;
+	len = (hdr[0] | (hdr[1] << 8) | (hdr[2] << 16)) + 4;
+	if (gwbuf_length(*head) < len)
+		return NULL;
+	if ((packet = gwbuf_split(head, len)) != NULL)
+	{
+		gwbuf_set_info(packet, GWBUF_INFO_PACKET_LEN, len - 4);
+		if (len > 4)
+			gwbuf_set_info(packet, GWBUF_INFO_COMMAND, hdr[4]);
+	}
+	return packet;
+}
+
+/**
+ * Record a fact about the packet that starts at a buffer. The facts belong
+ * to the buffer and the clones made after this, a clone made before keeps
+ * the facts it had.
+ *
+ * The facts are set by the thread that owns the packet, before the packet
+ * is shared with another thread, the functions that return them never
+ * change them.
+ *
+ * @param buf	The first buffer of the packet
+ * @param type	The fact to record
+ * @param value	The value of the fact
+ */
+void
+gwbuf_set_info(GWBUF *buf, gwbuf_info_t type, long value)
+{
+GWBUF_INFO	*info = buf->info;
+GWBUF_INFO	*copy;
+
+	ss_dassert(type >= 0 && type < GWBUF_INFO_MAX);
+	if (info == NULL || info->start != buf->start || info->refcount > 1)
+	{
+		if (info_pool == NULL)
+			info_pool = slab_cache_alloc("GWBUF info", sizeof(GWBUF_INFO));
+		if ((copy = (GWBUF_INFO *)slab_alloc(info_pool)) == NULL)
+			return;
+		/*< Keep the facts of the packet, drop those of an earlier one */
+		copy->set = 0;
+		if (info != NULL && info->start == buf->start)
+		{
+			copy->set = info->set;
+			memcpy(copy->value, info->value, sizeof(copy->value));
+		}
+		copy->refcount = 1;
+		copy->start = buf->start;
+		gwbuf_info_release(buf);
+		buf->info = info = copy;
+	}
+	info->value[type] = value;
+	info->set |= 1U << type;
+}
+
+/**
+ * Return a fact about the packet that starts at a buffer
+ *
+ * @param buf	The first buffer of the packet
+ * @param type	The fact to return
+ * @param value	Where to store the value of the fact
+ * @return	True if the fact has been recorded
+ */
+bool
+gwbuf_get_info(GWBUF *buf, gwbuf_info_t type, long *value)
+{
+GWBUF_INFO	*info = buf->info;
+
+	ss_dassert(type >= 0 && type < GWBUF_INFO_MAX);
+	if (info == NULL || info->start != buf->start ||
+	    (info->set & (1U << type)) == 0)
+		return false;
+	*value = info->value[type];
+	return true;
+}
+
+/**
+ * Return the command of the MySQL packet that starts at a buffer. The
+ * command recorded when the packet was split off is used, otherwise it is
+ * read from the packet, wherever in the chain it is.
+ *
+ * @param buf	The first buffer of the packet
+ * @return	The command or -1 if the packet is too short
+ */
+int
+gwbuf_mysql_command(GWBUF *buf)
+{
+long		value;
+unsigned char	command;
+
+	if (gwbuf_get_info(buf, GWBUF_INFO_COMMAND, &value))
+		return (int)value;
+	if (gwbuf_copy_data(buf, 4, 1, &command) != 1)
+		return -1;
+	return command;
+}
+
+/**
+ * Return the payload length of the MySQL packet that starts at a buffer,
+ * from the recorded fact if there is one.
+ *
+ * @param buf	The first buffer of the packet
+ * @return	The payload length or -1 if the header is not complete
+ */
+long
+gwbuf_mysql_packet_len(GWBUF *buf)
+{
+long		value;
+unsigned char	hdr[3];
+
+	if (gwbuf_get_info(buf, GWBUF_INFO_PACKET_LEN, &value))
+		return value;
+	if (gwbuf_copy_data(buf, 0, 3, hdr) != 3)
+		return -1;
+	return hdr[0] | (hdr[1] << 8) | (hdr[2] << 16);
+}
+
+/**
+ * Print the usage of the buffer pools to a DCB. An allocation that finds
+ * a free buffer in a pool is a hit, one that has to go to the heap is a
+ * miss.
+ *
+ * @param dcb	The DCB to print to
+ */
+void
+dprintBufferPools(DCB *dcb)
+{
+SLAB_CACHE	*cache;
+SLAB_STATS	total;
+int		i;
+
+	dcb_printf(dcb, "%-12s | %6s | %10s | %10s | %10s | %8s\n",
+		"Pool", "Size", "Allocs", "Hits", "Misses", "In use");
+	dcb_printf(dcb, "---------------------------------------------------------------------\n");
+	for (i = 0; i <= GWBUF_N_POOLS; i++)
+	{
+		cache = i < GWBUF_N_POOLS ? pools[i] : clone_pool;
+		if (cache == NULL)
+			continue;
+		slab_cache_stats(cache, &total);
+		dcb_printf(dcb, "%-12s | %6d | %10d | %10d | %10d | %8d\n",
+			cache->name,
+			(int)(i < GWBUF_N_POOLS ? pool_size[i] : sizeof(GWBUF)),
+			total.n_allocs,
+			total.n_allocs - total.n_misses,
+			total.n_misses,
+			total.n_allocs - total.n_frees);
+	}
+	dcb_printf(dcb, "Buffers larger than %u bytes allocated from the heap: %d\n",
+		pool_size[GWBUF_N_POOLS - 1], n_heap_allocs);
+	dprintArena(dcb);
+}
@@ -555,6 +555,156 @@ config_threadcount()
 	return gateway.n_threads;
 }
 
+/**
+ * Return the epoll_per_thread setting. When set every polling thread
+ * has an epoll set of its own and DCBs stay on the thread that added them.
+ *
+ * @return	Non-zero if each polling thread has its own epoll set
+ */
+int
+config_epoll_per_thread()
+{
+	return gateway.epoll_per_thread;
+}
+
+/**
+ * Return the time a polling thread keeps polling for events before it
+ * blocks in epoll_wait.
+ *
+ * @return	The spin time in microseconds
+ */
+int
+config_poll_spin_time()
+{
+	return gateway.poll_spin_time;
+}
+
+/**
+ * Return the size of the write queue of a DCB above which the peer DCBs
+ * in the same session stop reading.
+ *
+ * @return	The high water mark in bytes, 0 if there is no limit
+ */
+unsigned int
+config_writeq_high_water()
+{
+	return gateway.writeq_high_water;
+}
+
+/**
+ * Return the size the write queue of a DCB must drain to before the peer
+ * DCBs that stopped reading are started again.
+ *
+ * @return	The low water mark in bytes
+ */
+unsigned int
+config_writeq_low_water()
+{
+	return gateway.writeq_low_water;
+}
+
+/**
+ * Return the name of the I/O event engine the polling threads use.
+ *
+ * @return	The engine name or NULL for the default epoll engine
+ */
+char *
+config_poll_engine()
+{
+	return gateway.poll_engine;
+}
+
+/**
+ * Return the time a client has to complete the authentication.
+ *
+ * @return	The timeout in seconds, 0 for no timeout
+ */
+int
+config_client_auth_timeout()
+{
+	return gateway.client_auth_timeout;
+}
+
+/**
+ * Return the time a client connection may stay idle between a reply and
+ * the next query.
+ *
+ * @return	The timeout in seconds, 0 for no timeout
+ */
+int
+config_client_idle_timeout()
+{
+	return gateway.client_idle_timeout;
+}
+
+/**
+ * Return the time a backend connection has to connect and authenticate.
+ *
+ * @return	The timeout in seconds, 0 for no timeout
+ */
+int
+config_backend_connect_timeout()
+{
+	return gateway.backend_connect_timeout;
+}
+
+/**
+ * Return the time a backend has to start replying to a query.
+ *
+ * @return	The timeout in seconds, 0 for no timeout
+ */
+int
+config_query_timeout()
+{
+	return gateway.query_timeout;
+}
+
+/**
+ * Return whether the polling threads write the data written to a DCB while
+ * processing a batch of events once, at the end of the batch.
+ *
+ * @return	Non-zero if the writes are deferred
+ */
+int
+config_deferred_flush()
+{
+	return gateway.deferred_flush;
+}
+
+/**
+ * Return how new clients are spread over the polling threads.
+ *
+ * @return	The policy name or NULL to keep them on the accepting thread
+ */
+char *
+config_accept_balance()
+{
+	return gateway.accept_balance;
+}
+
+/**
+ * Return the number of bytes a session may hold in buffers before its
+ * client stops reading.
+ *
+ * @return	The limit in bytes, 0 if there is no limit
+ */
+unsigned int
+config_session_mem_limit()
+{
+	return gateway.session_mem_limit;
+}
+
+/**
+ * Return the size of the huge page arena the buffer pools allocate from.
+ *
+ * @return	The size in megabytes, 0 if there is no arena
+ */
+int
+config_buffer_arena_size()
+{
+	return gateway.buffer_arena_size;
+}
+
 /**
  * Configuration handler for items in the global [MaxScale] section
  *
@@ -567,6 +717,34 @@ handle_global_item(const char *name, const char *value)
 {
 	if (strcmp(name, "threads") == 0) {
 		gateway.n_threads = atoi(value);
+	} else if (strcmp(name, "epoll_per_thread") == 0) {
+		gateway.epoll_per_thread = atoi(value);
+	} else if (strcmp(name, "poll_spin_time") == 0) {
+		gateway.poll_spin_time = atoi(value);
+	} else if (strcmp(name, "writeq_high_water") == 0) {
+		gateway.writeq_high_water = strtoul(value, NULL, 10);
+	} else if (strcmp(name, "writeq_low_water") == 0) {
+		gateway.writeq_low_water = strtoul(value, NULL, 10);
+	} else if (strcmp(name, "poll_engine") == 0) {
+		free(gateway.poll_engine);
+		gateway.poll_engine = strdup(value);
+	} else if (strcmp(name, "client_auth_timeout") == 0) {
+		gateway.client_auth_timeout = atoi(value);
+	} else if (strcmp(name, "client_idle_timeout") == 0) {
+		gateway.client_idle_timeout = atoi(value);
+	} else if (strcmp(name, "backend_connect_timeout") == 0) {
+		gateway.backend_connect_timeout = atoi(value);
+	} else if (strcmp(name, "query_timeout") == 0) {
+		gateway.query_timeout = atoi(value);
+	} else if (strcmp(name, "deferred_flush") == 0) {
+		gateway.deferred_flush = atoi(value);
+	} else if (strcmp(name, "accept_balance") == 0) {
+		free(gateway.accept_balance);
+		gateway.accept_balance = strdup(value);
+	} else if (strcmp(name, "session_mem_limit") == 0) {
+		gateway.session_mem_limit = strtoul(value, NULL, 10);
+	} else if (strcmp(name, "buffer_arena_size") == 0) {
+		gateway.buffer_arena_size = atoi(value);
         } else {
                 return 0;
         }
@@ -580,6 +758,21 @@ static void
 global_defaults()
 {
 	gateway.n_threads = 1;
+	gateway.epoll_per_thread = 0;
+	gateway.poll_spin_time = 0;
+	gateway.writeq_high_water = 16 * 1024 * 1024;
+	gateway.writeq_low_water = 8 * 1024 * 1024;
+	free(gateway.poll_engine);
+	gateway.poll_engine = NULL;
+	gateway.client_auth_timeout = 10;
+	gateway.client_idle_timeout = 0;
+	gateway.backend_connect_timeout = 10;
+	gateway.query_timeout = 0;
+	gateway.deferred_flush = 0;
+	free(gateway.accept_balance);
+	gateway.accept_balance = NULL;
+	gateway.session_mem_limit = 0;
+	gateway.buffer_arena_size = 0;
 }
 
 /**
@@ -54,6 +54,7 @@ static int uh_cmpfun( void* v1, void* v2);
 static void *uh_keydup(void* key);
 static void uh_keyfree( void* key);
 static int uh_hfun( void* key);
+static int uh_keyfn(void* key, char *buf, int len);
 char *mysql_users_fetch(USERS *users, MYSQL_USER_HOST *key);
 char *mysql_format_user_entry(void *data);
 
@@ -406,7 +407,7 @@ USERS	*rval;
 	if ((rval = calloc(1, sizeof(USERS))) == NULL)
 		return NULL;
 
-	if ((rval->data = hashtable_alloc(USERS_HASHTABLE_DEFAULT_SIZE, uh_hfun, uh_cmpfun)) == NULL) {
+	if ((rval->data = hashtable_alloc_open(USERS_HASHTABLE_DEFAULT_SIZE, uh_hfun, uh_cmpfun, uh_keyfn)) == NULL) {
 		free(rval);
 		return NULL;
 	}
@@ -477,6 +478,34 @@ static int uh_hfun( void* key) {
 	}
 }
 
+/**
+ * The inline key function of the MySQL users table: the IPv4 address
+ * followed by the user name. Equal keys give equal bytes, so the table
+ * compares the bytes instead of calling uh_cmpfun.
+ *
+ * @param key	The key value, i.e. username@host (IPv4)
+ * @param buf	The buffer for the bytes
+ * @param len	The size of the buffer
+ * @return	The number of bytes of the key
+ */
+
+static int uh_keyfn(void* key, char *buf, int len) {
+	MYSQL_USER_HOST *hu = (MYSQL_USER_HOST *) key;
+	int ulen;
+
+	if (hu == NULL || hu->user == NULL)
+		return len + 1;
+
+	ulen = strlen(hu->user);
+	if (sizeof(hu->ipv4.sin_addr.s_addr) + ulen > len)
+		return sizeof(hu->ipv4.sin_addr.s_addr) + ulen;
+
+	memcpy(buf, &hu->ipv4.sin_addr.s_addr, sizeof(hu->ipv4.sin_addr.s_addr));
+	memcpy(buf + sizeof(hu->ipv4.sin_addr.s_addr), hu->user, ulen);
+
+	return sizeof(hu->ipv4.sin_addr.s_addr) + ulen;
+}
+
 /**
  * The compare function we use for compare MySQL users as: users@hosts.
  * Currently only IPv4 addresses are supported
@@ -50,10 +50,15 @@
  *
  * @endverbatim
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
 #include <dcb.h>
 #include <spinlock.h>
 #include <server.h>
@@ -64,18 +69,54 @@
 #include <errno.h>
 #include <gw.h>
 #include <poll.h>
+#include <config.h>
 #include <atomic.h>
+#include <slab.h>
+#include <timer.h>
+#include <statistics.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
 
 extern int lm_enabled_logfiles_bitmask;
 
 static	DCB		*allDCBs = NULL;	/* Diagnotics need a list of DCBs */
-static	DCB		*zombies = NULL;
-static	SPINLOCK	dcbspin = SPINLOCK_INIT;
-static	SPINLOCK	zombiespin = SPINLOCK_INIT;
+static	DCB		*zombies[2] = { NULL, NULL }; /* Zombies of odd and even epochs */
+static	SPINLOCK	dcbspin = SPINLOCK_INIT_NAMED("dcbspin");
+static	SPINLOCK	zombiespin = SPINLOCK_INIT_NAMED("zombiespin");
+static	int		zombie_epoch = 1;	/* The current reclamation epoch */
+static	int		epoch_pending = 0;	/* Threads yet to pass zombie_epoch */
+static	int		epoch_threads = 0;	/* Threads taking part in reclamation */
+static	bool		epoch_advancing = false; /* Waiting for threads to pass the epoch */
+static	int		epoch_wake = 0;		/* A new epoch needs the threads woken */
+static	__thread int	thread_epoch = 0;	/* Epoch last seen by the thread, 0 if none */
+static	SLAB_CACHE	*dcb_cache = NULL;	/* Cache of free DCBs */
+static	__thread bool	defer_writes = false;	/* Writes wait for dcb_flush_deferred */
+static	__thread DCB	*deferred = NULL;	/* DCBs with deferred writes */
+
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define	DCB_IOV_MAX	IOV_MAX
+#else
+#define	DCB_IOV_MAX	1024	/*< Max. number of buffers in one writev */
+#endif
+
+#define	DCB_SPLICE_SIZE	65536	/*< Bytes moved into the pipe by one splice */
+#define	DCB_READ_COPY	(MAX_BUFFER_SIZE / 2) /*< Reads copied to a smaller buffer */
 
 static void dcb_final_free(DCB *dcb);
+static void dcb_advance_epoch();
+static DCB  *dcb_epoch_passed();
+static void dcb_free_victims(DCB *dcb);
+static int  dcb_writev_queue(DCB *dcb, GWBUF **queuep, int *saved_errno);
+static void dcb_check_high_water(DCB *dcb);
+static void dcb_set_writeqlen(DCB *dcb, unsigned int len);
+static void dcb_check_low_water(DCB *dcb);
+static void dcb_start_throttled(DCB *dcb);
+static void dcb_leave_throttled(DCB *dcb);
+static void dcb_timeout(TIMER *timer, void *data);
+static void dcb_requeue_zombie(DCB *dcb);
+static void dcb_posted_write(void *arg1, void *arg2);
+static void dcb_splice_flush(DCB *dcb, DCB *peer);
+static void dcb_splice_hangup(DCB *dcb);
 static bool dcb_set_state_nomutex(
         DCB*              dcb,
         const dcb_state_t new_state,
@@ -83,7 +124,7 @@ static bool dcb_set_state_nomutex(
 
 DCB* dcb_get_zombies(void)
 {
-        return zombies;
+        return zombies[0] != NULL ? zombies[0] : zombies[1];
 }
 
 /**
@@ -99,7 +140,9 @@ DCB * dcb_alloc(
 {
 DCB	*rval;
 
-	if ((rval = calloc(1, sizeof(DCB))) == NULL)
+	if (dcb_cache == NULL)
+		dcb_cache = slab_cache_alloc("DCB", sizeof(DCB));
+	if ((rval = slab_alloc(dcb_cache)) == NULL)
 	{
 		return NULL;
 	}
@@ -108,21 +151,25 @@ DCB	*rval;
         rval->dcb_chk_tail = CHK_NUM_DCB;
 #endif
         rval->dcb_role = role;
-#if 1
-        simple_mutex_init(&rval->dcb_write_lock, "DCB write mutex");
-        simple_mutex_init(&rval->dcb_read_lock, "DCB read mutex");
-        rval->dcb_write_active = false;
-        rval->dcb_read_active = false;
-#endif
-        spinlock_init(&rval->dcb_initlock);
-	spinlock_init(&rval->writeqlock);
-	spinlock_init(&rval->delayqlock);
-	spinlock_init(&rval->authlock);
+        rval->evq_events = 0;
+        spinlock_init_named(&rval->dcb_initlock, "dcb initlock");
+	spinlock_init_named(&rval->writeqlock, "dcb writeqlock");
+	spinlock_init_named(&rval->delayqlock, "dcb delayqlock");
+	spinlock_init_named(&rval->authlock, "dcb authlock");
         rval->fd = -1;
 	memset(&rval->stats, 0, sizeof(DCBSTATS));	// Zero the statistics
 	rval->state = DCB_STATE_ALLOC;
-	bitmask_init(&rval->memdata.bitmask);
+	rval->memdata.epoch = 0;
+	rval->memdata.n_mail = 0;
 	rval->next = NULL;
+	timer_init(&rval->timer, dcb_timeout, rval);
+	rval->spliced = false;
+	rval->splice_peer = NULL;
+	rval->splice_pipe[0] = -1;
+	rval->splice_pipe[1] = -1;
+	rval->splice_pending = 0;
+	rval->flush_pending = false;
+	rval->next_deferred = NULL;
 
 	spinlock_acquire(&dcbspin);
 	if (allDCBs == NULL)
@@ -171,6 +218,7 @@ void
 dcb_add_to_zombieslist(DCB *dcb)
 {
         bool        succp = false;
+        bool        advanced = false;
         dcb_state_t prev_state = DCB_STATE_UNDEFINED;
         
         CHK_DCB(dcb);        
@@ -188,43 +236,20 @@ dcb_add_to_zombieslist(DCB *dcb)
                 spinlock_release(&zombiespin);
                 return;
         }
-#if 1
         /*<
-         * Add closing dcb to the top of the list.
+         * Add closing dcb to the zombies of the current epoch. If the
+         * threads are not already passing an epoch a new one is started,
+         * the dcb can be freed once every polling thread has seen it.
          */
-        dcb->memdata.next = zombies;
-        zombies = dcb;
-#else
-	if (zombies == NULL) {
-		zombies = dcb;
-        } else {
-		DCB *ptr = zombies;
-		while (ptr->memdata.next)
-		{
-                        ss_info_dassert(
-                                ptr->memdata.next->state == DCB_STATE_ZOMBIE,
-                                "Next zombie is not in DCB_STATE_ZOMBIE state");
-
-                        ss_info_dassert(
-                                ptr != dcb,
-                                "Attempt to add DCB to zombies list although it "
-                                "is already there.");
-                        
-			if (ptr == dcb)
-			{
-				LOGIF(LE, (skygw_log_write_flush(
-                                        LOGFILE_ERROR,
-                                        "Error : Attempt to add DCB to zombies "
-                                        "list when it is already in the list")));
-				break;
-			}
-			ptr = ptr->memdata.next;
-		}
-		if (ptr != dcb) {
-                        ptr->memdata.next = dcb;
-                }
-	}
-#endif
+        dcb->memdata.epoch = zombie_epoch;
+        dcb->memdata.next = zombies[zombie_epoch & 1];
+        zombies[zombie_epoch & 1] = dcb;
+
+        if (!epoch_advancing)
+        {
+                dcb_advance_epoch();
+                advanced = true;
+        }
         /*<
          * Set state which indicates that it has been added to zombies
          * list.
@@ -233,6 +258,12 @@ dcb_add_to_zombieslist(DCB *dcb)
         ss_info_dassert(succp, "Failed to set DCB_STATE_ZOMBIE");
         
 	spinlock_release(&zombiespin);
+        /*<
+         * Make idle polling threads pass the new epoch. The threads have
+         * already been woken for an epoch that is in progress.
+         */
+        if (advanced)
+                poll_wake();
 }
 
 
@@ -251,6 +282,12 @@ dcb_final_free(DCB *dcb)
         CHK_DCB(dcb);
         ss_info_dassert(dcb->state == DCB_STATE_DISCONNECTED,
                         "dcb not in DCB_STATE_DISCONNECTED state.");
+        timer_cancel(&dcb->timer);
+        if (dcb->splice_pipe[0] != -1)
+        {
+                close(dcb->splice_pipe[0]);
+                close(dcb->splice_pipe[1]);
+        }
 
 	/*< First remove this DCB from the chain */
 	spinlock_acquire(&dcbspin);
@@ -287,116 +324,131 @@ dcb_final_free(DCB *dcb)
                         /*<
                          * Remove reference from session if dcb is client.
                          */
+                        spinlock_acquire(&local_session->ses_lock);
                         if (local_session->client == dcb) {
                             local_session->client = NULL;
                         }
+                        spinlock_release(&local_session->ses_lock);
 	                dcb->session = NULL;                        
+                        /*< Data that was still queued is dropped */
+                        session_mem_account(local_session, -dcb->mem_buffered);
 			session_free(local_session);
 		}
 	}
 
 	if (dcb->protocol != NULL)
-		free(dcb->protocol);
+		slab_free(dcb->protocol_cache, dcb->protocol);
 	if (dcb->data)
-		free(dcb->data);
+		slab_free(dcb->data_cache, dcb->data);
 	if (dcb->remote)
 		free(dcb->remote);
-	bitmask_free(&dcb->memdata.bitmask);
-        simple_mutex_done(&dcb->dcb_read_lock);
-        simple_mutex_done(&dcb->dcb_write_lock);
-	free(dcb);
+	slab_free(dcb_cache, dcb);
 }
 
 /**
- * Process the DCB zombie queue
+ * Start a new reclamation epoch. Every polling thread that takes part in
+ * the reclamation has to pass the new epoch before the zombies of the
+ * previous epoch can be freed.
  *
- * This routine is called by each of the polling threads with
- * the thread id of the polling thread. It must clear the bit in
- * the memdata bitmask for the polling thread that calls it. If the
- * operation of clearing this bit means that no bits are set in
- * the memdata.bitmask then the DCB is no longer able to be 
- * referenced and it can be finally removed.
+ * Must be called with the zombiespin held.
+ */
+static void
+dcb_advance_epoch()
+{
+        zombie_epoch++;
+        epoch_pending = epoch_threads;
+        epoch_advancing = true;
+}
+
+/**
+ * Called when all the polling threads have passed the current epoch. The
+ * zombies of the previous epoch can no longer be referenced by any thread
+ * and are returned for freeing. If zombies have been added during the
+ * current epoch a new epoch is started for them, and dcb_free_victims
+ * wakes up the threads to pass it.
  *
- * @param	threadid	The thread ID of the caller
+ * Must be called with the zombiespin held.
+ *
+ * @return The list of DCBs that can be freed
  */
-DCB*
-dcb_process_zombies(int threadid)
+static DCB *
+dcb_epoch_passed()
 {
-DCB	*ptr, *lptr;
-DCB*    dcb_list = NULL;
-DCB*    dcb = NULL;
-bool    succp = false;
+DCB	*victims;
 
-	/*<
-	 * Perform a dirty read to see if there is anything in the queue.
-	 * This avoids threads hitting the queue spinlock when the queue 
-	 * is empty. This will really help when the only entry is being
-	 * freed, since the queue is updated before the expensive call to
-	 * dcb_final_free.
-	 */
-	if (!zombies)
-		return NULL;
+        victims = zombies[(zombie_epoch - 1) & 1];
+        zombies[(zombie_epoch - 1) & 1] = NULL;
 
-	spinlock_acquire(&zombiespin);
-	ptr = zombies;
-	lptr = NULL;
-	while (ptr)
-	{                    
-		bitmask_clear(&ptr->memdata.bitmask, threadid);
-		if (bitmask_isallclear(&ptr->memdata.bitmask))
-		{
-			/*<
-			 * Remove the DCB from the zombie queue
- 			 * and call the final free routine for the
-			 * DCB
-			 *
-			 * ptr is the DCB we are processing
-			 * lptr is the previous DCB on the zombie queue
-			 * or NULL if the DCB is at the head of the queue
-			 * tptr is the DCB after the one we are processing
-			 * on the zombie queue
-			 */
-			DCB	*tptr = ptr->memdata.next;
-			if (lptr == NULL)
-				zombies = tptr;
-			else
-				lptr->memdata.next = tptr;
-                        LOGIF(LD, (skygw_log_write_flush(
-                                LOGFILE_DEBUG,
-                                "%lu [dcb_process_zombies] Remove dcb %p fd %d "
-                                "in state %s from zombies list.",
-                                pthread_self(),
-                                ptr,
-                                ptr->fd,
-                                STRDCBSTATE(ptr->state)))); 
-                        ss_info_dassert(ptr->state == DCB_STATE_ZOMBIE,
-                                        "dcb not in DCB_STATE_ZOMBIE state.");
-                        /*<
-                         * Move dcb to linked list of victim dcbs.
-                         */
-                        if (dcb_list == NULL) {
-                                dcb_list = ptr;
-                                dcb = dcb_list;
-                        } else {
-                                dcb->memdata.next = ptr;
-                                dcb = dcb->memdata.next;
-                        }
-                        dcb->memdata.next = NULL;
-			ptr = tptr;
-		}
-		else
-		{
-			lptr = ptr;
-			ptr = ptr->memdata.next;
-		}
-	}
-	spinlock_release(&zombiespin);
+        if (zombies[zombie_epoch & 1] != NULL)
+        {
+                dcb_advance_epoch();
+                epoch_wake = 1;
+        }
+        else
+        {
+                epoch_advancing = false;
+        }
+        return victims;
+}
+
+/**
+ * Put a zombie that can not be freed yet back to the zombies of the
+ * current epoch.
+ *
+ * @param dcb	The DCB
+ */
+static void
+dcb_requeue_zombie(DCB *dcb)
+{
+bool    advanced = false;
+
+        spinlock_acquire(&zombiespin);
+        dcb->memdata.epoch = zombie_epoch;
+        dcb->memdata.next = zombies[zombie_epoch & 1];
+        zombies[zombie_epoch & 1] = dcb;
+
+        if (!epoch_advancing)
+        {
+                dcb_advance_epoch();
+                advanced = true;
+        }
+        spinlock_release(&zombiespin);
+        if (advanced)
+                poll_wake();
+}
+
+/**
+ * Close and free the DCBs of a list of zombies that can no longer be
+ * referenced by any polling thread.
+ *
+ * @param dcb	The list of DCBs, linked by memdata.next
+ */
+static void
+dcb_free_victims(DCB *dcb)
+{
+bool    succp = false;
+
+        if (epoch_wake && __sync_lock_test_and_set(&epoch_wake, 0))
+        {
+                poll_wake();
+        }
 
-        dcb = dcb_list;
         /*< Close, and set DISCONNECTED victims */
         while (dcb != NULL) {
 		DCB* dcb_next = NULL;
                 int  rc = 0;
+
+                /*<
+                 * A message posted for the DCB still refers to it, keep
+                 * the DCB for another epoch.
+                 */
+                if (dcb->memdata.n_mail > 0)
+                {
+                        dcb_next = dcb->memdata.next;
+                        dcb_requeue_zombie(dcb);
+                        dcb = dcb_next;
+                        continue;
+                }
                 /*<
                  * Close file descriptor and move to clean-up phase.
                  */
@@ -433,7 +485,92 @@ bool    succp = false;
                 dcb_final_free(dcb);
                 dcb = dcb_next;
         }
-        return zombies;
+}
+
+/**
+ * Process the DCB zombie queue
+ *
+ * This routine is called by each of the polling threads at the end of the
+ * polling loop, when the thread holds no references to DCBs. The thread
+ * records that it has passed the current reclamation epoch. The thread that
+ * is the last one to pass the epoch frees the zombies of the previous epoch
+ * as a batch. Apart from that the cost for a thread is a comparison of the
+ * epoch numbers and, once per epoch, a short hold of the zombiespin.
+ *
+ * @param	threadid	The thread ID of the caller
+ * @return	The remaining zombies or NULL if there are none
+ */
+DCB*
+dcb_process_zombies(int threadid)
+{
+DCB*    dcb_list = NULL;
+
+	if (thread_epoch == 0)
+	{
+		/*<
+		 * The first call from this thread. The thread does not
+		 * reference any DCB yet, so it takes part in the epochs
+		 * that start after this.
+		 */
+		spinlock_acquire(&zombiespin);
+		epoch_threads++;
+		thread_epoch = zombie_epoch;
+
+		if (epoch_advancing && epoch_pending == 0)
+		{
+			dcb_list = dcb_epoch_passed();
+		}
+		spinlock_release(&zombiespin);
+	}
+	/*<
+	 * Perform a dirty read to see if there is a new epoch. This avoids
+	 * threads hitting the zombiespin when there is nothing to free.
+	 */
+	else if (thread_epoch != zombie_epoch)
+	{
+		spinlock_acquire(&zombiespin);
+		thread_epoch = zombie_epoch;
+
+		if (--epoch_pending == 0)
+		{
+			dcb_list = dcb_epoch_passed();
+		}
+		spinlock_release(&zombiespin);
+	}
+
+        if (dcb_list != NULL || epoch_wake)
+        {
+                dcb_free_victims(dcb_list);
+        }
+        return dcb_get_zombies();
+}
+
+/**
+ * Remove the calling polling thread from the DCB reclamation. Called when
+ * a polling thread exits, after its last call to dcb_process_zombies.
+ */
+void
+dcb_process_zombies_done()
+{
+DCB	*dcb_list = NULL;
+
+	if (thread_epoch == 0)
+		return;
+
+	spinlock_acquire(&zombiespin);
+	epoch_threads--;
+
+	if (thread_epoch != zombie_epoch && --epoch_pending == 0)
+	{
+		dcb_list = dcb_epoch_passed();
+	}
+	thread_epoch = 0;
+	spinlock_release(&zombiespin);
+
+	if (dcb_list != NULL || epoch_wake)
+	{
+		dcb_free_victims(dcb_list);
+	}
 }
 
 /**
@@ -559,67 +696,130 @@ int             rc;
  *
  * @param dcb	The DCB to read from
  * @param head	Pointer to linked list to append data to
- * @return	-1 on error, otherwise the number of read bytes on the last.
- * 0 is returned if no data available on the last iteration of while loop.
+ * @return	-1 on error, otherwise the number of bytes read.
+ * 0 is returned if no data was available.
  */
 int
 dcb_read(DCB *dcb, GWBUF **head)
 {
-GWBUF 	  *buffer = NULL;
-int 	  b;
-int       rc;
-int       n = 0;
-int       eno = 0;
+	return dcb_read_data(dcb, head, NULL);
+}
 
-        CHK_DCB(dcb);
-        while (true)
+/**
+ * The receive buffers of the calling thread, two buffers of MAX_BUFFER_SIZE
+ * bytes that every read goes to. A buffer is only handed to the DCB when the
+ * read filled more than DCB_READ_COPY bytes of it, smaller reads are copied
+ * to a buffer of their own size class and the buffer is kept for the next
+ * read.
+ */
+static __thread GWBUF	*read_spare[2] = { NULL, NULL };
+
+/**
+ * Allocate a buffer from the buffer pool, logging a failure
+ *
+ * @param dcb	The DCB the buffer is for, for the error message
+ * @param size	The size of the buffer
+ * @return	The buffer or NULL if no memory is available
+ */
+static GWBUF *
+dcb_read_buffer(DCB *dcb, int size)
+{
+GWBUF	*buffer;
+
+	if ((buffer = gwbuf_alloc(size)) == NULL)
 	{
-		int bufsize;
+                /*<
+                 * This is a fatal error which should cause shutdown.
+                 * Todo shutdown if memory allocation fails.
+                 */
+                LOGIF(LE, (skygw_log_write_flush(
+                        LOGFILE_ERROR,
+                        "Error : Failed to allocate read buffer "
+                        "for dcb %p fd %d.",
+                        dcb,
+                        dcb->fd)));
+                ss_dassert(buffer != NULL);
+	}
+	return buffer;
+}
 
-                rc = ioctl(dcb->fd, FIONREAD, &b);
+/**
+ * Append the bytes a read left in a receive buffer of the thread to a
+ * linked list of buffers. A receive buffer that is mostly filled is handed
+ * over trimmed to the bytes read, otherwise the bytes are copied so that a
+ * short packet does not hold a whole receive buffer while it is queued.
+ *
+ * @param dcb	The DCB that was read from
+ * @param head	Pointer to linked list to append data to
+ * @param i	The receive buffer
+ * @param n	The bytes read into the buffer
+ * @return	0 on success, -1 if no memory is available
+ */
+static int
+dcb_read_append(DCB *dcb, GWBUF **head, int i, int n)
+{
+GWBUF	*buffer;
 
-                if (rc == -1) {
-                        eno = errno;
-                        errno = 0;
-                        LOGIF(LE, (skygw_log_write_flush(
-                                LOGFILE_ERROR,
-                                "Error : ioctl FIONREAD for dcb %p in "
-                                "state %s fd %d failed due error %d, %s.",
-                                dcb,
-                                STRDCBSTATE(dcb->state),
-                                dcb->fd,
-                                eno,
-                                strerror(eno))));
-                        n = -1;
-                        goto return_n;
-                }
-                /*< Nothing to read - leave */
-                if (b == 0) {
-                        n = 0;
-                        goto return_n;
-                }
-                bufsize = MIN(b, MAX_BUFFER_SIZE);
+	if (n > DCB_READ_COPY)
+	{
+		buffer = read_spare[i];
+		read_spare[i] = NULL;
+		buffer->end = buffer->start + n;
+	}
+	else
+	{
+		if ((buffer = dcb_read_buffer(dcb, n)) == NULL)
+			return -1;
+		memcpy(GWBUF_DATA(buffer), GWBUF_DATA(read_spare[i]), n);
+	}
+	*head = gwbuf_append(*head, buffer);
+	return 0;
+}
+
+/**
+ * Read all the data available in the socket of a DCB and append it to a
+ * linked list of buffers.
+ *
+ * The data is read with readv straight into the two receive buffers of the
+ * calling thread, so there is no need to ask the amount of available data
+ * with ioctl FIONREAD first. The bytes read are handed over in the receive
+ * buffers when they fill most of them and copied to a buffer of the right
+ * size class otherwise. Reading stops when the socket would block or a read
+ * does not fill both buffers.
+ *
+ * @param dcb		The DCB to read from
+ * @param head		Pointer to linked list to append data to
+ * @param closed	If not NULL, set to true if the peer closed the socket
+ * @return		-1 on error, otherwise the number of bytes read.
+ * 0 is returned if no data was available.
+ */
+int
+dcb_read_data(DCB *dcb, GWBUF **head, bool *closed)
+{
+struct iovec	iov[2];
+int		n, i;
+int		total = 0;
+
+        CHK_DCB(dcb);
 
-		if ((buffer = gwbuf_alloc(bufsize)) == NULL)
+        if (closed != NULL)
+                *closed = false;
+
+        while (true)
+	{
+		for (i = 0; i < 2; i++)
 		{
-                        /*<
-                         * This is a fatal error which should cause shutdown.
-                         * Todo shutdown if memory allocation fails.
-                         */
-                        LOGIF(LE, (skygw_log_write_flush(
-                                LOGFILE_ERROR,
-                                "Error : Failed to allocate read buffer "
-                                "for dcb %p fd %d, due %d, %s.",
-                                dcb,
-                                dcb->fd, 
-                                eno,
-                                strerror(eno))));
-                        
-                        n = -1;
-                        ss_dassert(buffer != NULL);
-                        goto return_n;
+			if (read_spare[i] == NULL &&
+			    (read_spare[i] = dcb_read_buffer(dcb,
+						MAX_BUFFER_SIZE)) == NULL)
+			{
+				return -1;
+			}
+			iov[i].iov_base = GWBUF_DATA(read_spare[i]);
+			iov[i].iov_len = MAX_BUFFER_SIZE;
 		}
-		GW_NOINTR_CALL(n = read(dcb->fd, GWBUF_DATA(buffer), bufsize);
+
+		GW_NOINTR_CALL(n = readv(dcb->fd, iov, 2);
                                dcb->stats.n_reads++);
 
 		if (n <= 0)
@@ -627,28 +827,27 @@ int       eno = 0;
                         int eno = errno;
                         errno = 0;
 
-                        if (eno != EAGAIN && eno != EWOULDBLOCK) {
-                                LOGIF(LE, (skygw_log_write_flush(
-                                        LOGFILE_ERROR,
-                                        "Error : Read failed, dcb %p in state "
-                                        "%s fd %d, due %d, %s.",
-                                        dcb,
-                                        STRDCBSTATE(dcb->state),
-                                        dcb->fd, 
-                                        eno,
-                                        strerror(eno))));
+                        if (n == 0)
+                        {
+                                /*< The peer has closed the socket */
+                                if (closed != NULL)
+                                        *closed = true;
+                                break;
                         }
-                        else
+                        if (eno == EAGAIN || eno == EWOULDBLOCK)
                         {
-                                /*<
-                                 * If read would block it means that other thread
-                                 * has probably read the data.
-                                 */
-                                n = 0;
+                                break;
                         }
-                        
-			gwbuf_free(buffer);
-                        goto return_n;
+                        LOGIF(LE, (skygw_log_write_flush(
+                                LOGFILE_ERROR,
+                                "Error : Read failed, dcb %p in state "
+                                "%s fd %d, due %d, %s.",
+                                dcb,
+                                STRDCBSTATE(dcb->state),
+                                dcb->fd, 
+                                eno,
+                                strerror(eno))));
+                        return -1;
                 }
                 LOGIF(LD, (skygw_log_write(
                         LOGFILE_DEBUG,
@@ -660,13 +859,119 @@ int       eno = 0;
                         STRDCBSTATE(dcb->state),
                         dcb->fd)));
 		/*< Append read data to the gwbuf */
-		*head = gwbuf_append(*head, buffer);
+		if (n <= MAX_BUFFER_SIZE)
+		{
+			if (dcb_read_append(dcb, head, 0, n) == -1)
+				return -1;
+		}
+		else if (dcb_read_append(dcb, head, 0, MAX_BUFFER_SIZE) == -1 ||
+			 dcb_read_append(dcb, head, 1, n - MAX_BUFFER_SIZE) == -1)
+		{
+			return -1;
+		}
+                total += n;
+
+                if (n < 2 * MAX_BUFFER_SIZE)
+                {
+                        /*< The socket receive buffer has been emptied */
+                        break;
+                }
 	} /*< while (true) */
-return_n:
-	return n;
+	return total;
 }
 
 
+/**
+ * Write a buffer chain to the descriptor of a DCB with as few system calls
+ * as possible. The links of the chain are gathered into an iovec of at most
+ * DCB_IOV_MAX entries and sent with a single writev call, which is repeated
+ * until the chain has been written or the socket buffer is full.
+ *
+ * The written data is consumed from the chain, a partially written link
+ * is left at the head of the chain. The caller must hold the writeqlock
+ * of the DCB if the chain is the write queue of the DCB.
+ *
+ * @param dcb		The DCB to write to
+ * @param queuep	Pointer to the chain, updated to the unwritten balance
+ * @param saved_errno	Set to the errno of a failed write, 0 otherwise
+ * @return		The number of bytes written
+ */
+static int
+dcb_writev_queue(DCB *dcb, GWBUF **queuep, int *saved_errno)
+{
+struct iovec	iov[DCB_IOV_MAX];
+GWBUF		*ptr;
+int		niov;
+int		total = 0;
+int		want;
+int		w;
+
+	*saved_errno = 0;
+
+	while (*queuep != NULL)
+	{
+		niov = 0;
+		want = 0;
+		for (ptr = *queuep; ptr != NULL && niov < DCB_IOV_MAX; ptr = ptr->next)
+		{
+			if (GWBUF_EMPTY(ptr))
+				continue;
+			iov[niov].iov_base = GWBUF_DATA(ptr);
+			iov[niov].iov_len = GWBUF_LENGTH(ptr);
+			want += GWBUF_LENGTH(ptr);
+			niov++;
+		}
+		if (niov == 0)
+		{
+			/*< Only empty links are left */
+			while (*queuep != NULL)
+				*queuep = gwbuf_consume(*queuep, 0);
+			break;
+		}
+		GW_NOINTR_CALL(
+			w = gw_writev(
+#if defined(SS_DEBUG)
+				dcb,
+#endif
+				dcb->fd, iov, niov);
+			dcb->stats.n_writes++;
+			);
+
+		if (w < 0)
+		{
+			*saved_errno = errno;
+			errno = 0;
+			break;
+		}
+		dcb->stats.n_bytes_written += w;
+		total += w;
+
+		if (w < want)
+		{
+			want = -1;	/*< Short write, the socket buffer is full */
+		}
+
+		/*
+		 * Pull the number of bytes we have written from the
+		 * chain, link by link, together with any empty links.
+		 */
+		while (*queuep != NULL && (w > 0 || GWBUF_EMPTY(*queuep)))
+		{
+			int	len = GWBUF_LENGTH(*queuep);
+
+			if (len > w)
+				len = w;
+			*queuep = gwbuf_consume(*queuep, len);
+			w -= len;
+		}
+		if (want == -1)
+		{
+			break;
+		}
+	}
+	return total;
+}
+
 /**
  * General purpose routine to write to a DCB
  *
@@ -676,7 +981,6 @@ return_n:
 int
 dcb_write(DCB *dcb, GWBUF *queue)
 {
-        int w;
         int saved_errno = 0;
 
         ss_dassert(queue != NULL);
@@ -712,8 +1016,11 @@ dcb_write(DCB *dcb, GWBUF *queue)
 		 * the routine that drains the queue data, so we should
 		 * not have a race condition on the event.
 		 */
+		dcb_set_writeqlen(dcb, dcb->writeqlen + gwbuf_length(queue));
 		dcb->writeq = gwbuf_append(dcb->writeq, queue);
 		dcb->stats.n_buffered++;
+		if (dcb->flush_pending)
+			stats_thread()->n_write_coalesced++;
                 LOGIF(LD, (skygw_log_write(
                                    LOGFILE_DEBUG,
                                    "%lu [dcb_write] Append to writequeue. %d writes "
@@ -724,101 +1031,81 @@ dcb_write(DCB *dcb, GWBUF *queue)
                                    STRDCBSTATE(dcb->state),
                                    dcb->fd)));
 	}
-	else
+	else if (defer_writes && dcb->state == DCB_STATE_POLLING)
 	{
-		int	len;
-
 		/*
-		 * Loop over the buffer chain that has been passed to us
-		 * from the reading side.
-		 * Send as much of the data in that chain as possible and
-		 * add any balance to the write queue.
+		 * Leave the data to dcb_flush_deferred, which writes all
+		 * that is written to the DCB during this batch of events
+		 * with one system call. A DCB that is already in the list
+		 * of a thread is flushed by that thread.
 		 */
-		while (queue != NULL)
+		dcb->writeq = queue;
+		dcb_set_writeqlen(dcb, gwbuf_length(queue));
+		if (!dcb->flush_pending)
 		{
-#if defined(SS_DEBUG)
-                        if (dcb->dcb_role == DCB_ROLE_REQUEST_HANDLER &&
-                            dcb->session != NULL)
-                        {
-                                if (dcb_isclient(dcb) && fail_next_client_fd) {
-                                        dcb_fake_write_errno[dcb->fd] = 32;
-                                        dcb_fake_write_ev[dcb->fd] = 29;
-                                        fail_next_client_fd = false;
-                                } else if (!dcb_isclient(dcb) &&
-                                           fail_next_backend_fd)
-                                {
-                                        dcb_fake_write_errno[dcb->fd] = 32;
-                                        dcb_fake_write_ev[dcb->fd] = 29;
-                                        fail_next_backend_fd = false;
-                                }
+			dcb->flush_pending = true;
+			dcb->next_deferred = deferred;
+			deferred = dcb;
+		}
+		stats_thread()->n_deferred++;
+	}
+	else
+	{
+#if defined(SS_DEBUG)
+                if (dcb->dcb_role == DCB_ROLE_REQUEST_HANDLER &&
+                    dcb->session != NULL)
+                {
+                        if (dcb_isclient(dcb) && fail_next_client_fd) {
+                                dcb_fake_write_errno[dcb->fd] = 32;
+                                dcb_fake_write_ev[dcb->fd] = 29;
+                                fail_next_client_fd = false;
+                        } else if (!dcb_isclient(dcb) &&
+                                   fail_next_backend_fd)
+                        {
+                                dcb_fake_write_errno[dcb->fd] = 32;
+                                dcb_fake_write_ev[dcb->fd] = 29;
+                                fail_next_backend_fd = false;
                         }
+                }
 #endif /* SS_DEBUG */
-			len = GWBUF_LENGTH(queue);
-			GW_NOINTR_CALL(
-                                w = gw_write(
-#if defined(SS_DEBUG)
-                                        dcb,
-#endif
-                                        dcb->fd, GWBUF_DATA(queue), len);
-                                dcb->stats.n_writes++;
-                                );
-                        
-			if (w < 0)
-			{
-                                saved_errno = errno;
-                                errno = 0;
+		/*
+		 * Send as much of the buffer chain that has been passed to
+		 * us from the reading side as possible and add any balance
+		 * to the write queue.
+		 */
+		dcb_writev_queue(dcb, &queue, &saved_errno);
 
-                                if (LOG_IS_ENABLED(LOGFILE_DEBUG))
-                                {
-                                if (saved_errno == EPIPE) {
-                                        LOGIF(LD, (skygw_log_write(
-                                                LOGFILE_DEBUG,
-                                                "%lu [dcb_write] Write to dcb "
-                                                "%p in state %s fd %d failed "
-                                                "due errno %d, %s",
-                                                pthread_self(),
-                                                dcb,
-                                                STRDCBSTATE(dcb->state),
-                                                dcb->fd,
-                                                saved_errno,
-                                                strerror(saved_errno))));
-                                        } 
-                                }
-                                if (LOG_IS_ENABLED(LOGFILE_ERROR))
-                                {
-                                        if (saved_errno != EPIPE &&
-                                                saved_errno != EAGAIN &&
-                                           saved_errno != EWOULDBLOCK)
-                                {
-                                        LOGIF(LE, (skygw_log_write_flush(
-                                                LOGFILE_ERROR,
-                                                "Error : Write to dcb %p in "
-                                                "state %s fd %d failed due "
-                                                "errno %d, %s",
-                                                dcb,
-                                                STRDCBSTATE(dcb->state),
-                                                dcb->fd,
-                                                saved_errno,
-                                                strerror(saved_errno))));
-                                }
-                                }
-				break;
-			}
-			/*
-			 * Pull the number of bytes we have written from
-			 * queue with have.
-			 */
-			queue = gwbuf_consume(queue, w);
-                        LOGIF(LD, (skygw_log_write(
-                                LOGFILE_DEBUG,
-                                "%lu [dcb_write] Wrote %d Bytes to dcb %p in "
-                                "state %s fd %d",
-                                pthread_self(),
-                                w,
-                                dcb,
-                                 STRDCBSTATE(dcb->state),
-                                dcb->fd)));
-		} /*< while (queue != NULL) */
+                if (saved_errno != 0)
+                {
+                        if (saved_errno == EPIPE)
+                        {
+                                LOGIF(LD, (skygw_log_write(
+                                        LOGFILE_DEBUG,
+                                        "%lu [dcb_write] Write to dcb "
+                                        "%p in state %s fd %d failed "
+                                        "due errno %d, %s",
+                                        pthread_self(),
+                                        dcb,
+                                        STRDCBSTATE(dcb->state),
+                                        dcb->fd,
+                                        saved_errno,
+                                        strerror(saved_errno))));
+                        }
+                        else if (saved_errno != EAGAIN &&
+                                 saved_errno != EWOULDBLOCK)
+                        {
+                                LOGIF(LE, (skygw_log_write_flush(
+                                        LOGFILE_ERROR,
+                                        "Error : Write to dcb %p in "
+                                        "state %s fd %d failed due "
+                                        "errno %d, %s",
+                                        dcb,
+                                        STRDCBSTATE(dcb->state),
+                                        dcb->fd,
+                                        saved_errno,
+                                        strerror(saved_errno))));
+                        }
+                }
                 /*<
                  * What wasn't successfully written is stored to write queue
                  * for suspended write.
@@ -827,9 +1114,11 @@ dcb_write(DCB *dcb, GWBUF *queue)
                 
 		if (queue != NULL)
 		{
+			dcb_set_writeqlen(dcb, gwbuf_length(queue));
 			dcb->stats.n_buffered++;
 		}
 	} /* if (dcb->writeq) */
+	dcb_check_high_water(dcb);
 
 	if (saved_errno != 0 &&
             queue != NULL &&
@@ -850,6 +1139,162 @@ dcb_write(DCB *dcb, GWBUF *queue)
 	return 1;
 }
 
+/**
+ * Check the write queue of a DCB against the high water mark after data
+ * has been queued. While the queue is above the mark, a DCB of the same
+ * session whose read entry point produced the data stops reading, so that
+ * the data is left in the kernel and TCP flow control slows the sender.
+ * The caller must hold the writeqlock of the DCB.
+ *
+ * @param dcb	The DCB that was written to
+ */
+static void
+dcb_check_high_water(DCB *dcb)
+{
+unsigned int	high = config_writeq_high_water();
+DCB		*reader;
+
+	if (high == 0)
+		return;
+	if (!dcb->high_water)
+	{
+		if (dcb->writeqlen <= high)
+			return;
+		dcb->high_water = true;
+		dcb->stats.n_high_water++;
+	}
+	reader = poll_reading_dcb();
+	if (reader == NULL || reader == dcb ||
+	    reader->session == NULL || reader->session != dcb->session ||
+	    reader->throttled_by != NULL)
+		return;
+
+	reader->throttled_by = dcb;
+	reader->next_throttled = dcb->throttled;
+	dcb->throttled = reader;
+	reader->stats.n_throttled++;
+	poll_stop_read(reader);
+
+	LOGIF(LD, (skygw_log_write(
+		LOGFILE_DEBUG,
+		"%lu [dcb_check_high_water] Stopped reading dcb %p, %u bytes "
+		"queued for dcb %p.",
+		pthread_self(),
+		reader,
+		dcb->writeqlen,
+		dcb)));
+}
+
+/**
+ * Set the number of bytes in the write queue of a DCB and account the
+ * change to the DCB and its session. The caller must hold the writeqlock
+ * of the DCB.
+ *
+ * @param dcb	The DCB
+ * @param len	The new length of the write queue
+ */
+static void
+dcb_set_writeqlen(DCB *dcb, unsigned int len)
+{
+	dcb_mem_account(dcb, (int)len - (int)dcb->writeqlen);
+	dcb->writeqlen = len;
+}
+
+/**
+ * Account bytes of data held in buffers for a DCB, such as its write and
+ * delay queues, to the DCB and its session.
+ *
+ * @param dcb	The DCB
+ * @param bytes	The number of bytes taken, negative if released
+ */
+void
+dcb_mem_account(DCB *dcb, int bytes)
+{
+	if (bytes == 0)
+		return;
+	atomic_add(&dcb->mem_buffered, bytes);
+	session_mem_account(dcb->session, bytes);
+}
+
+/**
+ * Check the write queue of a DCB against the low water mark after data
+ * has been written from it and start the DCBs that stopped reading once
+ * the queue has drained. The caller must hold the writeqlock of the DCB.
+ *
+ * @param dcb	The DCB that was written from
+ */
+static void
+dcb_check_low_water(DCB *dcb)
+{
+unsigned int	high = config_writeq_high_water();
+unsigned int	low = config_writeq_low_water();
+
+	if (!dcb->high_water)
+		return;
+	if (low >= high)
+		low = high / 2;
+	if (high != 0 && dcb->writeqlen > low)
+		return;
+	dcb->high_water = false;
+	dcb->stats.n_low_water++;
+	dcb_start_throttled(dcb);
+}
+
+/**
+ * Start reading from all the DCBs that wait for the write queue of a DCB
+ * to drain. The caller must hold the writeqlock of the DCB.
+ *
+ * @param dcb	The DCB whose waiting DCBs are started
+ */
+static void
+dcb_start_throttled(DCB *dcb)
+{
+DCB	*ptr;
+
+	while ((ptr = dcb->throttled) != NULL)
+	{
+		dcb->throttled = ptr->next_throttled;
+		ptr->next_throttled = NULL;
+		ptr->throttled_by = NULL;
+		/*< The session memory limit restarts it once it is released */
+		if (ptr->session != NULL && ptr->session->mem_throttled &&
+		    ptr->session->client == ptr)
+			continue;
+		poll_start_read(ptr);
+	}
+}
+
+/**
+ * Remove a DCB that is being closed from the list of DCBs waiting for
+ * its peer to drain.
+ *
+ * @param dcb	The DCB that is closed
+ */
+static void
+dcb_leave_throttled(DCB *dcb)
+{
+DCB	*peer = dcb->throttled_by;
+DCB	**pp;
+
+	if (peer == NULL)
+		return;
+	spinlock_acquire(&peer->writeqlock);
+	if (dcb->throttled_by == peer)
+	{
+		for (pp = &peer->throttled; *pp; pp = &(*pp)->next_throttled)
+		{
+			if (*pp == dcb)
+			{
+				*pp = dcb->next_throttled;
+				break;
+			}
+		}
+		dcb->next_throttled = NULL;
+		dcb->throttled_by = NULL;
+	}
+	spinlock_release(&peer->writeqlock);
+}
+
 /**
  * Drain the write queue of a DCB. This is called as part of the EPOLLOUT handling
  * of a socket and will try to send any buffered data from the write queue
@@ -862,71 +1307,93 @@ int
 dcb_drain_writeq(DCB *dcb)
 {
 int n = 0;
-int w;
 int saved_errno = 0;
 
 	spinlock_acquire(&dcb->writeqlock);
 	if (dcb->writeq)
 	{
-		int	len;
-
 		/*
-		 * Loop over the buffer chain in the pending writeq
-		 * Send as much of the data in that chain as possible and
-		 * leave any balance on the write queue.
+		 * Send as much of the data in the pending writeq as
+		 * possible and leave any balance on the write queue.
 		 */
-		while (dcb->writeq != NULL)
+		n = dcb_writev_queue(dcb, &dcb->writeq, &saved_errno);
+		if (dcb->writeq == NULL)
+			dcb_set_writeqlen(dcb, 0);
+		else
+			dcb_set_writeqlen(dcb, dcb->writeqlen - n);
+		dcb_check_low_water(dcb);
+
+		if (saved_errno != 0 &&
+		    saved_errno != EAGAIN &&
+		    saved_errno != EWOULDBLOCK)
 		{
-			len = GWBUF_LENGTH(dcb->writeq);
-			GW_NOINTR_CALL(w = gw_write(
-#if defined(SS_DEBUG)
-                               dcb,
-#endif
-                               dcb->fd,
-                               GWBUF_DATA(dcb->writeq),
-                               len););
-			saved_errno = errno;
-                        errno = 0;
-                        
-			if (w < 0)
-			{
-                                if (saved_errno == EAGAIN ||
-                                    saved_errno == EWOULDBLOCK)
-                                {
-                                        break;
-                                }
-                                LOGIF(LE, (skygw_log_write_flush(
-                                        LOGFILE_ERROR,
-                                        "Error : Write to dcb %p "
-                                        "in state %s fd %d failed due errno %d, %s",
-                                        dcb,
-                                        STRDCBSTATE(dcb->state),
-                                        dcb->fd,
-                                        saved_errno,
-                                        strerror(saved_errno))));
-                                break;
-			}
-			/*
-			 * Pull the number of bytes we have written from
-			 * queue with have.
-			 */
-			dcb->writeq = gwbuf_consume(dcb->writeq, w);
-                        LOGIF(LD, (skygw_log_write(
-                                LOGFILE_DEBUG,
-                                "%lu [dcb_drain_writeq] Wrote %d Bytes to dcb %p "
-                                "in state %s fd %d",
-                                pthread_self(),
-                                w,
+                        LOGIF(LE, (skygw_log_write_flush(
+                                LOGFILE_ERROR,
+                                "Error : Write to dcb %p "
+                                "in state %s fd %d failed due errno %d, %s",
                                 dcb,
                                 STRDCBSTATE(dcb->state),
-                                dcb->fd)));
-			n += w;
+                                dcb->fd,
+                                saved_errno,
+                                strerror(saved_errno))));
 		}
+                LOGIF(LD, (skygw_log_write(
+                        LOGFILE_DEBUG,
+                        "%lu [dcb_drain_writeq] Wrote %d Bytes to dcb %p "
+                        "in state %s fd %d",
+                        pthread_self(),
+                        n,
+                        dcb,
+                        STRDCBSTATE(dcb->state),
+                        dcb->fd)));
 	}
 	spinlock_release(&dcb->writeqlock);
 	return n;
 }
 
+/**
+ * Set whether the writes of the calling thread are deferred. A polling
+ * thread that defers its writes must call dcb_flush_deferred after every
+ * batch of events.
+ *
+ * @param enable	True to defer the writes
+ */
+void
+dcb_defer_writes(bool enable)
+{
+	defer_writes = enable;
+}
+
+/**
+ * Write the data that was written to DCBs by the calling thread since the
+ * last call, with one vectored write per DCB. Data the socket cannot take
+ * stays in the write queue and is written on the next EPOLLOUT event.
+ *
+ * The DCBs are not freed before the thread processes the zombies after the
+ * batch of events, so DCBs closed in the meantime are still valid.
+ */
+void
+dcb_flush_deferred()
+{
+DCB	*dcb;
+
+	while ((dcb = deferred) != NULL)
+	{
+		deferred = dcb->next_deferred;
+		spinlock_acquire(&dcb->writeqlock);
+		dcb->next_deferred = NULL;
+		dcb->flush_pending = false;
+		spinlock_release(&dcb->writeqlock);
+
+		if (dcb->state != DCB_STATE_POLLING)
+			continue;
+		stats_thread()->n_flushed++;
+		dcb_drain_writeq(dcb);
+		if (dcb->spliced)
+			dcb_splice_write_ready(dcb);
+	}
+}
+
 /** 
  * Removes dcb from poll set, and adds it to zombies list. As a consequense,
  * dcb first moves to DCB_STATE_NOPOLLING, and then to DCB_STATE_ZOMBIE state.
@@ -958,6 +1425,33 @@ dcb_close(DCB *dcb)
                dcb->state == DCB_STATE_NOPOLLING ||
                dcb->state == DCB_STATE_ZOMBIE);
         
+        /*<
+         * Release the DCBs that wait for this one to drain and stop
+         * waiting for a peer.
+         */
+        spinlock_acquire(&dcb->writeqlock);
+        dcb_start_throttled(dcb);
+        spinlock_release(&dcb->writeqlock);
+        dcb_leave_throttled(dcb);
+        timer_cancel(&dcb->timer);
+
+        /*<
+         * Send deferred data, such as an error message, before the
+         * descriptor is closed.
+         */
+        if (dcb->flush_pending)
+                dcb_drain_writeq(dcb);
+
+        /*<
+         * Unlink a spliced peer, which hangs up when it finds itself
+         * without a peer.
+         */
+        if (dcb->splice_peer != NULL)
+        {
+                dcb->splice_peer->splice_peer = NULL;
+                dcb->splice_peer = NULL;
+        }
+
         /*<
          * Stop dcb's listening and modify state accordingly.
          */
@@ -1073,11 +1567,28 @@ dprintDCB(DCB *pdcb, DCB *dcb)
 	if (dcb->remote)
 		dcb_printf(pdcb, "\tConnected to:		%s\n", dcb->remote);
 	dcb_printf(pdcb, "\tOwning Session:   	%d\n", dcb->session);
-	dcb_printf(pdcb, "\tQueued write data:	%d\n", gwbuf_length(dcb->writeq));
+	dcb_printf(pdcb, "\tPolling Thread:   	%d\n", dcb->thread_id);
+	dcb_printf(pdcb, "\tQueued write data:	%u\n", dcb->writeqlen);
+	dcb_printf(pdcb, "\tBuffered data:		%d bytes\n", dcb->mem_buffered);
+	if (dcb->throttled_by)
+		dcb_printf(pdcb, "\tReading stopped for:	%p\n", dcb->throttled_by);
+	if (dcb->spliced)
+		dcb_printf(pdcb, "\tSpliced to:		%p\n", dcb->splice_peer);
 	dcb_printf(pdcb, "\tStatistics:\n");
 	dcb_printf(pdcb, "\t\tNo. of Reads: 	%d\n", dcb->stats.n_reads);
 	dcb_printf(pdcb, "\t\tNo. of Writes:	%d\n", dcb->stats.n_writes);
+	dcb_printf(pdcb, "\t\tNo. of Bytes Written:	%ld\n", dcb->stats.n_bytes_written);
+	if (dcb->stats.n_writes > 0)
+		dcb_printf(pdcb, "\t\tBytes per Write:	%ld\n",
+			dcb->stats.n_bytes_written / dcb->stats.n_writes);
 	dcb_printf(pdcb, "\t\tNo. of Buffered Writes:	%d\n", dcb->stats.n_buffered);
+	dcb_printf(pdcb, "\t\tNo. of High Water Events:	%d\n", dcb->stats.n_high_water);
+	dcb_printf(pdcb, "\t\tNo. of Low Water Events:	%d\n", dcb->stats.n_low_water);
+	dcb_printf(pdcb, "\t\tNo. of Throttled Reads:	%d\n", dcb->stats.n_throttled);
+	dcb_printf(pdcb, "\t\tNo. of Timeouts:	%d\n", dcb->stats.n_timeouts);
+	if (dcb->spliced)
+		dcb_printf(pdcb, "\t\tNo. of Bytes Spliced:	%ld\n",
+			dcb->stats.n_bytes_spliced);
 	dcb_printf(pdcb, "\t\tNo. of Accepts: %d\n", dcb->stats.n_accepts);
 }
 
@@ -1132,6 +1643,309 @@ va_list	args;
 	dcb->func.write(dcb, buf);
 }
 
+/**
+ * Arm the timeout of a DCB or cancel it. The timeout runs on the wheel of
+ * the calling polling thread and is restarted by every call. When it
+ * expires an EPOLLERR event is delivered to the DCB, so the protocol closes
+ * it through its normal error handling.
+ *
+ * @param dcb	The DCB
+ * @param msecs	Milliseconds until the timeout, 0 cancels it
+ */
+void
+dcb_set_timeout(DCB *dcb, long msecs)
+{
+	if (msecs > 0)
+		timer_arm(&dcb->timer, poll_current_thread(), msecs);
+	else
+		timer_cancel(&dcb->timer);
+}
+
+/**
+ * Write to a DCB from any thread. When every polling thread has an event
+ * set of its own the write is posted to the thread that owns the DCB, so
+ * that only the owning thread works on the write queue and socket of the
+ * DCB. A DCB owned by the calling thread, or by every thread when the
+ * event set is shared, is written directly.
+ *
+ * @param dcb	The DCB to write to
+ * @param queue	The data to write
+ * @return	The return value of the write entry point, 1 if posted
+ */
+int
+dcb_post_write(DCB *dcb, GWBUF *queue)
+{
+	if (poll_n_epoll_sets() == 1 || dcb->thread_id == poll_current_thread())
+		return dcb->func.write(dcb, queue);
+
+	atomic_add(&dcb->memdata.n_mail, 1);
+	if (poll_post(dcb->thread_id, dcb_posted_write, dcb, queue) != 0)
+	{
+		atomic_add(&dcb->memdata.n_mail, -1);
+		return dcb->func.write(dcb, queue);
+	}
+	return 1;
+}
+
+/**
+ * Deliver a write posted by dcb_post_write in the thread owning the DCB.
+ * The data of a DCB that has been closed in the meantime is discarded.
+ *
+ * @param arg1	The DCB
+ * @param arg2	The data to write
+ */
+static void
+dcb_posted_write(void *arg1, void *arg2)
+{
+DCB	*dcb = (DCB *)arg1;
+GWBUF	*queue = (GWBUF *)arg2;
+
+	if (dcb->state == DCB_STATE_POLLING)
+	{
+		dcb->func.write(dcb, queue);
+	}
+	else
+	{
+		while ((queue = gwbuf_consume(queue, GWBUF_LENGTH(queue))) != NULL)
+			;
+	}
+	atomic_add(&dcb->memdata.n_mail, -1);
+}
+
+/**
+ * Splice two connected DCBs together. From then on the data read from
+ * either DCB is moved to the other one by the kernel with splice(2),
+ * through a pipe of each DCB, without being copied into buffers or passed
+ * to the protocol and router. The protocol read entry points are no longer
+ * called and the timeouts of the DCBs are cancelled. When either end closes
+ * the connection the client DCB of the session is hung up.
+ *
+ * The DCBs must be owned by the same polling thread, or the event set must
+ * be shared, as data written to the DCBs by dcb_post_write before the call
+ * would otherwise still be on its way.
+ *
+ * @param dcb	The DCB
+ * @param peer	The DCB to splice it to
+ * @return	0 if the DCBs are spliced, -1 otherwise
+ */
+int
+dcb_splice_start(DCB *dcb, DCB *peer)
+{
+int	in[2], out[2];
+
+	if (dcb->spliced || peer->spliced)
+		return -1;
+	if (poll_n_epoll_sets() > 1 && dcb->thread_id != peer->thread_id)
+		return -1;
+	if (pipe2(in, O_NONBLOCK | O_CLOEXEC) == -1)
+		return -1;
+	if (pipe2(out, O_NONBLOCK | O_CLOEXEC) == -1)
+	{
+		close(in[0]);
+		close(in[1]);
+		return -1;
+	}
+	dcb_set_timeout(dcb, 0);
+	dcb_set_timeout(peer, 0);
+	dcb->splice_pipe[0] = in[0];
+	dcb->splice_pipe[1] = in[1];
+	peer->splice_pipe[0] = out[0];
+	peer->splice_pipe[1] = out[1];
+	dcb->splice_peer = peer;
+	peer->splice_peer = dcb;
+
+	/*< The pipes and peers must be seen before the flags */
+	__sync_synchronize();
+	dcb->spliced = true;
+	peer->spliced = true;
+
+	LOGIF(LD, (skygw_log_write(
+		LOGFILE_DEBUG,
+		"%lu [dcb_splice_start] Spliced dcb %p fd %d to dcb %p fd %d.",
+		pthread_self(),
+		dcb,
+		dcb->fd,
+		peer,
+		peer->fd)));
+	return 0;
+}
+
+/**
+ * Move the data of a spliced DCB to its peer. Called for the read events
+ * of the DCB in place of the protocol read entry point. Reading from the
+ * DCB stops while data is left in its pipe and starts again once the
+ * write events of the peer have flushed the pipe.
+ *
+ * @param dcb	The spliced DCB to read from
+ */
+void
+dcb_splice(DCB *dcb)
+{
+DCB	*peer = dcb->splice_peer;
+ssize_t	n;
+
+	if (peer == NULL)
+	{
+		dcb_splice_hangup(dcb);
+		return;
+	}
+	for (;;)
+	{
+		spinlock_acquire(&peer->writeqlock);
+		if (dcb->splice_pending > 0)
+		{
+			dcb_splice_flush(dcb, peer);
+			if (dcb->splice_pending > 0)
+			{
+				poll_stop_read(dcb);
+				dcb->stats.n_throttled++;
+				spinlock_release(&peer->writeqlock);
+				return;
+			}
+		}
+		spinlock_release(&peer->writeqlock);
+
+		n = splice(dcb->fd,
+			NULL,
+			dcb->splice_pipe[1],
+			NULL,
+			DCB_SPLICE_SIZE,
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n > 0)
+		{
+			dcb->stats.n_reads++;
+			spinlock_acquire(&peer->writeqlock);
+			dcb->splice_pending += n;
+			dcb->stats.n_bytes_spliced += n;
+			spinlock_release(&peer->writeqlock);
+		}
+		else if (n == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		else if (n == -1 && errno == EAGAIN)
+		{
+			return;
+		}
+		else
+		{
+			dcb_splice_hangup(dcb);
+			return;
+		}
+	}
+}
+
+/**
+ * Move the data pending in the pipe of a DCB that is spliced to this DCB,
+ * once the write queue of this DCB has drained. Called for the write
+ * events of a spliced DCB after the protocol write entry point.
+ *
+ * @param dcb	The spliced DCB that can be written to
+ */
+void
+dcb_splice_write_ready(DCB *dcb)
+{
+DCB	*src = dcb->splice_peer;
+
+	if (src == NULL)
+		return;
+	spinlock_acquire(&dcb->writeqlock);
+	if (src->splice_pending > 0)
+	{
+		dcb_splice_flush(src, dcb);
+		if (src->splice_pending == 0)
+			poll_start_read(src);
+	}
+	spinlock_release(&dcb->writeqlock);
+}
+
+/**
+ * Write the data in the pipe of a DCB to its peer until the pipe is empty
+ * or the socket of the peer is full. Data in the write queue of the peer
+ * was written before the DCBs were spliced and goes first.
+ *
+ * Must be called with the writeqlock of the peer held.
+ *
+ * @param dcb	The DCB whose pipe is flushed
+ * @param peer	The DCB to write to
+ */
+static void
+dcb_splice_flush(DCB *dcb, DCB *peer)
+{
+ssize_t	n;
+
+	if (peer->writeq != NULL)
+		return;
+	while (dcb->splice_pending > 0)
+	{
+		n = splice(dcb->splice_pipe[0],
+			NULL,
+			peer->fd,
+			NULL,
+			dcb->splice_pending,
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n > 0)
+		{
+			dcb->splice_pending -= n;
+			peer->stats.n_writes++;
+			peer->stats.n_bytes_written += n;
+		}
+		else if (n == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		else
+		{
+			/*<
+			 * The socket is full or failed, a failure is reported
+			 * by the error and hangup events of the peer.
+			 */
+			break;
+		}
+	}
+}
+
+/**
+ * Hang up the session of a spliced DCB when either end has closed the
+ * connection. The client DCB gets a hangup event, which closes the session
+ * and with it the backend DCB.
+ *
+ * @param dcb	The spliced DCB
+ */
+static void
+dcb_splice_hangup(DCB *dcb)
+{
+DCB	*client = dcb->session ? dcb->session->client : NULL;
+
+	if (client == NULL)
+		client = dcb;
+	if (client->state == DCB_STATE_POLLING)
+		poll_fake_event(client, EPOLLHUP);
+}
+
+/**
+ * The timer callback of a DCB timeout
+ *
+ * @param timer	The timer of the DCB
+ * @param data	The DCB
+ */
+static void
+dcb_timeout(TIMER *timer, void *data)
+{
+DCB	*dcb = (DCB *)data;
+
+	if (dcb->state != DCB_STATE_POLLING)
+		return;
+	dcb->stats.n_timeouts++;
+	LOGIF(LT, (skygw_log_write(
+		LOGFILE_TRACE,
+		"%lu [dcb_timeout] Timeout of dcb %p fd %d.",
+		pthread_self(),
+		dcb,
+		dcb->fd)));
+	poll_fake_event(dcb, EPOLLERR);
+}
+
 /**
  * Determine the role that a DCB plays within a session.
  *
@@ -1179,7 +1993,6 @@ void dcb_hashtable_stats(
 	dcb_printf(dcb, "\tLongest chain length:	%d\n", longest);
 }
 
-
 bool dcb_set_state(
         DCB*              dcb,
         const dcb_state_t new_state,
@@ -1338,6 +2151,41 @@ static bool dcb_set_state_nomutex(
         return succp;
 }
 
+/**
+ * Write a vector of buffers to a descriptor, the vectored version of gw_write.
+ * In debug builds the injected write errors of gw_write are honoured.
+ *
+ * @param fd	The descriptor to write to
+ * @param iov	The buffers to write
+ * @param iovcnt	Number of buffers
+ * @return	The number of bytes written or -1 on error
+ */
+int gw_writev(
+#if defined(SS_DEBUG)
+        DCB* dcb,
+#endif
+        int                 fd,
+        const struct iovec* iov,
+        int                 iovcnt)
+{
+        int w;
+#if defined(SS_DEBUG)
+        if (dcb_fake_write_errno[fd] != 0) {
+                ss_dassert(dcb_fake_write_ev[fd] != 0);
+                /*< leave peer to read missing bytes */
+                w = write(fd, iov[0].iov_base, iov[0].iov_len/2);
+
+                if (w > 0) {
+                        w = -1;
+                        errno = dcb_fake_write_errno[fd];
+                }
+                return w;
+        }
+#endif
+        w = writev(fd, iov, iovcnt);
+        return w;
+}
+
 int gw_write(
 #if defined(SS_DEBUG)
         DCB* dcb,
@@ -56,6 +56,7 @@
 #include <monitor.h>
 #include <version.h>
 #include <maxscale.h>
+#include <arena.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -1320,6 +1321,8 @@ int main(int argc, char **argv)
                 "MaxScale is running in process  %i",
                 getpid())));
     
+        /*< Must precede the first buffer allocations of the threads */
+        arena_init(config_buffer_arena_size());
         poll_init();
     
         /*<
@@ -160,54 +160,21 @@ void gw_daemonize(void) {
 /////////////////////////////////////////////////
 // Read data from dcb and store it in the gwbuf
 /////////////////////////////////////////////////
-int gw_read_gwbuff(DCB *dcb, GWBUF **head, int b) {
-	GWBUF *buffer = NULL;
-	int n = -1;
-
-	if (b <= 0) {
-                ss_dassert(false);
-#if 0
-		dcb->func.close(dcb);
-#endif
-		return 1;
-	}
-
-	while (b > 0) {
-		int bufsize = b < MAX_BUFFER_SIZE ? b : MAX_BUFFER_SIZE;
-		if ((buffer = gwbuf_alloc(bufsize)) == NULL) {
-			/* Bad news, we have run out of memory */
-			/* Error handling */
-			(dcb->func).close(dcb);
-			return 1;
-		}
-
-		GW_NOINTR_CALL(n = read(dcb->fd, GWBUF_DATA(buffer), bufsize); dcb->stats.n_reads++);
-
-		if (n < 0) {
-			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-				gwbuf_free(buffer);
-				return 1;
-			} else {
-				gwbuf_free(buffer);
-				(dcb->func).close(dcb);
-				return 1;
-			}
-		}
+int gw_read_gwbuff(DCB *dcb, GWBUF **head) {
+	bool closed = false;
+	int n;
 
-		if (n == 0) {
-			//  socket closed
-			gwbuf_free(buffer);
-#if 1
-			(dcb->func).close(dcb);
-#endif
-			return 1;
-		}
+	n = dcb_read_data(dcb, head, &closed);
 
-		// append read data to the gwbuf
-		*head = gwbuf_append(*head, buffer);
+	if (n < 0 || (n == 0 && closed)) {
+		// read error or socket closed
+		(dcb->func).close(dcb);
+		return 1;
+	}
 
-		// how many bytes left
-		b -= n;
+	if (n == 0) {
+		// nothing to read, other thread may have read the data
+		return 1;
 	}
 
 	return 0;
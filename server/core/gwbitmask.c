@@ -56,7 +56,7 @@ bitmask_init(GWBITMASK *bitmask)
 	{
 		memset(bitmask->bits, 0, bitmask->length / 8);
 	}
-	spinlock_init(&bitmask->lock);
+	spinlock_init_named(&bitmask->lock, "bitmask lock");
 }
 
 /**
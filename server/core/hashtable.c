@@ -18,7 +18,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
 #include <hashtable.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define	HASHOPEN_EMPTY		0x80	/*< Control byte of an empty slot */
+#define	HASHOPEN_DELETED	0xfe	/*< Control byte of a deleted slot */
+#define	HASHOPEN_NOT_INLINE	0xff	/*< Length of a key that is not inline */
+#define	HASHOPEN_TAG(hash)	((unsigned char)((hash) >> 25))
 
 /**
  * @file hashtable.c General purpose hashtable routines
@@ -41,10 +50,43 @@
  * the key and the value, if the actions required are different the called functions
  * must understand how to differenate the key and value.
  *
- * The hash table implements a single write, multiple reader locking policy by
- * using a pair of counters and a spinlock. The spinlock is used to protect the
- * number of readers and writers counters when taking out locks. Releasing of
- * locks uses pure atomic actions and thus does not require spinlock protection.
+ * Readers never wait. The writers are serialised by the spinlock of the table
+ * and only ever publish entries that are completely filled in, a new entry is
+ * linked to the head of its chain and a deleted entry is unlinked with a single
+ * pointer store, so a reader walking a chain always sees a consistent chain.
+ * A deleted entry may still be seen by readers that were walking its chain,
+ * it is therefore put on the retired list of the table and only freed when no
+ * reader that entered the table before it was unlinked is left.
+ *
+ * Readers announce themselves by incrementing one of two counts, selected by
+ * the parity of the table epoch, in one of the reader slots of the table. To
+ * free the retired entries a writer waits for the readers of the previous
+ * epoch to leave, moves to the next epoch and waits for the readers of the
+ * epoch it left. The writer takes the retired list off the table and waits
+ * after releasing the spinlock, so the other writers are not held up. The
+ * list is taken once it holds HASHTABLE_RETIRE_BATCH entries plus a quarter
+ * of the entries of the table, which keeps the waits rare in large tables.
+ * The chains and slots replaced by a resize are freed the same way, no
+ * writer ever waits for the readers with the spinlock held.
+ *
+ * When the table holds more than HASHTABLE_MAX_LOAD entries per chain a new
+ * set of chains twice the size is published next to the old one. Each add
+ * and delete then copies the entries of HASHTABLE_MIGRATE_STEP old chains to
+ * the new chains and frees the originals after a single wait, so no single
+ * operation rehashes the whole table. The migration only starts once a wait
+ * that started after the new chains were published has completed, as the
+ * readers of the old state do not look in the new chains. Readers look in the old chains before the new ones; an
+ * entry is published in the new chain before it is unlinked from the old.
+ *
+ * A table allocated with hashtable_alloc_open uses open addressing instead of
+ * chains. The slots are in groups of HASHTABLE_GROUP with a control byte per
+ * slot, the control bytes of a group are compared with seven bits of the hash
+ * value in one SSE2 instruction and only slots whose tag matches are looked
+ * at. Short keys are kept in the slot, so a lookup usually touches the control
+ * bytes, one slot and the value. Groups are probed linearly. Slots are never
+ * reused while readers may look at them, a deleted slot stays deleted until
+ * the table is rebuilt, which happens when the slots in use pass 7/8 of the
+ * table; the table is then rebuilt at twice the number of entries.
  *
  * @verbatim
  * Revision History
@@ -59,10 +101,37 @@
  * @endverbatim
  */
 
-static	void hashtable_read_lock(HASHTABLE *table);
-static	void hashtable_read_unlock(HASHTABLE *table);
-static	void hashtable_write_lock(HASHTABLE *table);
-static	void hashtable_write_unlock(HASHTABLE *table);
+/**
+ * The entries, chains and slots that a writer has taken off the table to
+ * free once no reader can see them.
+ */
+typedef struct {
+	HASHENTRIES	*entries;	/*< Entries linked by their retired pointer */
+	HASHSTATE	*state;		/*< Replaced state or NULL */
+	HASHENTRIES	**chains;	/*< Chains emptied by a migration or NULL */
+	HASHOPEN	*open;		/*< Slots replaced by a rebuild or NULL */
+	void		*key;		/*< Key deleted without an entry or NULL */
+	void		*value;		/*< Its value */
+} HASHRETIRED;
+
+#define	HASHRETIRED_INIT	{ NULL, NULL, NULL, NULL, NULL, NULL }
+
+static	int hashtable_read_lock(HASHTABLE *table);
+static	void hashtable_read_unlock(HASHTABLE *table, int idx);
+static	void hashtable_retire(HASHTABLE *table, HASHENTRIES *entry);
+static	void hashtable_detach(HASHTABLE *table, HASHRETIRED *retired);
+static	void hashtable_reclaim(HASHTABLE *table, HASHRETIRED *retired);
+static	void hashtable_synchronize(HASHTABLE *table);
+static	void hashtable_migrate(HASHTABLE *table, HASHRETIRED *retired);
+static	HASHOPEN *hashopen_alloc(int n_groups);
+static	int hashopen_add(HASHTABLE *table, void *key, void *value);
+static	int hashopen_delete(HASHTABLE *table, void *key);
+static	void *hashopen_fetch(HASHTABLE *table, void *key);
+static	int hashopen_count(HASHTABLE *table, HASHOPEN *open, int *longest);
+static	void hashopen_free(HASHTABLE *table, HASHOPEN *open, int entries);
+
+static	__thread int	reader_slot = -1;	/*< Reader slot of the thread */
+static	int		next_reader_slot = 0;
 
 /**
  * Special null function used as default memory allfunctions in the hashtable
@@ -98,41 +167,97 @@ HASHTABLE 	*rval;
         rval->ht_chk_top = CHK_NUM_HASHTABLE;
         rval->ht_chk_tail = CHK_NUM_HASHTABLE;
 #endif
-	rval->hashsize = size;
 	rval->hashfn = hashfn;
 	rval->cmpfn = cmpfn;
 	rval->kcopyfn = nullfn;
 	rval->vcopyfn = nullfn;
 	rval->kfreefn = nullfn;
 	rval->vfreefn = nullfn;
-	rval->n_readers = 0;
-	rval->writelock = 0;
-	spinlock_init(&rval->spin);
-	if ((rval->entries = (HASHENTRIES **)calloc(size, sizeof(HASHENTRIES *))) == NULL)
+	rval->open = NULL;
+	rval->keyfn = NULL;
+	rval->n_entries = 0;
+	rval->migrate_pos = 0;
+	rval->migrate_after = 0;
+	rval->sync_started = 0;
+	rval->sync_done = 0;
+	rval->n_resizes = 0;
+	rval->n_migrated = 0;
+	rval->epoch = 0;
+	rval->retired = NULL;
+	rval->n_retired = 0;
+	spinlock_init_named(&rval->spin, "hashtable spin");
+	spinlock_init_named(&rval->sync, "hashtable sync");
+	if (posix_memalign((void **)&rval->readers, sizeof(HASHREADERS),
+			HASHTABLE_READER_SLOTS * sizeof(HASHREADERS)) != 0)
+	{
+		free(rval);
+		return NULL;
+	}
+	memset(rval->readers, 0, HASHTABLE_READER_SLOTS * sizeof(HASHREADERS));
+	if ((rval->state = (HASHSTATE *)calloc(1, sizeof(HASHSTATE))) == NULL)
 	{
+		free(rval->readers);
 		free(rval);
 		return NULL;
 	}
-	memset(rval->entries, 0, size * sizeof(HASHENTRIES *));
+	if ((rval->state->entries = (HASHENTRIES **)calloc(size, sizeof(HASHENTRIES *))) == NULL)
+	{
+		free(rval->state);
+		free(rval->readers);
+		free(rval);
+		return NULL;
+	}
+	rval->state->size = size;
 
 	return rval;
 }
 
 /**
- * Delete an entire hash table
+ * Allocate a new open addressing hash table. The table is used through the
+ * same functions as a table allocated with hashtable_alloc.
  *
- * @param	table	The hash table to delete
+ * @param size		The expected number of entries, the table grows as needed
+ * @param hashfn	The user supplied hash function
+ * @param cmpfn		The user supplied key comparison function
+ * @param keyfn		The function that returns the bytes kept inline for
+ *			a key, NULL if keys are only compared with cmpfn
+ * @return The hashtable table
  */
-void
-hashtable_free(HASHTABLE *table)
+HASHTABLE *
+hashtable_alloc_open(int size, int (*hashfn)(), int (*cmpfn)(), HASHKEYFN keyfn)
+{
+HASHTABLE	*rval;
+int		n_groups = 1;
+
+	if ((rval = hashtable_alloc(1, hashfn, cmpfn)) == NULL)
+		return NULL;
+	while (n_groups * HASHTABLE_GROUP < size + size / 2)
+		n_groups *= 2;
+	if ((rval->open = hashopen_alloc(n_groups)) == NULL)
+	{
+		hashtable_free(rval);
+		return NULL;
+	}
+	rval->keyfn = keyfn;
+	return rval;
+}
+
+/**
+ * Free the entries of a set of chains
+ *
+ * @param table		The hash table
+ * @param chains	The chains
+ * @param size		The number of chains
+ */
+static void
+hashtable_free_chains(HASHTABLE *table, HASHENTRIES **chains, int size)
 {
 int		i;
 HASHENTRIES	*entry, *ptr;
 
-	hashtable_write_lock(table);
-	for (i = 0; i < table->hashsize; i++)
+	for (i = 0; i < size; i++)
 	{
-		entry = table->entries[i];
+		entry = chains[i];
 		while (entry)
 		{
 			ptr = entry->next;
@@ -142,7 +267,42 @@ HASHENTRIES	*entry, *ptr;
 			entry = ptr;
 		}
 	}
-	free(table->entries);
+	free(chains);
+}
+
+/**
+ * Delete an entire hash table. The caller must make sure that the table is
+ * no longer used by any other thread.
+ *
+ * @param	table	The hash table to delete
+ */
+void
+hashtable_free(HASHTABLE *table)
+{
+HASHENTRIES	*entry, *ptr;
+
+	spinlock_acquire(&table->spin);
+	entry = table->retired;
+	while (entry)
+	{
+		ptr = entry->retired;
+		if (!entry->moved)
+		{
+			table->kfreefn(entry->key);
+			table->vfreefn(entry->value);
+		}
+		free(entry);
+		entry = ptr;
+	}
+	if (table->open)
+		hashopen_free(table, table->open, 1);
+	if (table->state->old_entries)
+		hashtable_free_chains(table, table->state->old_entries,
+					table->state->old_size);
+	hashtable_free_chains(table, table->state->entries, table->state->size);
+	free(table->state);
+	free(table->readers);
+	spinlock_release(&table->spin);
 	free(table);
 }
 
@@ -170,6 +330,78 @@ hashtable_memory_fns(HASHTABLE *table, HASHMEMORYFN kcopyfn, HASHMEMORYFN vcopyf
 		table->vfreefn = vfreefn;
 }
 
+/**
+ * Look for a key in the chains of the table. The old chains are searched
+ * first, an entry being migrated is always in one of the chains.
+ *
+ * Must be called by a reader or with the spinlock of the table held.
+ *
+ * @param table		The hash table
+ * @param state		The chains of the table
+ * @param hash		The hash value of the key
+ * @param key		The key
+ * @return		The entry or NULL if the key is not in the table
+ */
+static HASHENTRIES *
+hashtable_find(HASHTABLE *table, HASHSTATE *state, unsigned int hash, void *key)
+{
+HASHENTRIES	*entry;
+
+	if (state->old_entries)
+	{
+		entry = state->old_entries[hash % state->old_size];
+		while (entry && table->cmpfn(key, entry->key) != 0)
+			entry = entry->next;
+		if (entry)
+			return entry;
+	}
+	entry = state->entries[hash % state->size];
+	while (entry && table->cmpfn(key, entry->key) != 0)
+		entry = entry->next;
+	return entry;
+}
+
+/**
+ * Publish the chains of a table that is twice as large as the current one.
+ * The entries are migrated by the following adds and deletes, once the
+ * readers of the current state have left.
+ *
+ * Must be called with the spinlock of the table held.
+ *
+ * @param table		The hash table
+ * @param retired	Receives the replaced state, freed by the caller
+ */
+static void
+hashtable_grow(HASHTABLE *table, HASHRETIRED *retired)
+{
+HASHSTATE	*old = table->state, *state;
+int		size = old->size * 2 + 1;
+
+	if ((state = (HASHSTATE *)malloc(sizeof(HASHSTATE))) == NULL)
+		return;
+	if ((state->entries = (HASHENTRIES **)calloc(size, sizeof(HASHENTRIES *))) == NULL)
+	{
+		/*< The table keeps working with longer chains */
+		free(state);
+		return;
+	}
+	state->size = size;
+	state->old_entries = old->entries;
+	state->old_size = old->size;
+	__sync_synchronize();
+	table->state = state;
+	table->migrate_pos = 0;
+	table->n_resizes++;
+
+	/*<
+	 * Readers that still use the previous state do not look in the new
+	 * chains, no entry may be moved before a wait that starts after this.
+	 */
+	__sync_synchronize();
+	table->migrate_after = *(volatile int *)&table->sync_started;
+	retired->state = old;
+}
+
 /**
  * Add an item to the hash table.
  *
@@ -181,62 +413,70 @@ hashtable_memory_fns(HASHTABLE *table, HASHMEMORYFN kcopyfn, HASHMEMORYFN vcopyf
 int
 hashtable_add(HASHTABLE *table, void *key, void *value)
 {
-        int		hashkey;
-        HASHENTRIES	*entry;
+unsigned int	hashkey;
+HASHSTATE	*state;
+HASHENTRIES	*ptr;
+HASHRETIRED	retired = HASHRETIRED_INIT;
 
-        if (key == NULL || value == NULL)
-            return 0;
+	if (key == NULL || value == NULL)
+		return 0;
+	if (table->open)
+		return hashopen_add(table, key, value);
 
-        if (table->hashsize <= 0) {            
-            return 0;
-        } else {
-            hashkey = table->hashfn(key) % table->hashsize;
-        }
-	hashtable_write_lock(table);
-	entry = table->entries[hashkey % table->hashsize];
-	while (entry && table->cmpfn(key, entry->key) != 0)
+	spinlock_acquire(&table->spin);
+	state = table->state;
+	if (state->size <= 0)
 	{
-		entry = entry->next;
+		spinlock_release(&table->spin);
+		return 0;
 	}
-	if (entry && table->cmpfn(key, entry->key) == 0)
+	hashkey = (unsigned int)table->hashfn(key);
+	if (hashtable_find(table, state, hashkey, key) != NULL)
 	{
 		/* Duplicate key value */
-		hashtable_write_unlock(table);
+		spinlock_release(&table->spin);
 		return 0;
 	}
-	else
+	if ((ptr = (HASHENTRIES *)malloc(sizeof(HASHENTRIES))) == NULL)
 	{
-		HASHENTRIES	*ptr = (HASHENTRIES *)malloc(sizeof(HASHENTRIES));
-		if (ptr == NULL)
-		{
-			hashtable_write_unlock(table);
-			return 0;
-		}
-
-		/* copy the key */
-		ptr->key = table->kcopyfn(key);
-
-		/* check succesfull key copy */
-		if ( ptr->key  == NULL) {
-			return 0;
-		}
+		spinlock_release(&table->spin);
+		return 0;
+	}
 
-		/* copy the value */
-		ptr->value = table->vcopyfn(value);
+	/* copy the key */
+	if ((ptr->key = table->kcopyfn(key)) == NULL)
+	{
+		spinlock_release(&table->spin);
+		free(ptr);
+		return 0;
+	}
 
-		/* check succesfull value copy */
-		if  ( ptr->value == NULL) {
-			/* remove the key ! */
-			table->kfreefn(ptr->key);
+	/* copy the value */
+	if ((ptr->value = table->vcopyfn(value)) == NULL)
+	{
+		spinlock_release(&table->spin);
+		/* remove the key ! */
+		table->kfreefn(ptr->key);
+		free(ptr);
+		return 0;
+	}
+	hashkey %= state->size;
+	ptr->next = state->entries[hashkey];
+	ptr->retired = NULL;
+	ptr->moved = 0;
 
-			/* value not copied, return */
-			return 0;
-		}
+	/*< The entry must be complete before readers can find it */
+	__sync_synchronize();
+	state->entries[hashkey] = ptr;
+	table->n_entries++;
 
-		ptr->next = table->entries[hashkey % table->hashsize];
-		table->entries[hashkey % table->hashsize] = ptr;
-	}
-	hashtable_write_unlock(table);
+	if (state->old_entries)
+		hashtable_migrate(table, &retired);
+	else if (table->n_entries > state->size * HASHTABLE_MAX_LOAD)
+		hashtable_grow(table, &retired);
+	hashtable_detach(table, &retired);
+	spinlock_release(&table->spin);
+	hashtable_reclaim(table, &retired);
 	return 1;
 }
 
@@ -250,54 +490,71 @@ hashtable_add(HASHTABLE *table, void *key, void *value)
 int
 hashtable_delete(HASHTABLE *table, void *key)
 {
-int		hashkey = table->hashfn(key) % table->hashsize;
-HASHENTRIES	*entry, *ptr;
+unsigned int	hashkey;
+HASHSTATE	*state;
+HASHENTRIES	**chain, *entry, *prev;
+HASHRETIRED	retired = HASHRETIRED_INIT;
 
-	hashtable_write_lock(table);
-	entry = table->entries[hashkey % table->hashsize];
-	while (entry && entry->key && table->cmpfn(key, entry->key) != 0)
-	{
-		entry = entry->next;
-	}
-	if (entry == NULL)
+	if (key == NULL)
+		return 0;
+	if (table->open)
+		return hashopen_delete(table, key);
+
+	spinlock_acquire(&table->spin);
+	state = table->state;
+	if (state->size <= 0)
 	{
-		/* Not found */
-		hashtable_write_unlock(table);
+		spinlock_release(&table->spin);
 		return 0;
 	}
-
-	if (entry == table->entries[hashkey % table->hashsize])
+	hashkey = (unsigned int)table->hashfn(key);
+	chain = NULL;
+	entry = NULL;
+	if (state->old_entries)
 	{
-		/* We are removing from the first entry */
-		table->entries[hashkey % table->hashsize] = entry->next;
-		table->kfreefn(entry->key);
-		table->vfreefn(entry->value);
-
-                if (entry->next != NULL) {
-                    entry->key = entry->next->key;
-                    entry->value = entry->next->value;
-                } else {
-                    entry->key = NULL;
-                    entry->value = NULL;
-                }
-		free(entry);
+		chain = &state->old_entries[hashkey % state->old_size];
+		prev = NULL;
+		entry = *chain;
+		while (entry && table->cmpfn(key, entry->key) != 0)
+		{
+			prev = entry;
+			entry = entry->next;
+		}
 	}
-	else
+	if (entry == NULL)
 	{
-		ptr = table->entries[hashkey % table->hashsize];
-		while (ptr && ptr->next != entry)
-			ptr = ptr->next;
-		if (ptr == NULL)
+		chain = &state->entries[hashkey % state->size];
+		prev = NULL;
+		entry = *chain;
+		while (entry && table->cmpfn(key, entry->key) != 0)
 		{
-			hashtable_write_unlock(table);
-			return 0;	/* This should never happen */
+			prev = entry;
+			entry = entry->next;
 		}
-		ptr->next = entry->next;
-		table->kfreefn(entry->key);
-		table->vfreefn(entry->value);
-		free(entry);
 	}
-	hashtable_write_unlock(table);
+	if (entry == NULL)
+	{
+		/* Not found */
+		spinlock_release(&table->spin);
+		return 0;
+	}
+
+	/*<
+	 * The entry keeps its next pointer, readers that are on the entry
+	 * still get to the rest of the chain.
+	 */
+	if (prev == NULL)
+		*chain = entry->next;
+	else
+		prev->next = entry->next;
+	table->n_entries--;
+	hashtable_retire(table, entry);
+
+	if (state->old_entries)
+		hashtable_migrate(table, &retired);
+	hashtable_detach(table, &retired);
+	spinlock_release(&table->spin);
+	hashtable_reclaim(table, &retired);
 	return 1;
 }
 
@@ -311,25 +568,57 @@ HASHENTRIES	*entry, *ptr;
 void *
 hashtable_fetch(HASHTABLE *table, void *key)
 {
-int		hashkey = table->hashfn(key) % table->hashsize;
+HASHSTATE	*state;
 HASHENTRIES	*entry;
+void		*value = NULL;
+int		idx;
 
-	hashtable_read_lock(table);
-	entry = table->entries[hashkey % table->hashsize];
-	while (entry && entry->key && table->cmpfn(key, entry->key) != 0)
-	{
-		entry = entry->next;
-	}
-	if (entry == NULL)
-	{
-		hashtable_read_unlock(table);
+	if (key == NULL)
 		return NULL;
+	if (table->open)
+		return hashopen_fetch(table, key);
+
+	idx = hashtable_read_lock(table);
+	state = *(HASHSTATE * volatile *)&table->state;
+	if (state->size > 0)
+	{
+		entry = hashtable_find(table, state,
+				(unsigned int)table->hashfn(key), key);
+		if (entry)
+			value = entry->value;
 	}
-	else
+	hashtable_read_unlock(table, idx);
+	return value;
+}
+
+/**
+ * Count the entries of a set of chains
+ *
+ * @param chains	The chains
+ * @param size		The number of chains
+ * @param longest	Set to the longest chain if that is longer
+ * @return		The number of entries
+ */
+static int
+hashtable_count(HASHENTRIES **chains, int size, int *longest)
+{
+HASHENTRIES	*entry;
+int		total = 0, i, j;
+
+	for (i = 0; i < size; i++)
 	{
-		hashtable_read_unlock(table);
-		return entry->value;
+		j = 0;
+		entry = chains[i];
+		while (entry)
+		{
+			j++;
+			entry = entry->next;
+		}
+		total += j;
+		if (j > *longest)
+			*longest = j;
 	}
+	return total;
 }
 
 /**
@@ -340,30 +629,42 @@ HASHENTRIES	*entry;
 void
 hashtable_stats(HASHTABLE *table)
 {
-int		total, longest, i, j;
-HASHENTRIES	*entries;
+HASHSTATE	*state;
+int		total, longest, size, old_size, idx;
 
-	printf("Hashtable: %p, size %d\n", table, table->hashsize);
 	total = 0;
 	longest = 0;
-	hashtable_read_lock(table);
-	for (i = 0; i < table->hashsize; i++)
+	idx = hashtable_read_lock(table);
+	if (table->open)
 	{
-		j = 0;
-		entries = table->entries[i];
-		while (entries)
-		{
-			j++;
-			entries = entries->next;
-		}
-		total += j;
-		if (j > longest)
-			longest = j;
+		HASHOPEN	*open = *(HASHOPEN * volatile *)&table->open;
+
+		size = open->n_groups * HASHTABLE_GROUP;
+		total = hashopen_count(table, open, &longest);
+		hashtable_read_unlock(table, idx);
+		printf("Hashtable: %p, open addressing, %d slots\n", table, size);
+		printf("\tNo. of entries:     	%d\n", total);
+		printf("\tLoad factor:		%.2f\n", (float)total / size);
+		printf("\tLongest probe:		%d groups\n", longest);
+		printf("\tNo. of rebuilds:	%d\n", table->n_resizes);
+		return;
 	}
-	hashtable_read_unlock(table);
+	state = *(HASHSTATE * volatile *)&table->state;
+	size = state->size;
+	old_size = state->old_size;
+	if (state->old_entries)
+		total += hashtable_count(state->old_entries, old_size, &longest);
+	total += hashtable_count(state->entries, size, &longest);
+	hashtable_read_unlock(table, idx);
+	printf("Hashtable: %p, size %d\n", table, size);
 	printf("\tNo. of entries:     	%d\n", total);
-	printf("\tAverage chain length:	%.1f\n", (float)total / table->hashsize);
+	printf("\tAverage chain length:	%.1f\n", (float)total / size);
 	printf("\tLongest chain length:	%d\n", longest);
+	printf("\tNo. of resizes:		%d\n", table->n_resizes);
+	printf("\tChains migrated:	%d\n", table->n_migrated);
+	if (old_size > 0)
+		printf("\tChains to migrate:	%d of %d\n",
+			old_size - table->migrate_pos, old_size);
 }
 
 /** 
@@ -393,122 +694,714 @@ void hashtable_get_stats(
         int*  longest)
 {
         HASHTABLE*   ht;
-        HASHENTRIES* entries;
-        int          i;
-        int          j;
+        HASHSTATE*   state;
+        int          idx;
 
         ht = (HASHTABLE *)table;
         CHK_HASHTABLE(ht);
         *nelems = 0;
         *longest = 0;
-	hashtable_read_lock(ht);
-        
-	for (i = 0; i < ht->hashsize; i++)
+	idx = hashtable_read_lock(ht);
+        if (ht->open) {
+                HASHOPEN* open = *(HASHOPEN * volatile *)&ht->open;
+
+                *nelems = hashopen_count(ht, open, longest);
+                *hashsize = open->n_groups * HASHTABLE_GROUP;
+                hashtable_read_unlock(ht, idx);
+                return;
+        }
+        state = *(HASHSTATE * volatile *)&ht->state;
+
+        if (state->old_entries) {
+                *nelems += hashtable_count(state->old_entries,
+                                           state->old_size,
+                                           longest);
+        }
+        *nelems += hashtable_count(state->entries, state->size, longest);
+        *hashsize = state->size;
+	hashtable_read_unlock(ht, idx);
+}
+
+
+/**
+ * Enter the hashtable as a reader. Entering never waits, the reader
+ * increments the count of the current epoch in the reader slot of its
+ * thread. The entries the reader finds stay valid until it leaves.
+ *
+ * @param table		The hashtable to enter
+ * @return		The count to decrement when leaving
+ */
+static int
+hashtable_read_lock(HASHTABLE *table)
+{
+int	idx;
+
+	if (reader_slot < 0)
+		reader_slot = (unsigned int)atomic_add(&next_reader_slot, 1)
+				% HASHTABLE_READER_SLOTS;
+	idx = *(volatile int *)&table->epoch & 1;
+	atomic_add(&table->readers[reader_slot].count[idx], 1);
+	return idx;
+}
+
+/**
+ * Leave the hashtable.
+ *
+ * @param table		The hash table
+ * @param idx		The value returned by hashtable_read_lock
+ */
+static void
+hashtable_read_unlock(HASHTABLE *table, int idx)
+{
+	atomic_add(&table->readers[reader_slot].count[idx], -1);
+}
+
+/**
+ * Wait until no reader is left that entered with the given epoch parity.
+ * Readers that enter while the slots are checked have started after the
+ * retired entries were unlinked and can not find them.
+ *
+ * @param table		The hash table
+ * @param idx		The epoch parity
+ */
+static void
+hashtable_wait_readers(HASHTABLE *table, int idx)
+{
+int	i;
+
+	for (i = 0; i < HASHTABLE_READER_SLOTS; i++)
 	{
-		j = 0;
-		entries = ht->entries[i];
-		while (entries)
-		{
-			j++;
-			entries = entries->next;
-		}
-		*nelems += j;
-		if (j > *longest) {
-			*longest = j;
-                }
+		/*< A reader may have been preempted, give it the processor */
+		while (*(volatile int *)&table->readers[i].count[idx] != 0)
+			sched_yield();
 	}
-        *hashsize = ht->hashsize;
-	hashtable_read_unlock(ht);
 }
 
+/**
+ * Put an entry that has been unlinked from its chain on the retired list.
+ *
+ * Must be called with the spinlock of the table held.
+ *
+ * @param table		The hash table
+ * @param entry		The unlinked entry
+ */
+static void
+hashtable_retire(HASHTABLE *table, HASHENTRIES *entry)
+{
+	entry->retired = table->retired;
+	table->retired = entry;
+	table->n_retired++;
+}
+
+/**
+ * Take the retired list off the table once it is long enough, adding it to
+ * the entries the caller already has to free. The list grows with the table
+ * so that the cost of the wait stays small next to the entries it frees.
+ *
+ * Must be called with the spinlock of the table held.
+ *
+ * @param table		The hash table
+ * @param retired	The entries the caller frees after the wait
+ */
+static void
+hashtable_detach(HASHTABLE *table, HASHRETIRED *retired)
+{
+HASHENTRIES	*tail;
+
+	if (table->n_retired < HASHTABLE_RETIRE_BATCH + table->n_entries / 4)
+		return;
+	for (tail = table->retired; tail->retired; tail = tail->retired)
+		;
+	tail->retired = retired->entries;
+	retired->entries = table->retired;
+	table->retired = NULL;
+	table->n_retired = 0;
+}
 
 /**
- * Take a read lock on the hashtable.
+ * Wait until all the readers that are inside the table have left. The
+ * readers of the previous epoch are waited for first, as they may still be
+ * inside, then new readers are moved to the next epoch and the readers of
+ * the current one are waited for. The waits of different writers are
+ * serialised by the sync spinlock of the table and counted, so that a
+ * writer can tell whether a wait started after a change has completed.
  *
- * The hashtable support multiple readers and a single writer,
- * we have a spinlock to protect the two counts, n_readers and
- * writelock.
+ * @param table		The hash table
+ */
+static void
+hashtable_synchronize(HASHTABLE *table)
+{
+int	idx;
+
+	spinlock_acquire(&table->sync);
+	table->sync_started++;
+	idx = table->epoch & 1;
+	/*< The unlinks must be visible before the counts are read */
+	__sync_synchronize();
+	hashtable_wait_readers(table, idx ^ 1);
+	table->epoch++;
+	__sync_synchronize();
+	hashtable_wait_readers(table, idx);
+	__sync_synchronize();
+	table->sync_done++;
+	spinlock_release(&table->sync);
+}
+
+/**
+ * Free the entries, chains and slots taken off the table once all the
+ * readers that may still see them have left. The key and value of an entry that was migrated
+ * belong to its copy and are not freed.
+ *
+ * Must be called without the spinlock of the table held.
  *
- * We take the hashtable spinlock and then check that writelock
- * is set to zero. If not we release the spinlock and do dirty
- * reads of writelock until it goes to 0. Once it is zero we
- * acquire the spinlock again and test that writelock is still
- * 0.
+ * @param table		The hash table
+ * @param retired	The entries and chains to free
+ */
+static void
+hashtable_reclaim(HASHTABLE *table, HASHRETIRED *retired)
+{
+HASHENTRIES	*entry, *ptr;
+
+	if (retired->entries == NULL && retired->state == NULL &&
+	    retired->chains == NULL && retired->open == NULL &&
+	    retired->key == NULL)
+		return;
+	hashtable_synchronize(table);
+
+	entry = retired->entries;
+	while (entry)
+	{
+		ptr = entry->retired;
+		if (!entry->moved)
+		{
+			table->kfreefn(entry->key);
+			table->vfreefn(entry->value);
+		}
+		free(entry);
+		entry = ptr;
+	}
+	free(retired->state);
+	free(retired->chains);
+	if (retired->open)
+		hashopen_free(table, retired->open, 0);
+	if (retired->key)
+	{
+		table->kfreefn(retired->key);
+		table->vfreefn(retired->value);
+	}
+}
+
+/**
+ * Move the entries of the next few old chains to the new chains. Each entry
+ * is copied, the copies are linked to the new chains before the old chain
+ * is unlinked so that readers always find the entry in one of the chains.
+ * The originals of all the chains moved are handed to the caller, which
+ * frees them after a single wait. Once the last old chain is empty the old
+ * chains are handed over as well. Nothing is moved before the readers that
+ * may not look in the new chains have left.
  *
- * With writelock set to zero we increment n_readers with the
- * spinlock still held.
+ * Must be called with the spinlock of the table held.
  *
- * @param table		The hashtable to lock.
+ * @param table		The hash table
+ * @param retired	The entries and chains the caller frees after the wait
  */
 static void
-hashtable_read_lock(HASHTABLE *table)
+hashtable_migrate(HASHTABLE *table, HASHRETIRED *retired)
 {
-	spinlock_acquire(&table->spin);
-	while (table->writelock)
+HASHSTATE	*state = table->state, *done;
+HASHENTRIES	*entry, *copy, *copies, *next;
+unsigned int	hashkey;
+int		n;
+
+	/*< The readers of the state before the resize may still be inside */
+	if (*(volatile int *)&table->sync_done <= table->migrate_after)
+		return;
+	for (n = 0; n < HASHTABLE_MIGRATE_STEP &&
+			table->migrate_pos < state->old_size; n++)
 	{
-		spinlock_release(&table->spin);
-		while (table->writelock)
-			;
-		spinlock_acquire(&table->spin);
+		copies = NULL;
+		for (entry = state->old_entries[table->migrate_pos]; entry;
+				entry = entry->next)
+		{
+			if ((copy = (HASHENTRIES *)malloc(sizeof(HASHENTRIES))) == NULL)
+			{
+				/*< Try again with the next operation */
+				while (copies)
+				{
+					next = copies->next;
+					free(copies);
+					copies = next;
+				}
+				return;
+			}
+			copy->key = entry->key;
+			copy->value = entry->value;
+			copy->retired = NULL;
+			copy->moved = 0;
+			copy->next = copies;
+			copies = copy;
+		}
+		while (copies)
+		{
+			next = copies->next;
+			hashkey = (unsigned int)table->hashfn(copies->key) % state->size;
+			copies->next = state->entries[hashkey];
+			__sync_synchronize();
+			state->entries[hashkey] = copies;
+			copies = next;
+		}
+		__sync_synchronize();
+		entry = state->old_entries[table->migrate_pos];
+		state->old_entries[table->migrate_pos] = NULL;
+		table->migrate_pos++;
+		table->n_migrated++;
+		while (entry)
+		{
+			next = entry->next;
+			entry->moved = 1;
+			entry->retired = retired->entries;
+			retired->entries = entry;
+			entry = next;
+		}
 	}
-	table->n_readers++;
-	spinlock_release(&table->spin);
+	if (table->migrate_pos < state->old_size)
+		return;
+
+	if ((done = (HASHSTATE *)malloc(sizeof(HASHSTATE))) == NULL)
+		return;
+	done->size = state->size;
+	done->entries = state->entries;
+	done->old_size = 0;
+	done->old_entries = NULL;
+	__sync_synchronize();
+	table->state = done;
+
+	/*< The wait of the caller also waits out the users of the state */
+	retired->state = state;
+	retired->chains = state->old_entries;
+}
+
+/**
+ * Mix the bits of a hash value, the hash functions of the callers often only
+ * use a few bits of the key.
+ */
+static unsigned int
+hashopen_mix(unsigned int h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+/**
+ * The hash value of an inline key
+ */
+static unsigned int
+hashopen_hash_bytes(const char *data, int len)
+{
+unsigned int	h = 2166136261u;
+int		i;
+
+	for (i = 0; i < len; i++)
+	{
+		h ^= (unsigned char)data[i];
+		h *= 16777619;
+	}
+	return hashopen_mix(h);
+}
+
+/**
+ * Return a bit for each control byte of a group that is equal to a value
+ *
+ * @param ctrl	The control bytes of the group
+ * @param value	The value
+ * @return	Bit i is set if ctrl[i] is equal to value
+ */
+static unsigned int
+hashopen_match(const unsigned char *ctrl, unsigned char value)
+{
+#ifdef __SSE2__
+__m128i	group = _mm_loadu_si128((const __m128i *)ctrl);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)value)));
+#else
+unsigned int	bits = 0;
+int		i;
+
+	for (i = 0; i < HASHTABLE_GROUP; i++)
+	{
+		if (ctrl[i] == value)
+			bits |= 1 << i;
+	}
+	return bits;
+#endif
 }
 
 /**
- * Release a previously obtained readlock.
+ * Allocate the slots of an open addressing table, all empty
  *
- * Simply decrement the n_readers value for the hash table
+ * @param n_groups	The number of groups of slots, a power of two
+ * @return		The slots or NULL if out of memory
+ */
+static HASHOPEN *
+hashopen_alloc(int n_groups)
+{
+HASHOPEN	*open;
+int		n_slots = n_groups * HASHTABLE_GROUP;
+
+	if ((open = (HASHOPEN *)malloc(sizeof(HASHOPEN))) == NULL)
+		return NULL;
+	if ((open->ctrl = (unsigned char *)malloc(n_slots)) == NULL)
+	{
+		free(open);
+		return NULL;
+	}
+	if (posix_memalign((void **)&open->slots, sizeof(HASHSLOT),
+				n_slots * sizeof(HASHSLOT)) != 0)
+	{
+		free(open->ctrl);
+		free(open);
+		return NULL;
+	}
+	memset(open->ctrl, HASHOPEN_EMPTY, n_slots);
+	open->n_groups = n_groups;
+	open->n_used = 0;
+	return open;
+}
+
+/**
+ * Free the slots of an open addressing table
  *
- * @param table		The hash table to unlock
+ * @param table		The hash table
+ * @param open		The slots
+ * @param entries	Non-zero if the keys and values are freed as well
  */
 static void
-hashtable_read_unlock(HASHTABLE *table)
+hashopen_free(HASHTABLE *table, HASHOPEN *open, int entries)
 {
-	atomic_add(&table->n_readers, -1);
+int	i;
+
+	for (i = 0; entries && i < open->n_groups * HASHTABLE_GROUP; i++)
+	{
+		if (open->ctrl[i] < HASHOPEN_EMPTY)
+		{
+			table->kfreefn(open->slots[i].key);
+			table->vfreefn(open->slots[i].value);
+		}
+	}
+	free(open->slots);
+	free(open->ctrl);
+	free(open);
 }
 
 /**
- * Obtain an exclusive write lock for the hash table.
+ * Compute the inline form and the hash value of a key. Keys that are too
+ * long to be kept inline are hashed with the hash function of the table.
  *
- * We acquire the hashtable spinlock, check for the number of
- * readers beign zero. If it is not we hold the spinlock and
- * loop waiting for the n_readers to reach zero. This will prevent
- * any new readers beign granted access but will not prevent current
- * readers releasing the read lock.
+ * @param table		The hash table
+ * @param key		The key
+ * @param kdata		Buffer of HASHTABLE_INLINE_KEY bytes for the inline key
+ * @param klen		Set to the length of the inline key or HASHOPEN_NOT_INLINE
+ * @return		The hash value
+ */
+static unsigned int
+hashopen_key(HASHTABLE *table, void *key, char *kdata, unsigned char *klen)
+{
+int	len;
+
+	if (table->keyfn &&
+		(len = table->keyfn(key, kdata, HASHTABLE_INLINE_KEY)) >= 0 &&
+		len <= HASHTABLE_INLINE_KEY)
+	{
+		*klen = len;
+		return hashopen_hash_bytes(kdata, len);
+	}
+	*klen = HASHOPEN_NOT_INLINE;
+	return hashopen_mix((unsigned int)table->hashfn(key));
+}
+
+/**
+ * Find the slot of a key
  *
- * Once we have no readers we increment writelock and test if we are
- * the only writelock holder, if not we repeat the process. We hold
- * the spinlock throughout the process since both read and write
- * locks do not require the spinlock to be acquired.
+ * Must be called by a reader or with the spinlock of the table held.
  *
- * @param table	The table to lock for updates
+ * @param table		The hash table
+ * @param open		The slots of the table
+ * @param key		The key
+ * @param hash		The hash value of the key
+ * @param kdata		The inline key
+ * @param klen		The length of the inline key
+ * @return		The slot or NULL if the key is not in the table
+ */
+static HASHSLOT *
+hashopen_find(HASHTABLE *table, HASHOPEN *open, void *key, unsigned int hash,
+		char *kdata, unsigned char klen)
+{
+unsigned int	mask = open->n_groups - 1;
+unsigned int	group = hash & mask;
+unsigned char	tag = HASHOPEN_TAG(hash);
+unsigned char	*ctrl;
+HASHSLOT	*slot;
+unsigned int	bits;
+int		probes;
+
+	for (probes = 0; probes < open->n_groups; probes++)
+	{
+		ctrl = &open->ctrl[group * HASHTABLE_GROUP];
+		bits = hashopen_match(ctrl, tag);
+		while (bits)
+		{
+			slot = &open->slots[group * HASHTABLE_GROUP + __builtin_ctz(bits)];
+			if (slot->klen == klen &&
+				(klen == HASHOPEN_NOT_INLINE ?
+					table->cmpfn(key, slot->key) == 0 :
+					memcmp(kdata, slot->kdata, klen) == 0))
+				return slot;
+			bits &= bits - 1;
+		}
+		/*< An entry is always in the first group with an empty slot */
+		if (hashopen_match(ctrl, HASHOPEN_EMPTY))
+			break;
+		group = (group + 1) & mask;
+	}
+	return NULL;
+}
+
+
+/**
+ * Put an entry into the first empty slot of its probe sequence. The slot
+ * is filled in before its control byte is set, which makes it visible to
+ * the readers.
+ *
+ * Must be called with the spinlock of the table held and with an empty slot
+ * in the table.
  */
 static void
-hashtable_write_lock(HASHTABLE *table)
+hashopen_insert(HASHOPEN *open, unsigned int hash, void *key, void *value,
+		char *kdata, unsigned char klen)
+{
+unsigned int	mask = open->n_groups - 1;
+unsigned int	group = hash & mask;
+unsigned int	bits;
+int		i;
+
+	while ((bits = hashopen_match(&open->ctrl[group * HASHTABLE_GROUP],
+				HASHOPEN_EMPTY)) == 0)
+		group = (group + 1) & mask;
+	i = group * HASHTABLE_GROUP + __builtin_ctz(bits);
+	open->slots[i].key = key;
+	open->slots[i].value = value;
+	open->slots[i].klen = klen;
+	if (klen != HASHOPEN_NOT_INLINE)
+		memcpy(open->slots[i].kdata, kdata, klen);
+	__sync_synchronize();
+	open->ctrl[i] = HASHOPEN_TAG(hash);
+	open->n_used++;
+}
+
+/**
+ * Rebuild the slots of an open table with room for twice the entries it
+ * holds, dropping the deleted slots. The new slots are published once
+ * complete, the old ones are handed to the caller, which frees them when no
+ * reader can use them any more.
+ *
+ * Must be called with the spinlock of the table held.
+ *
+ * @param table		The hash table
+ * @param retired	Receives the replaced slots, freed by the caller
+ * @return		Non-zero if the table was rebuilt
+ */
+static int
+hashopen_rebuild(HASHTABLE *table, HASHRETIRED *retired)
 {
-int	available;
+HASHOPEN	*old = table->open, *open;
+HASHSLOT	*slot;
+unsigned int	hash;
+int		n_groups = 1, i;
 
+	while (n_groups * HASHTABLE_GROUP < (table->n_entries + 1) * 2)
+		n_groups *= 2;
+	if ((open = hashopen_alloc(n_groups)) == NULL)
+		return 0;
+	for (i = 0; i < old->n_groups * HASHTABLE_GROUP; i++)
+	{
+		if (old->ctrl[i] >= HASHOPEN_EMPTY)
+			continue;
+		slot = &old->slots[i];
+		if (slot->klen == HASHOPEN_NOT_INLINE)
+			hash = hashopen_mix((unsigned int)table->hashfn(slot->key));
+		else
+			hash = hashopen_hash_bytes(slot->kdata, slot->klen);
+		hashopen_insert(open, hash, slot->key, slot->value,
+				slot->kdata, slot->klen);
+	}
+	__sync_synchronize();
+	table->open = open;
+	table->n_resizes++;
+	retired->open = old;
+	return 1;
+}
+
+/**
+ * Add an entry to an open addressing table
+ *
+ * @param table		The hash table
+ * @param key		The key of the item
+ * @param value		The value for the item
+ * @return		The number of items added
+ */
+static int
+hashopen_add(HASHTABLE *table, void *key, void *value)
+{
+char		kdata[HASHTABLE_INLINE_KEY];
+unsigned char	klen;
+unsigned int	hash;
+void		*kcopy, *vcopy;
+HASHRETIRED	retired = HASHRETIRED_INIT;
+
+	hash = hashopen_key(table, key, kdata, &klen);
 	spinlock_acquire(&table->spin);
-	do {
-		while (table->n_readers)
-			;
-		available = atomic_add(&table->writelock, 1);
-		if (available != 0)
-			atomic_add(&table->writelock, -1);
-	} while (available != 0);
+	if (hashopen_find(table, table->open, key, hash, kdata, klen) != NULL)
+	{
+		/* Duplicate key value */
+		spinlock_release(&table->spin);
+		return 0;
+	}
+	if ((table->open->n_used + 1) * 8 > table->open->n_groups * HASHTABLE_GROUP * 7 &&
+		!hashopen_rebuild(table, &retired) &&
+		table->open->n_used == table->open->n_groups * HASHTABLE_GROUP)
+	{
+		spinlock_release(&table->spin);
+		return 0;
+	}
+	if ((kcopy = table->kcopyfn(key)) == NULL)
+	{
+		spinlock_release(&table->spin);
+		hashtable_reclaim(table, &retired);
+		return 0;
+	}
+	if ((vcopy = table->vcopyfn(value)) == NULL)
+	{
+		spinlock_release(&table->spin);
+		hashtable_reclaim(table, &retired);
+		table->kfreefn(kcopy);
+		return 0;
+	}
+	hashopen_insert(table->open, hash, kcopy, vcopy, kdata, klen);
+	table->n_entries++;
 	spinlock_release(&table->spin);
+	hashtable_reclaim(table, &retired);
+	return 1;
 }
 
 /**
- * Release the write lock on the hash table.
+ * Delete an entry from an open addressing table. The slot is marked as
+ * deleted, the key and value are retired as readers may still use them.
  *
- * @param table The hash table to unlock
+ * @param table		The hash table
+ * @param key		The key value of the item to remove
+ * @return		The number of items deleted
  */
-static void
-hashtable_write_unlock(HASHTABLE *table)
+static int
+hashopen_delete(HASHTABLE *table, void *key)
 {
-	atomic_add(&table->writelock, -1);
+char		kdata[HASHTABLE_INLINE_KEY];
+unsigned char	klen;
+unsigned int	hash;
+HASHSLOT	*slot;
+HASHENTRIES	*entry;
+HASHRETIRED	retired = HASHRETIRED_INIT;
+
+	hash = hashopen_key(table, key, kdata, &klen);
+	spinlock_acquire(&table->spin);
+	if ((slot = hashopen_find(table, table->open, key, hash, kdata, klen)) == NULL)
+	{
+		/* Not found */
+		spinlock_release(&table->spin);
+		return 0;
+	}
+	table->open->ctrl[slot - table->open->slots] = HASHOPEN_DELETED;
+	table->n_entries--;
+	if ((entry = (HASHENTRIES *)malloc(sizeof(HASHENTRIES))) != NULL)
+	{
+		entry->key = slot->key;
+		entry->value = slot->value;
+		entry->next = NULL;
+		entry->moved = 0;
+		hashtable_retire(table, entry);
+		hashtable_detach(table, &retired);
+	}
+	else
+	{
+		retired.key = slot->key;
+		retired.value = slot->value;
+	}
+	spinlock_release(&table->spin);
+	hashtable_reclaim(table, &retired);
+	return 1;
+}
+
+/**
+ * Fetch the value of a key from an open addressing table
+ *
+ * @param table		The hash table
+ * @param key		The key value
+ * @return		The value or NULL if the key is not in the table
+ */
+static void *
+hashopen_fetch(HASHTABLE *table, void *key)
+{
+char		kdata[HASHTABLE_INLINE_KEY];
+unsigned char	klen;
+unsigned int	hash;
+HASHSLOT	*slot;
+void		*value = NULL;
+int		idx;
+
+	hash = hashopen_key(table, key, kdata, &klen);
+	idx = hashtable_read_lock(table);
+	slot = hashopen_find(table, *(HASHOPEN * volatile *)&table->open,
+			key, hash, kdata, klen);
+	if (slot)
+		value = slot->value;
+	hashtable_read_unlock(table, idx);
+	return value;
+}
+
+/**
+ * Count the entries of an open table and find the longest probe, the
+ * number of groups looked at to find an entry.
+ *
+ * @param table		The hash table
+ * @param open		The slots of the table
+ * @param longest	Set to the longest probe if that is longer
+ * @return		The number of entries
+ */
+static int
+hashopen_count(HASHTABLE *table, HASHOPEN *open, int *longest)
+{
+HASHSLOT	*slot;
+unsigned int	hash;
+int		total = 0, i, probe;
+
+	for (i = 0; i < open->n_groups * HASHTABLE_GROUP; i++)
+	{
+		if (open->ctrl[i] >= HASHOPEN_EMPTY)
+			continue;
+		total++;
+		slot = &open->slots[i];
+		if (slot->klen == HASHOPEN_NOT_INLINE)
+			hash = hashopen_mix((unsigned int)table->hashfn(slot->key));
+		else
+			hash = hashopen_hash_bytes(slot->kdata, slot->klen);
+		probe = ((i / HASHTABLE_GROUP - hash) & (open->n_groups - 1)) + 1;
+		if (probe > *longest)
+			*longest = probe;
+	}
+	return total;
 }
 
 /**
@@ -541,28 +1434,57 @@ void *
 hashtable_next(HASHITERATOR *iter)
 {
 int		i;
+HASHSTATE	*state;
 HASHENTRIES	*entries;
+void		*key = NULL;
+int		idx;
 
 	iter->depth++;
-	while (iter->chain < iter->table->hashsize)
+	idx = hashtable_read_lock(iter->table);
+	if (iter->table->open)
 	{
-		if ((entries = iter->table->entries[iter->chain]) != NULL)
+		HASHOPEN	*open = *(HASHOPEN * volatile *)&iter->table->open;
+
+		/*< The chain is the slot, a rebuild may change the order */
+		if (iter->depth > 0)
+			iter->chain++;
+		while (iter->chain < open->n_groups * HASHTABLE_GROUP)
 		{
-			i = 0;
-			hashtable_read_lock(iter->table);
-			while (entries && i < iter->depth)
+			if (open->ctrl[iter->chain] < HASHOPEN_EMPTY)
 			{
-				entries = entries->next;
-				i++;
+				key = open->slots[iter->chain].key;
+				break;
 			}
-			hashtable_read_unlock(iter->table);
-			if (entries)
-				return entries->key;
+			iter->chain++;
+		}
+		hashtable_read_unlock(iter->table, idx);
+		return key;
+	}
+	state = *(HASHSTATE * volatile *)&iter->table->state;
+
+	/*< The old chains, if the table is growing, come before the new ones */
+	while (iter->chain < state->old_size + state->size)
+	{
+		if (iter->chain < state->old_size)
+			entries = state->old_entries[iter->chain];
+		else
+			entries = state->entries[iter->chain - state->old_size];
+		i = 0;
+		while (entries && i < iter->depth)
+		{
+			entries = entries->next;
+			i++;
+		}
+		if (entries)
+		{
+			key = entries->key;
+			break;
 		}
 		iter->depth = 0;
 		iter->chain++;
 	}
-	return NULL;
+	hashtable_read_unlock(iter->table, idx);
+	return key;
 }
 
 /**
@@ -0,0 +1,129 @@
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2014
+ */
+
+/**
+ * @file lockstats.c  - The show locks report
+ *
+ * Lists the lock classes with the most contended acquisitions, from the
+ * profiles of the named spinlocks and the statistics of the simple mutexes
+ * of the log manager and the utilities. Kept apart from spinlock.c so that
+ * the spinlocks do not depend on the DCB and the utilities.
+ */
+#include <stdlib.h>
+#include <spinlock.h>
+#include <skygw_utils.h>
+#include <dcb.h>
+
+#define	LOCKS_SHOWN	20	/**< Number of lock classes show locks lists */
+
+/**
+ * One lock class in the show locks output
+ */
+typedef struct {
+	const char	*name;
+	const char	*kind;
+	long		n_locked;
+	long		n_contended;
+	long		wait_time;
+	long		wait_max;
+	long		hold_time;
+	long		n_held;
+} LOCK_ROW;
+
+static int
+lock_row_cmp(const void *a, const void *b)
+{
+const LOCK_ROW	*ra = (const LOCK_ROW *)a, *rb = (const LOCK_ROW *)b;
+
+	if (ra->n_contended != rb->n_contended)
+		return ra->n_contended < rb->n_contended ? 1 : -1;
+	return ra->wait_time < rb->wait_time ? 1 : ra->wait_time > rb->wait_time ? -1 : 0;
+}
+
+/**
+ * Print the most contended lock classes, the named spinlocks and the
+ * mutexes of the log manager and the utilities. The acquisitions are
+ * estimated from the samples, the contended acquisitions are exact.
+ *
+ * @param dcb	The DCB to print to
+ */
+void
+dprintLocks(DCB *dcb)
+{
+LOCK_PROFILE		*profile;
+simple_mutex_stats_t	*sms;
+LOCK_ROW		*rows;
+int			n_rows = 0, i;
+
+	for (profile = spinlock_profiles(); profile; profile = profile->next)
+		n_rows++;
+	for (sms = simple_mutex_stats_first(); sms; sms = sms->sms_next)
+		n_rows++;
+	if (n_rows == 0)
+	{
+		dcb_printf(dcb, "No named locks have been used\n");
+		return;
+	}
+	if ((rows = calloc(n_rows, sizeof(LOCK_ROW))) == NULL)
+		return;
+
+	/*< Classes added since counting are left out */
+	i = 0;
+	for (profile = spinlock_profiles(); profile && i < n_rows; profile = profile->next, i++)
+	{
+		rows[i].name = profile->name;
+		rows[i].kind = "spinlock";
+		rows[i].n_locked = profile->n_sampled * SPINLOCK_SAMPLE;
+		rows[i].n_contended = profile->n_contended;
+		rows[i].wait_time = profile->wait_time;
+		rows[i].wait_max = profile->wait_max;
+		rows[i].hold_time = profile->hold_time;
+		rows[i].n_held = profile->n_sampled;
+	}
+	for (sms = simple_mutex_stats_first(); sms && i < n_rows; sms = sms->sms_next, i++)
+	{
+		rows[i].name = sms->sms_name;
+		rows[i].kind = "mutex";
+		rows[i].n_locked = sms->sms_n_locked;
+		rows[i].n_contended = sms->sms_n_contended;
+		rows[i].wait_time = sms->sms_wait_time;
+		rows[i].wait_max = sms->sms_wait_max;
+		rows[i].hold_time = sms->sms_hold_time;
+		rows[i].n_held = sms->sms_n_locked / SIMPLE_MUTEX_SAMPLE;
+	}
+	n_rows = i;
+	qsort(rows, n_rows, sizeof(LOCK_ROW), lock_row_cmp);
+
+	dcb_printf(dcb, "%-24s %-8s %12s %12s %10s %10s %10s\n",
+		"Lock", "Kind", "Acquired", "Contended",
+		"Avg wait", "Max wait", "Avg hold");
+	dcb_printf(dcb, "%-24s %-8s %12s %12s %10s %10s %10s\n",
+		"", "", "(estimate)", "", "(ns)", "(ns)", "(ns)");
+	for (i = 0; i < n_rows && i < LOCKS_SHOWN; i++)
+	{
+		dcb_printf(dcb, "%-24s %-8s %12ld %12ld %10ld %10ld %10ld\n",
+			rows[i].name,
+			rows[i].kind,
+			rows[i].n_locked,
+			rows[i].n_contended,
+			rows[i].n_contended ? rows[i].wait_time / rows[i].n_contended : 0,
+			rows[i].wait_max,
+			rows[i].n_held ? rows[i].hold_time / rows[i].n_held : 0);
+	}
+	free(rows);
+}
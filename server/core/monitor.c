@@ -39,7 +39,7 @@
 extern int lm_enabled_logfiles_bitmask;
 
 static MONITOR	*allMonitors = NULL;
-static SPINLOCK	monLock = SPINLOCK_INIT;
+static SPINLOCK	monLock = SPINLOCK_INIT_NAMED("monLock");
 
 /**
  * Allocate a new monitor, load the associated module for the monitor
@@ -17,9 +17,12 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <errno.h>
 #include <poll.h>
 #include <dcb.h>
@@ -27,6 +30,12 @@
 #include <gwbitmask.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
+#include <config.h>
+#include <gw.h>
+#include <statistics.h>
+#include <poll_engine.h>
+#include <timer.h>
+#include <slab.h>
 
 extern int lm_enabled_logfiles_bitmask;
 
@@ -44,48 +53,254 @@ extern int lm_enabled_logfiles_bitmask;
  * @endverbatim
  */
 
-static	int		epoll_fd = -1;	  /*< The epoll file descriptor */
+static	POLL_ENGINE	*engine = &poll_engine_epoll; /*< The I/O event engine */
+static	POLL_SET	**poll_sets = NULL; /*< The event sets of the engine */
+static	int		n_poll_sets = 0;  /*< Number of event sets */
+static	__thread int	current_thread_id = 0; /*< Polling thread of the caller */
+static	__thread bool	polling_thread = false; /*< The caller is a polling thread */
 static	int		do_shutdown = 0;	  /*< Flag the shutdown of the poll subsystem */
 static	GWBITMASK	poll_mask;
 static  simple_mutex_t  epoll_wait_mutex; /*< serializes calls to epoll_wait */
+static	long		spin_time = 0;	  /*< usecs to spin before blocking */
+static	int		poll_oneshot = 0; /*< DCBs are added with EPOLLONESHOT */
+static	__thread DCB	*reading_dcb = NULL; /*< DCB whose read handler is running */
+
+static	__thread THREAD_STATS *thread_stats = NULL; /*< Statistics of the polling thread */
+
+/**
+ * A message posted to a polling thread
+ */
+typedef struct mail {
+	struct mail	*next;		/*< The message posted before this one */
+	POLL_MAIL_FUNC	func;		/*< Called by the receiving thread */
+	void		*arg1;
+	void		*arg2;
+} MAIL;
+
+/**
+ * The mailbox of an event set. Any thread pushes messages onto the head
+ * with compare and swap, the receiving thread takes the whole list at once.
+ */
+typedef struct {
+	MAIL		*head;		/*< Posted messages, the latest first */
+	int		fd;		/*< eventfd signalled when head was empty */
+} STATS_ALIGNED MAILBOX;
+
+static	MAILBOX		*mailboxes = NULL; /*< One mailbox per event set */
+
+/**
+ * The wake up eventfd of an event set. In the sets of the individual
+ * threads the eventfd is drained when it is received. The threads of a
+ * shared set take one wake up each, the eventfd is a semaphore that is
+ * signalled once for every thread to wake.
+ */
+typedef struct {
+	int		fd;		/*< eventfd signalled by poll_wake */
+	long		time;		/*< Time of the pending wake in usecs */
+} STATS_ALIGNED WAKE;
+
+static	WAKE		*wakes = NULL;	  /*< One wake up eventfd per event set */
+static	SLAB_CACHE	*mail_cache = NULL;
+
+/**
+ * The load of a polling thread, updated by any thread
+ */
+typedef struct {
+	int		n_dcbs;		/*< Request handler DCBs owned by the thread */
+	int		n_accepting;	/*< Clients handed to the thread, not yet added */
+} STATS_ALIGNED THREAD_LOAD;
+
+#define	POLL_ACCEPT_LOCAL	0	/*< Clients stay on the accepting thread */
+#define	POLL_ACCEPT_ROUND_ROBIN	1	/*< Clients go to the threads in turn */
+#define	POLL_ACCEPT_LEAST_LOADED 2	/*< Clients go to the thread with fewest DCBs */
+
+static	THREAD_LOAD	*thread_load = NULL;
+static	int		accept_balance = POLL_ACCEPT_LOCAL;
+static	int		accept_next = 0;  /*< Next thread for round robin */
 
 /**
- * The polling statistics
+ * The statistics of the calling thread, threads other than the polling
+ * threads share the statistics of thread 0.
  */
-static struct {
-	int	n_read;		/*< Number of read events   */
-	int	n_write;	/*< Number of write events  */
-	int	n_error;	/*< Number of error events  */
-	int	n_hup;		/*< Number of hangup events */
-	int	n_accept;	/*< Number of accept events */
-	int	n_polls;	/*< Number of poll cycles   */
-} pollStats;
+#define	POLL_STATS	(thread_stats != NULL ? thread_stats : stats_thread())
+
+static	int	poll_spin_then_block(POLL_SET *, struct epoll_event *);
+static	void	poll_wake_received(WAKE *);
+static	void	poll_dispatch_events(DCB *, __uint32_t);
+static	void	poll_process_events(DCB *, __uint32_t);
+static	void	poll_modify_dcb(DCB *, char *);
+static	void	poll_mail_received(MAILBOX *);
 
 
 /**
  * Initialise the polling system we are using for the gateway.
  *
- * In this case we are using the Linux epoll mechanism
+ * The events are collected by the engine named by the poll_engine option,
+ * epoll by default. With epoll a single set is shared by all the polling
+ * threads unless the epoll_per_thread option is set, in which case one set
+ * is created for each polling thread and a descriptor is only ever reported
+ * to the thread that owns it. Other engines always use one set per thread.
+ * If the io_uring engine is not supported by the kernel epoll is used.
  */
 void
 poll_init()
 {
-	if (epoll_fd != -1)
+int	i;
+
+	if (poll_sets != NULL)
 		return;
-	if ((epoll_fd = epoll_create(MAX_EVENTS)) == -1)
+	stats_init(config_threadcount());
+	timer_wheels_init();
+	if ((engine = poll_engine_find(config_poll_engine())) == NULL)
+	{
+		LOGIF(LE, (skygw_log_write_flush(
+			LOGFILE_ERROR,
+			"Error : Unknown poll_engine %s, using epoll.",
+			config_poll_engine())));
+		engine = &poll_engine_epoll;
+	}
+retry:
+	/*<
+	 * The io_uring engine always has one set per thread, its completions
+	 * are not shared fairly between the threads waiting on a set.
+	 */
+	if ((config_epoll_per_thread() || engine != &poll_engine_epoll) &&
+	    config_threadcount() > 1)
+		n_poll_sets = config_threadcount();
+	else
+		n_poll_sets = 1;
+	if ((poll_sets = (POLL_SET **)calloc(n_poll_sets, sizeof(POLL_SET *))) == NULL)
+	{
+		perror("calloc");
+		exit(-1);
+	}
+	for (i = 0; i < n_poll_sets; i++)
+	{
+		if ((poll_sets[i] = engine->create(MAX_EVENTS)) == NULL)
+		{
+			if (engine != &poll_engine_epoll)
+			{
+				LOGIF(LE, (skygw_log_write_flush(
+					LOGFILE_ERROR,
+					"Error : Failed to create %s event set due "
+					"%d, %s. Using epoll.",
+					engine->name,
+					errno,
+					strerror(errno))));
+				while (--i >= 0)
+					engine->destroy(poll_sets[i]);
+				free(poll_sets);
+				engine = &poll_engine_epoll;
+				goto retry;
+			}
+			perror("poll_init");
+			exit(-1);
+		}
+	}
+	if ((wakes = (WAKE *)stats_alloc(sizeof(WAKE))) == NULL)
+	{
+		perror("poll_init");
+		exit(-1);
+	}
+	for (i = 0; i < n_poll_sets; i++)
+	{
+		if ((wakes[i].fd = eventfd(0, n_poll_sets == 1 ?
+				EFD_NONBLOCK | EFD_SEMAPHORE : EFD_NONBLOCK)) == -1 ||
+		    engine->add(poll_sets[i], wakes[i].fd, EPOLLIN, &wakes[i]) == -1)
+		{
+			perror("poll_init");
+			exit(-1);
+		}
+	}
+	/*<
+	 * The mailbox of a set is edge triggered, a post only signals it
+	 * when the mailbox was empty.
+	 */
+	if ((mailboxes = (MAILBOX *)stats_alloc(sizeof(MAILBOX))) == NULL)
+	{
+		perror("poll_init");
+		exit(-1);
+	}
+	mail_cache = slab_cache_alloc("Mail", sizeof(MAIL));
+	if ((thread_load = (THREAD_LOAD *)stats_alloc(sizeof(THREAD_LOAD))) == NULL)
 	{
-		perror("epoll_create");
+		perror("poll_init");
 		exit(-1);
 	}
-	memset(&pollStats, 0, sizeof(pollStats));
+	if (config_accept_balance() == NULL ||
+	    strcasecmp(config_accept_balance(), "local") == 0)
+		accept_balance = POLL_ACCEPT_LOCAL;
+	else if (strcasecmp(config_accept_balance(), "round_robin") == 0)
+		accept_balance = POLL_ACCEPT_ROUND_ROBIN;
+	else if (strcasecmp(config_accept_balance(), "least_loaded") == 0)
+		accept_balance = POLL_ACCEPT_LEAST_LOADED;
+	else
+	{
+		LOGIF(LE, (skygw_log_write_flush(
+			LOGFILE_ERROR,
+			"Error : Unknown accept_balance %s, clients stay on "
+			"the accepting thread.",
+			config_accept_balance())));
+	}
+	for (i = 0; i < n_poll_sets; i++)
+	{
+		if ((mailboxes[i].fd = eventfd(0, EFD_NONBLOCK)) == -1 ||
+		    engine->add(poll_sets[i],
+				mailboxes[i].fd,
+				EPOLLIN | EPOLLET,
+				&mailboxes[i]) == -1)
+		{
+			perror("poll_init");
+			exit(-1);
+		}
+	}
+	spin_time = config_poll_spin_time();
+	/*<
+	 * When several threads share an epoll set only one of them at a time
+	 * should receive the events of a descriptor.
+	 */
+	poll_oneshot = (n_poll_sets == 1 && config_threadcount() > 1);
 	bitmask_init(&poll_mask);
         simple_mutex_init(&epoll_wait_mutex, "epoll_wait_mutex");        
 }
 
+/**
+ * Return the event set a polling thread waits on
+ *
+ * @param thread_id	The polling thread
+ * @return		The event set of the thread
+ */
+static POLL_SET *
+poll_set(int thread_id)
+{
+	if (thread_id < 0 || thread_id >= n_poll_sets)
+		return poll_sets[0];
+	return poll_sets[thread_id];
+}
+
+/**
+ * Return the index of the load entry of the thread that owns a DCB
+ *
+ * @param dcb	The DCB
+ * @return	The index into thread_load
+ */
+static int
+poll_load_index(DCB *dcb)
+{
+	if (dcb->thread_id < 0 || dcb->thread_id >= stats_n_threads())
+		return 0;
+	return dcb->thread_id;
+}
+
 /**
  * Add a DCB to the set of descriptors within the polling
  * environment.
  *
+ * Request handler DCBs are owned by the polling thread that adds them, so that
+ * the client and backend DCBs of a session are all served by the thread which
+ * accepted the client. Listener DCBs keep the owner they were given when they
+ * were created.
+ *
  * @param dcb	The descriptor to add to the poll
  * @return	-1 on error or 0 on success
  */
@@ -95,18 +310,20 @@ poll_add_dcb(DCB *dcb)
         int         rc = -1;
         dcb_state_t old_state = DCB_STATE_UNDEFINED;
         dcb_state_t new_state;
-        struct	epoll_event	ev;
+        __uint32_t  events;
 
         CHK_DCB(dcb);
         
-	ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
-	ev.data.ptr = dcb;
+	events = EPOLLIN | EPOLLOUT | EPOLLET;
+	if (poll_oneshot)
+		events |= EPOLLONESHOT;
 
         /*<
          * Choose new state according to the role of dcb.
          */
         if (dcb->dcb_role == DCB_ROLE_REQUEST_HANDLER) {
                 new_state = DCB_STATE_POLLING;
+                dcb->thread_id = current_thread_id;
         } else {
                 ss_dassert(dcb->dcb_role == DCB_ROLE_SERVICE_LISTENER);
                 new_state = DCB_STATE_LISTENING;
@@ -116,7 +333,10 @@ poll_add_dcb(DCB *dcb)
          * is not polling anymore.
          */
         if (dcb_set_state(dcb, new_state, &old_state)) {
-                rc = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, dcb->fd, &ev);
+                rc = engine->add(poll_set(dcb->thread_id),
+                                 dcb->fd,
+                                 events,
+                                 dcb);
 
                 if (rc != 0) {
                         int eno = errno;
@@ -124,20 +344,24 @@ poll_add_dcb(DCB *dcb)
                         LOGIF(LE, (skygw_log_write_flush(
                                 LOGFILE_ERROR,
                                 "Error : Adding dcb %p in state %s "
-                                "to poll set failed. epoll_ctl failed due "
+                                "to poll set failed. %s failed due "
                                 "%d, %s.",
                                 dcb,
                                 STRDCBSTATE(dcb->state),
+                                engine->name,
                                 eno,
                                 strerror(eno))));
                 } else {
+                        if (dcb->dcb_role == DCB_ROLE_REQUEST_HANDLER)
+                                atomic_add(&thread_load[poll_load_index(dcb)].n_dcbs, 1);
                         LOGIF(LD, (skygw_log_write(
                                 LOGFILE_DEBUG,
                                 "%lu [poll_add_dcb] Added dcb %p in state %s to "
-                                "poll set.",
+                                "poll set of thread %d.",
                                 pthread_self(),
                                 dcb,
-                                STRDCBSTATE(dcb->state))));
+                                STRDCBSTATE(dcb->state),
+                                dcb->thread_id)));
                 }
                 ss_dassert(rc == 0); /*< trap in debug */
         } else {
@@ -164,7 +388,6 @@ poll_add_dcb(DCB *dcb)
 int
 poll_remove_dcb(DCB *dcb)
 {
-        struct	epoll_event ev;
         int                 rc = -1;
         dcb_state_t         old_state = DCB_STATE_UNDEFINED;
         dcb_state_t         new_state = DCB_STATE_NOPOLLING;
@@ -185,14 +408,19 @@ poll_remove_dcb(DCB *dcb)
          * Set state to NOPOLLING and remove dcb from poll set.
          */
         if (dcb_set_state(dcb, new_state, &old_state)) {
-                rc = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, dcb->fd, &ev);
+                rc = engine->remove(poll_set(dcb->thread_id), dcb->fd);
+                if (dcb->dcb_role == DCB_ROLE_REQUEST_HANDLER)
+                        atomic_add(&thread_load[poll_load_index(dcb)].n_dcbs, -1);
 
                 if (rc != 0) {
                         int eno = errno;
                         errno = 0;
                         LOGIF(LE, (skygw_log_write_flush(
                                 LOGFILE_ERROR,
-                                "Error : epoll_ctl failed due %d, %s.",
+                                "Error : Removing dcb %p from poll set "
+                                "failed. %s failed due %d, %s.",
+                                dcb,
+                                engine->name,
                                 eno,
                                 strerror(eno))));
                 }
@@ -206,9 +434,6 @@ poll_remove_dcb(DCB *dcb)
                 rc = 0;
                 goto return_rc;
         }
-        
-        /*< Set bit for each maxscale thread */
-        bitmask_copy(&dcb->memdata.bitmask, poll_bitmask()); 
         rc = 0;
 return_rc:
         return rc;
@@ -238,6 +463,9 @@ return_rc:
  * with timeout. The call with the timeout differs in that the Linux scheduler may
  * deschedule a process if a timeout is included, but will not do this if a 0 timeout
  * value is given. this improves performance when the gateway is under heavy load.
+ * If the poll_spin_time option is set the no-wait poll is repeated for that many
+ * microseconds before the thread blocks. Threads that are blocked are woken up
+ * through the wake up eventfd of their set when a new zombie epoch starts.
  *
  * @param arg	The thread ID passed as a void * to satisfy the threading package
  */
@@ -247,9 +475,14 @@ poll_waitevents(void *arg)
         struct epoll_event events[MAX_EVENTS];
         int		   i, nfds;
         int		   thread_id = (int)arg;
+        POLL_SET	   *set = poll_set(thread_id);
         bool               no_op = false;
-        static bool        process_zombies_only = false; /*< flag for all threads */
-        DCB                *zombies = NULL;
+        long               loop_start;
+
+	current_thread_id = thread_id;
+	polling_thread = true;
+	thread_stats = stats_thread();
+	dcb_defer_writes(config_deferred_flush());
 
 	/* Add this thread to the bitmask of running polling threads */
 	bitmask_set(&poll_mask, thread_id);
@@ -257,7 +490,7 @@ poll_waitevents(void *arg)
 	while (1)
 	{
 #if BLOCKINGPOLL
-		nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+		nfds = engine->wait(set, events, MAX_EVENTS, -1);
 #else /* BLOCKINGPOLL */
                 if (!no_op) {
                         LOGIF(LD, (skygw_log_write(
@@ -268,11 +501,8 @@ poll_waitevents(void *arg)
                                            thread_id)));                        
                         no_op = TRUE;
                 }
-#if 0
-                simple_mutex_lock(&epoll_wait_mutex, TRUE);
-#endif
                 
-		if ((nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, 0)) == -1)
+		if ((nfds = engine->wait(set, events, MAX_EVENTS, 0)) == -1)
 		{
                         int eno = errno;
                         errno = 0;
@@ -287,31 +517,13 @@ poll_waitevents(void *arg)
 		}
 		else if (nfds == 0)
 		{
-                        if (process_zombies_only) {
-#if 0
-                                simple_mutex_unlock(&epoll_wait_mutex);
-#endif
-                                goto process_zombies;
-                        } else {
-                                nfds = epoll_wait(epoll_fd,
-                                                  events,
-                                                  MAX_EVENTS,
-                                                  EPOLL_TIMEOUT);
-                                /*<
-                                 * When there are zombies to be cleaned up but
-                                 * no client requests, allow all threads to call
-                                 * dcb_process_zombies without having to wait
-                                 * for the timeout.
-                                 */
-                                if (nfds == 0 && dcb_get_zombies() != NULL)
-                                {
-                                        process_zombies_only = true;
-                                }
-                        }
+                        /*<
+                         * Zombies and other pending work signal the
+                         * wake up eventfd, so there is no need to return early
+                         * from the blocking wait to look for them.
+                         */
+                        nfds = poll_spin_then_block(set, events);
 		}
-#if 0
-                simple_mutex_unlock(&epoll_wait_mutex);
-#endif
 #endif /* BLOCKINGPOLL */
 		if (nfds > 0)
 		{
@@ -320,13 +532,28 @@ poll_waitevents(void *arg)
                                 "%lu [poll_waitevents] epoll_wait found %d fds",
                                 pthread_self(),
                                 nfds)));
-			atomic_add(&pollStats.n_polls, 1);
+			loop_start = stats_usecs();
+			thread_stats->n_polls++;
+			hist_add(&thread_stats->events, nfds);
 
 			for (i = 0; i < nfds; i++)
 			{
 				DCB 		*dcb = (DCB *)events[i].data.ptr;
 				__uint32_t	ev = events[i].events;
 
+                                if ((void *)dcb >= (void *)wakes &&
+                                    (void *)dcb < (void *)(wakes + n_poll_sets))
+                                {
+                                        /*< The wake up eventfd, not a DCB */
+                                        poll_wake_received((WAKE *)dcb);
+                                        continue;
+                                }
+                                if ((void *)dcb >= (void *)mailboxes &&
+                                    (void *)dcb < (void *)(mailboxes + n_poll_sets))
+                                {
+                                        poll_mail_received((MAILBOX *)dcb);
+                                        continue;
+                                }
                                 CHK_DCB(dcb);
 
 #if defined(SS_DEBUG)
@@ -348,141 +575,15 @@ poll_waitevents(void *arg)
                                 ss_dassert(dcb->state != DCB_STATE_FREED);
                                 ss_debug(spinlock_release(&dcb->dcb_initlock);)
 
-                                LOGIF(LT, (skygw_log_write(
-                                        LOGFILE_TRACE,
-                                        "%lu [poll_waitevents] event %d dcb %p "
-                                        "role %s",
-                                        pthread_self(),
-                                        ev,
-                                        dcb,
-                                        STRDCBROLE(dcb->dcb_role))));
-
-				if (ev & EPOLLOUT)
-				{
-                                        int eno = 0;
-                                        eno = gw_getsockerrno(dcb->fd);
-
-                                        if (eno == 0)  {
-                                                simple_mutex_lock(
-                                                        &dcb->dcb_write_lock,
-                                                        true);
-                                                ss_info_dassert(
-                                                        !dcb->dcb_write_active,
-                                                        "Write already active");
-                                                dcb->dcb_write_active = TRUE;
-                                                atomic_add(
-                                                &pollStats.n_write,
-                                                        1);
-                                                dcb->func.write_ready(dcb);
-                                                dcb->dcb_write_active = FALSE;
-                                                simple_mutex_unlock(
-                                                        &dcb->dcb_write_lock);
-                                        } else {
-                                                LOGIF(LD, (skygw_log_write(
-                                                        LOGFILE_DEBUG,
-                                                        "%lu [poll_waitevents] "
-                                                        "EPOLLOUT due %d, %s. "
-                                                        "dcb %p, fd %i",
-                                                        pthread_self(),
-                                                        eno,
-                                                        strerror(eno),
-                                                        dcb,
-                                                        dcb->fd)));
-                                        }
-                                }
-                                if (ev & EPOLLIN)
-                                {
-                                        simple_mutex_lock(&dcb->dcb_read_lock,
-                                                          true);
-                                        ss_info_dassert(!dcb->dcb_read_active,
-                                                        "Read already active");
-                                        dcb->dcb_read_active = TRUE;
-                                        
-					if (dcb->state == DCB_STATE_LISTENING)
-					{
-                                                LOGIF(LD, (skygw_log_write(
-                                                        LOGFILE_DEBUG,
-                                                        "%lu [poll_waitevents] "
-                                                        "Accept in fd %d",
-                                                        pthread_self(),
-                                                        dcb->fd)));
-                                                atomic_add(
-                                                        &pollStats.n_accept, 1);
-                                                dcb->func.accept(dcb);
-                                        }
-					else
-					{
-                                                LOGIF(LD, (skygw_log_write(
-                                                        LOGFILE_DEBUG,
-                                                        "%lu [poll_waitevents] "
-                                                        "Read in dcb %p fd %d",
-                                                        pthread_self(),
-                                                        dcb,
-                                                        dcb->fd)));
-						atomic_add(&pollStats.n_read, 1);
-						dcb->func.read(dcb);
-					}
-                                        dcb->dcb_read_active = FALSE;
-                                        simple_mutex_unlock(
-                                                &dcb->dcb_read_lock);
-				}
-				if (ev & EPOLLERR)
-				{
-                                        int eno = gw_getsockerrno(dcb->fd);
-#if defined(SS_DEBUG)
-                                        if (eno == 0) {
-                                                eno = dcb_fake_write_errno[dcb->fd];
-                                                LOGIF(LD, (skygw_log_write(
-                                                        LOGFILE_DEBUG,
-                                                        "%lu [poll_waitevents] "
-                                                        "Added fake errno %d. "
-                                                        "%s",
-                                                        pthread_self(),
-                                                        eno,
-                                                        strerror(eno))));
-                                        }
-                                        dcb_fake_write_errno[dcb->fd] = 0;
-#endif
-                                        if (eno != 0) {
-                                                LOGIF(LD, (skygw_log_write(
-                                                        LOGFILE_DEBUG,
-                                                        "%lu [poll_waitevents] "
-                                                        "EPOLLERR due %d, %s.",
-                                                        pthread_self(),
-                                                        eno,
-                                                        strerror(eno))));
-                                        }
-                                        atomic_add(&pollStats.n_error, 1);
-                                        dcb->func.error(dcb);
-                                }
-
-				if (ev & EPOLLHUP)
-				{
-                                        int eno = 0;
-                                        eno = gw_getsockerrno(dcb->fd);
-                                        
-                                        LOGIF(LD, (skygw_log_write(
-                                                LOGFILE_DEBUG,
-                                                "%lu [poll_waitevents] "
-                                                "EPOLLHUP on dcb %p, fd %d. "
-                                                "Errno %d, %s.",
-                                                pthread_self(),
-                                                dcb,
-                                                dcb->fd,
-                                                eno,
-                                                strerror(eno))));
-                                        atomic_add(&pollStats.n_hup, 1);
-					dcb->func.hangup(dcb);
-				}
+                                poll_dispatch_events(dcb, ev);
 			} /*< for */
                         no_op = FALSE;
+			hist_add(&thread_stats->loop_time,
+				 stats_usecs() - loop_start);
 		}
-        process_zombies:
-		zombies = dcb_process_zombies(thread_id);
-                
-                if (zombies == NULL) {
-                        process_zombies_only = false;
-                }
+		timer_run(thread_id);
+		dcb_flush_deferred();
+		dcb_process_zombies(thread_id);
 
 		if (do_shutdown)
 		{
@@ -491,11 +592,297 @@ poll_waitevents(void *arg)
                          * polling threads.
                          */
 			bitmask_clear(&poll_mask, thread_id);
+			dcb_process_zombies_done();
 			return;
 		}
 	} /*< while(1) */
 }
 
+/**
+ * Dispatch the events reported for a DCB.
+ *
+ * The events are ORed into the pending events word of the DCB together with
+ * DCB_EVQ_ACTIVE. If the bit was already set another thread is processing
+ * events for the DCB and will pick them up, so this thread returns at once
+ * to serve other descriptors; no polling thread ever waits for a DCB.
+ * Otherwise this thread owns the DCB: it takes the pending events by
+ * exchanging the word with DCB_EVQ_ACTIVE and processes them, until it can
+ * swap DCB_EVQ_ACTIVE back to zero. In the shared epoll mode the descriptor
+ * is added with EPOLLONESHOT and is re-armed once all pending events have
+ * been processed.
+ *
+ * @param dcb	The DCB the events are for
+ * @param ev	The epoll events
+ */
+static void
+poll_dispatch_events(DCB *dcb, __uint32_t ev)
+{
+        if (__sync_fetch_and_or(&dcb->evq_events, ev | DCB_EVQ_ACTIVE) &
+            DCB_EVQ_ACTIVE)
+        {
+                POLL_STATS->n_coalesced++;
+                return;
+        }
+
+        do
+        {
+                ev = __sync_lock_test_and_set(&dcb->evq_events, DCB_EVQ_ACTIVE);
+                ev &= ~DCB_EVQ_ACTIVE;
+                if (ev != 0)
+                {
+                        poll_process_events(dcb, ev);
+                }
+        } while (!__sync_bool_compare_and_swap(&dcb->evq_events,
+                                                DCB_EVQ_ACTIVE,
+                                                0));
+
+        if (poll_oneshot)
+        {
+                poll_modify_dcb(dcb, "poll_dispatch_events");
+        }
+}
+
+/**
+ * Set the events reported for a DCB that is in the poll set. EPOLLIN is
+ * left out while reading from the DCB is stopped. The threads that stop and
+ * start reading and re-arm the DCB may modify it at the same time, so the
+ * events are set again if read_stopped changed while they were set; the
+ * last modification then always matches read_stopped.
+ *
+ * @param dcb	The DCB to modify
+ * @param func	Name of the calling function for the debug log
+ */
+static void
+poll_modify_dcb(DCB *dcb, char *func)
+{
+        __uint32_t events;
+        bool       stopped;
+
+        do
+        {
+                if (dcb->state != DCB_STATE_POLLING &&
+                    dcb->state != DCB_STATE_LISTENING)
+                {
+                        return;
+                }
+                stopped = *(volatile bool *)&dcb->read_stopped;
+                __sync_synchronize();
+                events = EPOLLOUT | EPOLLET;
+                if (!stopped)
+                        events |= EPOLLIN;
+                if (poll_oneshot)
+                        events |= EPOLLONESHOT;
+
+                if (engine->modify(poll_set(dcb->thread_id),
+                                   dcb->fd,
+                                   events,
+                                   dcb) == -1)
+                {
+                        int eno = errno;
+                        errno = 0;
+                        LOGIF(LD, (skygw_log_write(
+                                LOGFILE_DEBUG,
+                                "%lu [%s] Modifying events of dcb %p fd %d "
+                                "failed due %d, %s.",
+                                pthread_self(),
+                                func,
+                                dcb,
+                                dcb->fd,
+                                eno,
+                                strerror(eno))));
+                        return;
+                }
+                __sync_synchronize();
+        } while (*(volatile bool *)&dcb->read_stopped != stopped);
+}
+
+/**
+ * Stop reporting EPOLLIN for a DCB. Data that arrives for the DCB stays in
+ * the socket buffer until reading is started again, which holds back the
+ * sender of the data.
+ *
+ * @param dcb	The DCB to stop reading from
+ */
+void
+poll_stop_read(DCB *dcb)
+{
+        if (__sync_bool_compare_and_swap(&dcb->read_stopped, false, true))
+        {
+                POLL_STATS->n_read_stopped++;
+                poll_modify_dcb(dcb, "poll_stop_read");
+        }
+}
+
+/**
+ * Report EPOLLIN for a DCB again after poll_stop_read. The events are
+ * modified in edge triggered mode, so data that arrived while reading was
+ * stopped is reported at once.
+ *
+ * @param dcb	The DCB to start reading from
+ */
+void
+poll_start_read(DCB *dcb)
+{
+        if (__sync_bool_compare_and_swap(&dcb->read_stopped, true, false))
+        {
+                poll_modify_dcb(dcb, "poll_start_read");
+        }
+}
+
+/**
+ * Deliver events to a DCB that were not reported by the poll set, such as
+ * the error raised when a timeout of the DCB expires. The events are
+ * processed like reported events and never concurrently with other events
+ * of the same DCB.
+ *
+ * @param dcb	The DCB
+ * @param ev	The events to deliver
+ */
+void
+poll_fake_event(DCB *dcb, __uint32_t ev)
+{
+	poll_dispatch_events(dcb, ev);
+}
+
+/**
+ * Return the DCB whose read entry point the calling thread is running.
+ * Data written to other DCBs at that time comes from this DCB.
+ *
+ * @return The DCB being read or NULL
+ */
+DCB *
+poll_reading_dcb()
+{
+        return reading_dcb;
+}
+
+/**
+ * Call the protocol entry points of a DCB for a set of epoll events.
+ * Only one thread at a time processes the events of a DCB.
+ *
+ * @param dcb	The DCB the events are for
+ * @param ev	The epoll events
+ */
+static void
+poll_process_events(DCB *dcb, __uint32_t ev)
+{
+        LOGIF(LT, (skygw_log_write(
+                LOGFILE_TRACE,
+                "%lu [poll_waitevents] event %d dcb %p "
+                "role %s",
+                pthread_self(),
+                ev,
+                dcb,
+                STRDCBROLE(dcb->dcb_role))));
+
+        if (ev & EPOLLOUT)
+        {
+                int eno = 0;
+                eno = gw_getsockerrno(dcb->fd);
+
+                if (eno == 0)  {
+                        POLL_STATS->n_write++;
+                        dcb->func.write_ready(dcb);
+                        if (dcb->spliced)
+                                dcb_splice_write_ready(dcb);
+                } else {
+                        LOGIF(LD, (skygw_log_write(
+                                LOGFILE_DEBUG,
+                                "%lu [poll_waitevents] "
+                                "EPOLLOUT due %d, %s. "
+                                "dcb %p, fd %i",
+                                pthread_self(),
+                                eno,
+                                strerror(eno),
+                                dcb,
+                                dcb->fd)));
+                }
+        }
+        if (ev & EPOLLIN)
+        {
+                if (dcb->state == DCB_STATE_LISTENING)
+                {
+                        LOGIF(LD, (skygw_log_write(
+                                LOGFILE_DEBUG,
+                                "%lu [poll_waitevents] "
+                                "Accept in fd %d",
+                                pthread_self(),
+                                dcb->fd)));
+                        POLL_STATS->n_accept++;
+                        dcb->func.accept(dcb);
+                }
+                else
+                {
+                        LOGIF(LD, (skygw_log_write(
+                                LOGFILE_DEBUG,
+                                "%lu [poll_waitevents] "
+                                "Read in dcb %p fd %d",
+                                pthread_self(),
+                                dcb,
+                                dcb->fd)));
+                        POLL_STATS->n_read++;
+                        if (dcb->spliced)
+                        {
+                                dcb_splice(dcb);
+                        }
+                        else
+                        {
+                                reading_dcb = dcb;
+                                dcb->func.read(dcb);
+                                reading_dcb = NULL;
+                        }
+                }
+        }
+        if (ev & EPOLLERR)
+        {
+                int eno = gw_getsockerrno(dcb->fd);
+#if defined(SS_DEBUG)
+                if (eno == 0) {
+                        eno = dcb_fake_write_errno[dcb->fd];
+                        LOGIF(LD, (skygw_log_write(
+                                LOGFILE_DEBUG,
+                                "%lu [poll_waitevents] "
+                                "Added fake errno %d. "
+                                "%s",
+                                pthread_self(),
+                                eno,
+                                strerror(eno))));
+                }
+                dcb_fake_write_errno[dcb->fd] = 0;
+#endif
+                if (eno != 0) {
+                        LOGIF(LD, (skygw_log_write(
+                                LOGFILE_DEBUG,
+                                "%lu [poll_waitevents] "
+                                "EPOLLERR due %d, %s.",
+                                pthread_self(),
+                                eno,
+                                strerror(eno))));
+                }
+                POLL_STATS->n_error++;
+                dcb->func.error(dcb);
+        }
+
+        if (ev & EPOLLHUP)
+        {
+                int eno = 0;
+                eno = gw_getsockerrno(dcb->fd);
+                
+                LOGIF(LD, (skygw_log_write(
+                        LOGFILE_DEBUG,
+                        "%lu [poll_waitevents] "
+                        "EPOLLHUP on dcb %p, fd %d. "
+                        "Errno %d, %s.",
+                        pthread_self(),
+                        dcb,
+                        dcb->fd,
+                        eno,
+                        strerror(eno))));
+                POLL_STATS->n_hup++;
+                dcb->func.hangup(dcb);
+        }
+}
+
 /**
  * Shutdown the polling loop
  */
@@ -503,6 +890,202 @@ void
 poll_shutdown()
 {
 	do_shutdown = 1;
+	poll_wake();
+}
+
+/**
+ * Wait for events once a non-blocking wait has found none.
+ *
+ * The thread keeps polling without blocking for poll_spin_time
+ * microseconds, so that a busy gateway does not pay for a sleep and a
+ * wake up between every batch of events. After that the thread blocks
+ * until an event arrives, the set is woken up, the next timer of the
+ * thread is due or EPOLL_TIMEOUT expires.
+ *
+ * @param set		The event set of the thread
+ * @param events	The event array to fill
+ * @return		The return value of the final wait call
+ */
+static int
+poll_spin_then_block(POLL_SET *set, struct epoll_event *events)
+{
+int	nfds;
+int	n_empty = 1;
+long	spin_until;
+
+	if (spin_time > 0)
+	{
+		spin_until = stats_usecs() + spin_time;
+		do {
+			if ((nfds = engine->wait(set, events, MAX_EVENTS, 0)) != 0)
+			{
+				POLL_STATS->n_empty += n_empty;
+				return nfds;
+			}
+			n_empty++;
+		} while (!do_shutdown && stats_usecs() < spin_until);
+	}
+	POLL_STATS->n_empty += n_empty;
+	POLL_STATS->n_blocked++;
+	return engine->wait(set,
+			    events,
+			    MAX_EVENTS,
+			    timer_next_timeout(current_thread_id, EPOLL_TIMEOUT));
+}
+
+/**
+ * Wake up the other polling threads, used when there is work that every
+ * thread has to do, such as passing a new zombie epoch. Each thread is
+ * signalled once, it is not woken again until the next call, so a thread
+ * that is slow to pass the epoch does not keep the others spinning. The
+ * calling polling thread does the work at the end of its loop and is not
+ * signalled. The threads of a shared set take one wake up each, a thread
+ * that was busy may take the wake up of a blocked one, which then does
+ * the work at the latest after EPOLL_TIMEOUT.
+ */
+void
+poll_wake()
+{
+uint64_t	count;
+int		i;
+
+	if (wakes == NULL)
+		return;
+	for (i = 0; i < n_poll_sets; i++)
+	{
+		if (n_poll_sets == 1)
+			count = config_threadcount() - (thread_stats != NULL);
+		else if (thread_stats != NULL && i == current_thread_id)
+			continue;
+		else
+			count = 1;
+		if (count == 0)
+			continue;
+		__sync_bool_compare_and_swap(&wakes[i].time, 0, stats_usecs());
+		if (write(wakes[i].fd, &count, sizeof(count)) == -1 &&
+		    errno != EAGAIN)
+		{
+			LOGIF(LE, (skygw_log_write_flush(
+				LOGFILE_ERROR,
+				"Error : Failed to wake polling thread %d due "
+				"%d, %s.",
+				i,
+				errno,
+				strerror(errno))));
+		}
+	}
+}
+
+/**
+ * Post a message to a polling thread. The function is called with the two
+ * arguments by the polling thread when it receives the event of its
+ * mailbox, messages from one thread are delivered in the order they were
+ * posted. When the threads share one event set the message is
+ * delivered by whichever thread receives the mailbox event.
+ *
+ * @param thread_id	The polling thread to post to
+ * @param func		The function to call
+ * @param arg1		The first argument of the function
+ * @param arg2		The second argument of the function
+ * @return		0 if the message was posted, -1 on error
+ */
+int
+poll_post(int thread_id, POLL_MAIL_FUNC func, void *arg1, void *arg2)
+{
+MAILBOX		*box;
+MAIL		*mail, *head;
+uint64_t	one = 1;
+
+	if (mailboxes == NULL || (mail = (MAIL *)slab_alloc(mail_cache)) == NULL)
+		return -1;
+	mail->func = func;
+	mail->arg1 = arg1;
+	mail->arg2 = arg2;
+	if (thread_id < 0 || thread_id >= n_poll_sets)
+		thread_id = 0;
+	box = &mailboxes[thread_id];
+	do {
+		head = box->head;
+		mail->next = head;
+	} while (!__sync_bool_compare_and_swap(&box->head, head, mail));
+
+	POLL_STATS->n_posted++;
+	if (head == NULL)
+	{
+		POLL_STATS->n_mail_wakes++;
+		if (write(box->fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		{
+			LOGIF(LE, (skygw_log_write_flush(
+				LOGFILE_ERROR,
+				"Error : Failed to signal the mailbox of "
+				"thread %d due %d, %s.",
+				thread_id,
+				errno,
+				strerror(errno))));
+		}
+	}
+	return 0;
+}
+
+/**
+ * Deliver the messages of a mailbox. The eventfd is reset before the list
+ * is taken, a message posted after that signals it again.
+ *
+ * @param box	The mailbox
+ */
+static void
+poll_mail_received(MAILBOX *box)
+{
+MAIL		*list, *mail, *next;
+uint64_t	count;
+
+	while (read(box->fd, &count, sizeof(count)) == sizeof(count))
+		;
+	list = __sync_lock_test_and_set(&box->head, NULL);
+
+	/*< Reverse the list into the posting order */
+	mail = NULL;
+	while (list != NULL)
+	{
+		next = list->next;
+		list->next = mail;
+		mail = list;
+		list = next;
+	}
+	while (mail != NULL)
+	{
+		next = mail->next;
+		mail->func(mail->arg1, mail->arg2);
+		slab_free(mail_cache, mail);
+		POLL_STATS->n_delivered++;
+		mail = next;
+	}
+}
+
+/**
+ * Receive a wake up of the event set. The eventfd is read once, which
+ * drains it in the set of a thread and takes one wake up from a shared
+ * set. Only the first thread that sees the wake up measures the latency
+ * from the call to poll_wake.
+ *
+ * @param wake	The wake up eventfd of the set
+ */
+static void
+poll_wake_received(WAKE *wake)
+{
+uint64_t	count;
+long		then;
+long		latency;
+
+	if (read(wake->fd, &count, sizeof(count)) != sizeof(count))
+		return;
+	if ((then = __sync_lock_test_and_set(&wake->time, 0)) == 0)
+		return;
+	latency = stats_usecs() - then;
+	POLL_STATS->n_wakes++;
+	POLL_STATS->wake_latency += latency;
+	if (latency > POLL_STATS->wake_max)
+		POLL_STATS->wake_max = latency;
 }
 
 /**
@@ -516,6 +1099,97 @@ poll_bitmask()
 	return &poll_mask;
 }
 
+/**
+ * Return the number of event sets in use, one per polling thread when
+ * epoll_per_thread is set or the engine is not epoll and one shared set
+ * otherwise.
+ *
+ * @return The number of event sets
+ */
+int
+poll_n_epoll_sets()
+{
+	return n_poll_sets;
+}
+
+/**
+ * Return the polling thread the caller is running in
+ *
+ * @return The polling thread id of the caller, 0 outside the polling threads
+ */
+int
+poll_current_thread()
+{
+	return current_thread_id;
+}
+
+/**
+ * Return whether the caller is one of the polling threads. The other
+ * threads, such as the monitors and the housekeeper, share the data of
+ * polling thread 0 when they use per thread data.
+ *
+ * @return True in a polling thread
+ */
+bool
+poll_is_polling_thread()
+{
+	return polling_thread;
+}
+
+/**
+ * Choose the polling thread that sets up and owns a newly accepted client
+ * according to the accept_balance option. The client counts as load of
+ * the thread until the thread calls poll_accept_done, so a burst of
+ * accepts is spread even before the clients are added to the event sets.
+ * When the event set is shared the accepting thread is returned.
+ *
+ * @return	The polling thread for the client
+ */
+int
+poll_accept_thread()
+{
+int	thread_id = current_thread_id;
+int	i, load, best;
+
+	if (n_poll_sets == 1)
+		return current_thread_id;
+	switch (accept_balance)
+	{
+	case POLL_ACCEPT_ROUND_ROBIN:
+		thread_id = ((unsigned int)atomic_add(&accept_next, 1)) % n_poll_sets;
+		break;
+	case POLL_ACCEPT_LEAST_LOADED:
+		best = INT_MAX;
+		for (i = 0; i < n_poll_sets; i++)
+		{
+			load = thread_load[i].n_dcbs + thread_load[i].n_accepting;
+			if (load < best)
+			{
+				best = load;
+				thread_id = i;
+			}
+		}
+		break;
+	}
+	atomic_add(&thread_load[thread_id].n_accepting, 1);
+	if (thread_id != current_thread_id)
+		POLL_STATS->n_accept_handoff++;
+	return thread_id;
+}
+
+/**
+ * Release the load taken by poll_accept_thread once the client has been
+ * added to the event set of the thread or has failed.
+ *
+ * @param thread_id	The thread returned by poll_accept_thread
+ */
+void
+poll_accept_done(int thread_id)
+{
+	if (n_poll_sets > 1)
+		atomic_add(&thread_load[thread_id].n_accepting, -1);
+}
+
 /**
  * Debug routine to print the polling statistics
  *
@@ -524,10 +1198,50 @@ poll_bitmask()
 void
 dprintPollStats(DCB *dcb)
 {
-	dcb_printf(dcb, "Number of epoll cycles: 	%d\n", pollStats.n_polls);
-	dcb_printf(dcb, "Number of read events:   	%d\n", pollStats.n_read);
-	dcb_printf(dcb, "Number of write events: 	%d\n", pollStats.n_write);
-	dcb_printf(dcb, "Number of error events: 	%d\n", pollStats.n_error);
-	dcb_printf(dcb, "Number of hangup events:	%d\n", pollStats.n_hup);
-	dcb_printf(dcb, "Number of accept events:	%d\n", pollStats.n_accept);
+THREAD_STATS	total;
+
+	stats_sum(&total);
+	dcb_printf(dcb, "Poll engine:            	%s\n", engine->name);
+	dcb_printf(dcb, "Number of epoll sets:   	%d\n", n_poll_sets);
+	dcb_printf(dcb, "Number of epoll cycles: 	%d\n", total.n_polls);
+	dcb_printf(dcb, "Number of read events:   	%d\n", total.n_read);
+	dcb_printf(dcb, "Number of write events: 	%d\n", total.n_write);
+	dcb_printf(dcb, "Number of error events: 	%d\n", total.n_error);
+	dcb_printf(dcb, "Number of hangup events:	%d\n", total.n_hup);
+	dcb_printf(dcb, "Number of accept events:	%d\n", total.n_accept);
+	dcb_printf(dcb, "Number of empty polls:  	%d\n", total.n_empty);
+	dcb_printf(dcb, "Number of blocking polls:	%d\n", total.n_blocked);
+	dcb_printf(dcb, "Number of wake ups:     	%d\n", total.n_wakes);
+	dcb_printf(dcb, "Number of coalesced events:	%d\n", total.n_coalesced);
+	dcb_printf(dcb, "Number of reads stopped:	%d\n", total.n_read_stopped);
+	dcb_printf(dcb, "Number of engine syscalls:	%d\n", total.n_syscalls);
+	dcb_printf(dcb, "Number of messages posted:	%d\n", total.n_posted);
+	dcb_printf(dcb, "Number of messages delivered:	%d\n", total.n_delivered);
+	dcb_printf(dcb, "Number of mailbox signals:	%d\n", total.n_mail_wakes);
+	dcb_printf(dcb, "Number of deferred writes:	%d\n", total.n_deferred);
+	dcb_printf(dcb, "Number of coalesced writes:	%d\n", total.n_write_coalesced);
+	dcb_printf(dcb, "Number of deferred flushes:	%d\n", total.n_flushed);
+	dcb_printf(dcb, "Number of clients handed off:	%d\n", total.n_accept_handoff);
+	if (total.n_wakes > 0)
+	{
+		dcb_printf(dcb, "Average wake up latency:	%ld usecs\n",
+			total.wake_latency / total.n_wakes);
+		dcb_printf(dcb, "Maximum wake up latency:	%ld usecs\n",
+			total.wake_max);
+	}
+	dprintHistogram(dcb, "Event loop time (usecs):", &total.loop_time);
+	dprintHistogram(dcb, "Events per poll:", &total.events);
+	dprintHistogram(dcb, "Query routing time (usecs):", &total.route_time);
+	dprintHistogram(dcb, "Listen backlog on accept:", &total.accept_backlog);
+	dprintHistogram(dcb, "Accepts per wake up:", &total.accept_batch);
+	dprintHistogram(dcb, "Handshake latency (usecs):", &total.handshake_time);
+	if (n_poll_sets > 1)
+	{
+		int	i;
+
+		dcb_printf(dcb, "DCBs per thread:       	");
+		for (i = 0; i < n_poll_sets; i++)
+			dcb_printf(dcb, " %d", thread_load[i].n_dcbs);
+		dcb_printf(dcb, "\n");
+	}
 }
@@ -0,0 +1,578 @@
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2014
+ */
+
+/**
+ * @file poll_engine.c  - The I/O event engines
+ *
+ * Two engines are provided. The epoll engine maps each entry point onto the
+ * epoll system call of the same name.
+ *
+ * The io_uring engine submits a poll request for each descriptor to an
+ * io_uring instance and reads the completions from the shared completion
+ * ring. Completions are read without a system call and the changes made
+ * by the thread that waits on the set are submitted together with its next
+ * wait, so a busy thread makes one system call per batch of events instead
+ * of one per epoll_ctl and epoll_wait. Removals are submitted at once, as
+ * the poll request holds a reference to the socket.
+ *
+ * Every descriptor has a slot holding its user data and a generation
+ * number, which is part of the user data of the poll request. Completions
+ * of requests that were cancelled or replaced carry an old generation and
+ * are dropped, so the user data of a removed descriptor is never returned.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <poll_engine.h>
+#include <spinlock.h>
+#include <statistics.h>
+
+/**
+ * The epoll engine
+ */
+typedef struct {
+	int		fd;		/*< The epoll descriptor */
+} EPOLL_SET;
+
+static POLL_SET *
+epoll_engine_create(int max_events)
+{
+EPOLL_SET	*set;
+
+	if ((set = (EPOLL_SET *)calloc(1, sizeof(EPOLL_SET))) == NULL)
+		return NULL;
+	if ((set->fd = epoll_create(max_events)) == -1)
+	{
+		free(set);
+		return NULL;
+	}
+	return set;
+}
+
+static int
+epoll_engine_ctl(POLL_SET *pset, int op, int fd, __uint32_t events, void *data)
+{
+EPOLL_SET		*set = (EPOLL_SET *)pset;
+struct epoll_event	ev;
+
+	ev.events = events;
+	ev.data.ptr = data;
+	stats_thread()->n_syscalls++;
+	return epoll_ctl(set->fd, op, fd, &ev);
+}
+
+static int
+epoll_engine_add(POLL_SET *set, int fd, __uint32_t events, void *data)
+{
+	return epoll_engine_ctl(set, EPOLL_CTL_ADD, fd, events, data);
+}
+
+static int
+epoll_engine_modify(POLL_SET *set, int fd, __uint32_t events, void *data)
+{
+	return epoll_engine_ctl(set, EPOLL_CTL_MOD, fd, events, data);
+}
+
+static int
+epoll_engine_remove(POLL_SET *set, int fd)
+{
+	return epoll_engine_ctl(set, EPOLL_CTL_DEL, fd, 0, NULL);
+}
+
+static void
+epoll_engine_destroy(POLL_SET *pset)
+{
+EPOLL_SET	*set = (EPOLL_SET *)pset;
+
+	close(set->fd);
+	free(set);
+}
+
+static int
+epoll_engine_wait(POLL_SET *pset, struct epoll_event *events, int max, int timeout)
+{
+EPOLL_SET	*set = (EPOLL_SET *)pset;
+
+	stats_thread()->n_syscalls++;
+	return epoll_wait(set->fd, events, max, timeout);
+}
+
+POLL_ENGINE poll_engine_epoll = {
+	"epoll",
+	epoll_engine_create,
+	epoll_engine_add,
+	epoll_engine_modify,
+	epoll_engine_remove,
+	epoll_engine_wait,
+	epoll_engine_destroy
+};
+
+/**
+ * The io_uring engine
+ */
+#define	URING_ENTRIES	256		/*< Size of the submission ring */
+
+/**
+ * The registration of a descriptor in an io_uring set
+ */
+typedef struct {
+	void		*data;		/*< The user data */
+	__uint32_t	events;		/*< The events and reporting flags */
+	__uint32_t	gen;		/*< Generation of the poll request, 0 if free */
+	int		armed;		/*< A poll request is active */
+} URING_FD;
+
+typedef struct {
+	int			ring_fd;	/*< The io_uring descriptor */
+	SPINLOCK		lock;		/*< Protects the rings and the slots */
+	pthread_t		owner;		/*< The thread that waits on the set */
+	int			has_owner;	/*< A thread has waited on the set */
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		*sq_flags;
+	unsigned		*sq_array;
+	unsigned		sq_mask;
+	unsigned		sq_entries;
+	struct io_uring_sqe	*sqes;
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		cq_mask;
+	struct io_uring_cqe	*cqes;
+	char			*sq_ptr;	/*< The mapping of the submission ring */
+	size_t			sq_size;
+	char			*cq_ptr;	/*< The mapping of the completion ring */
+	size_t			cq_size;
+	size_t			sqes_size;	/*< Size of the mapping of the sqes */
+	URING_FD		*fds;		/*< Slots indexed by descriptor */
+	int			n_fds;		/*< Number of slots */
+	__uint32_t		gen;		/*< Last generation handed out */
+} URING_SET;
+
+static int
+uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete,
+	    unsigned flags, void *arg, size_t argsz)
+{
+	stats_thread()->n_syscalls++;
+	return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit,
+			    min_complete, flags, arg, argsz);
+}
+
+/**
+ * Release the mappings, the descriptor and the memory of a set
+ *
+ * @param set	The set, the mappings that failed are MAP_FAILED or NULL
+ */
+static void
+uring_release(URING_SET *set)
+{
+	if (set->sqes != NULL && set->sqes != MAP_FAILED)
+		munmap(set->sqes, set->sqes_size);
+	if (set->cq_ptr != NULL && set->cq_ptr != MAP_FAILED &&
+	    set->cq_ptr != set->sq_ptr)
+		munmap(set->cq_ptr, set->cq_size);
+	if (set->sq_ptr != NULL && set->sq_ptr != MAP_FAILED)
+		munmap(set->sq_ptr, set->sq_size);
+	close(set->ring_fd);
+	free(set->fds);
+	free(set);
+}
+
+static POLL_SET *
+uring_engine_create(int max_events)
+{
+URING_SET		*set;
+struct io_uring_params	p;
+size_t			sq_size, cq_size;
+char			*sq_ptr, *cq_ptr;
+
+	if ((set = (URING_SET *)calloc(1, sizeof(URING_SET))) == NULL)
+		return NULL;
+	memset(&p, 0, sizeof(p));
+	if ((set->ring_fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) == -1)
+	{
+		free(set);
+		return NULL;
+	}
+	if ((p.features & IORING_FEAT_EXT_ARG) == 0 ||
+	    (p.features & IORING_FEAT_NODROP) == 0)
+	{
+		close(set->ring_fd);
+		free(set);
+		errno = ENOSYS;
+		return NULL;
+	}
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (cq_size > sq_size)
+			sq_size = cq_size;
+		cq_size = sq_size;
+	}
+	set->sq_size = sq_size;
+	set->cq_size = cq_size;
+	set->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	sq_ptr = set->sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, set->ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED)
+		goto failed;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		cq_ptr = set->cq_ptr = sq_ptr;
+	else if ((cq_ptr = set->cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, set->ring_fd,
+				IORING_OFF_CQ_RING)) == MAP_FAILED)
+		goto failed;
+	set->sqes = mmap(NULL, set->sqes_size,
+			 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 set->ring_fd, IORING_OFF_SQES);
+	if (set->sqes == MAP_FAILED)
+		goto failed;
+
+	set->sq_head = (unsigned *)(sq_ptr + p.sq_off.head);
+	set->sq_tail = (unsigned *)(sq_ptr + p.sq_off.tail);
+	set->sq_flags = (unsigned *)(sq_ptr + p.sq_off.flags);
+	set->sq_array = (unsigned *)(sq_ptr + p.sq_off.array);
+	set->sq_mask = *(unsigned *)(sq_ptr + p.sq_off.ring_mask);
+	set->sq_entries = p.sq_entries;
+	set->cq_head = (unsigned *)(cq_ptr + p.cq_off.head);
+	set->cq_tail = (unsigned *)(cq_ptr + p.cq_off.tail);
+	set->cq_mask = *(unsigned *)(cq_ptr + p.cq_off.ring_mask);
+	set->cqes = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+	spinlock_init_named(&set->lock, "poll set lock");
+	return set;
+
+failed:
+	uring_release(set);
+	return NULL;
+}
+
+static void
+uring_engine_destroy(POLL_SET *pset)
+{
+	uring_release((URING_SET *)pset);
+}
+
+/**
+ * Return the number of requests in the submission ring that have not been
+ * submitted yet.
+ */
+static unsigned
+uring_unsubmitted(URING_SET *set)
+{
+	return __atomic_load_n(set->sq_tail, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(set->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Submit the queued requests, the caller must hold the set lock
+ */
+static void
+uring_submit(URING_SET *set)
+{
+unsigned	n;
+
+	if ((n = uring_unsubmitted(set)) > 0)
+		uring_enter(set->ring_fd, n, 0, 0, NULL, 0);
+}
+
+/**
+ * Return the next free submission entry, the caller must hold the set lock
+ * and call uring_queue once the entry is filled in.
+ */
+static struct io_uring_sqe *
+uring_get_sqe(URING_SET *set)
+{
+struct io_uring_sqe	*sqe;
+unsigned		idx;
+
+	if (uring_unsubmitted(set) >= set->sq_entries)
+		uring_submit(set);
+	idx = *set->sq_tail & set->sq_mask;
+	sqe = &set->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	set->sq_array[idx] = idx;
+	return sqe;
+}
+
+static void
+uring_queue(URING_SET *set)
+{
+	__atomic_store_n(set->sq_tail, *set->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Return the slot of a descriptor, the caller must hold the set lock
+ */
+static URING_FD *
+uring_slot(URING_SET *set, int fd)
+{
+URING_FD	*fds;
+int		n;
+
+	if (fd < 0)
+		return NULL;
+	if (fd >= set->n_fds)
+	{
+		n = set->n_fds ? set->n_fds : 1024;
+		while (n <= fd)
+			n *= 2;
+		if ((fds = (URING_FD *)realloc(set->fds, n * sizeof(URING_FD))) == NULL)
+			return NULL;
+		memset(&fds[set->n_fds], 0, (n - set->n_fds) * sizeof(URING_FD));
+		set->fds = fds;
+		set->n_fds = n;
+	}
+	return &set->fds[fd];
+}
+
+/**
+ * Queue a poll request for a descriptor with the events of its slot
+ */
+static void
+uring_arm(URING_SET *set, int fd, URING_FD *slot)
+{
+struct io_uring_sqe	*sqe = uring_get_sqe(set);
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = slot->events & ~(EPOLLET | EPOLLONESHOT);
+	if (slot->events & EPOLLET)
+		sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = ((__u64)fd << 32) | slot->gen;
+	uring_queue(set);
+	slot->armed = 1;
+}
+
+/**
+ * Queue the cancellation of the active poll request of a descriptor
+ */
+static void
+uring_cancel(URING_SET *set, int fd, URING_FD *slot)
+{
+struct io_uring_sqe	*sqe;
+
+	if (!slot->armed)
+		return;
+	sqe = uring_get_sqe(set);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = ((__u64)fd << 32) | slot->gen;
+	sqe->user_data = 0;
+	uring_queue(set);
+	slot->armed = 0;
+}
+
+/**
+ * Submit the changes at once unless the calling thread waits on the set,
+ * in which case they go with its next wait.
+ */
+static void
+uring_commit(URING_SET *set)
+{
+	if (!set->has_owner || !pthread_equal(set->owner, pthread_self()))
+		uring_submit(set);
+}
+
+static int
+uring_engine_add(POLL_SET *pset, int fd, __uint32_t events, void *data)
+{
+URING_SET	*set = (URING_SET *)pset;
+URING_FD	*slot;
+
+	spinlock_acquire(&set->lock);
+	if ((slot = uring_slot(set, fd)) == NULL)
+	{
+		spinlock_release(&set->lock);
+		errno = ENOMEM;
+		return -1;
+	}
+	/*
+	 * A descriptor that was closed without being removed may have been
+	 * reused, as with epoll the new registration replaces the old one.
+	 */
+	uring_cancel(set, fd, slot);
+	if (++set->gen == 0)
+		set->gen = 1;
+	slot->gen = set->gen;
+	slot->data = data;
+	slot->events = events;
+	uring_arm(set, fd, slot);
+	uring_commit(set);
+	spinlock_release(&set->lock);
+	return 0;
+}
+
+static int
+uring_engine_modify(POLL_SET *pset, int fd, __uint32_t events, void *data)
+{
+URING_SET	*set = (URING_SET *)pset;
+URING_FD	*slot;
+
+	spinlock_acquire(&set->lock);
+	if (fd < 0 || fd >= set->n_fds || (slot = &set->fds[fd])->gen == 0)
+	{
+		spinlock_release(&set->lock);
+		errno = ENOENT;
+		return -1;
+	}
+	uring_cancel(set, fd, slot);
+	if (++set->gen == 0)
+		set->gen = 1;
+	slot->gen = set->gen;
+	slot->data = data;
+	slot->events = events;
+	uring_arm(set, fd, slot);
+	uring_commit(set);
+	spinlock_release(&set->lock);
+	return 0;
+}
+
+static int
+uring_engine_remove(POLL_SET *pset, int fd)
+{
+URING_SET	*set = (URING_SET *)pset;
+URING_FD	*slot;
+
+	spinlock_acquire(&set->lock);
+	if (fd < 0 || fd >= set->n_fds || (slot = &set->fds[fd])->gen == 0)
+	{
+		spinlock_release(&set->lock);
+		errno = ENOENT;
+		return -1;
+	}
+	uring_cancel(set, fd, slot);
+	slot->gen = 0;
+	slot->data = NULL;
+	uring_submit(set);
+	spinlock_release(&set->lock);
+	return 0;
+}
+
+/**
+ * Move the completions of the current poll requests into the event array.
+ * Descriptors whose request has ended are armed again unless they were
+ * added with EPOLLONESHOT, which gives level triggered reporting for
+ * single shot requests.
+ */
+static int
+uring_reap(URING_SET *set, struct epoll_event *events, int max)
+{
+struct io_uring_cqe	*cqe;
+URING_FD		*slot;
+unsigned		head, tail;
+__u64			ud;
+int			fd, n = 0;
+
+	spinlock_acquire(&set->lock);
+	head = *set->cq_head;
+	tail = __atomic_load_n(set->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail && n < max)
+	{
+		cqe = &set->cqes[head & set->cq_mask];
+		head++;
+		ud = cqe->user_data;
+		fd = (int)(ud >> 32);
+		if ((__uint32_t)ud == 0 || fd >= set->n_fds)
+			continue;
+		slot = &set->fds[fd];
+		if (slot->gen != (__uint32_t)ud)
+			continue;
+		if ((cqe->flags & IORING_CQE_F_MORE) == 0)
+			slot->armed = 0;
+		if (cqe->res == -ECANCELED)
+			continue;
+		events[n].events = cqe->res < 0 ? EPOLLERR : (__uint32_t)cqe->res;
+		events[n].data.ptr = slot->data;
+		n++;
+		if (!slot->armed && (slot->events & EPOLLONESHOT) == 0)
+			uring_arm(set, fd, slot);
+	}
+	__atomic_store_n(set->cq_head, head, __ATOMIC_RELEASE);
+	spinlock_release(&set->lock);
+	return n;
+}
+
+static int
+uring_engine_wait(POLL_SET *pset, struct epoll_event *events, int max, int timeout)
+{
+URING_SET			*set = (URING_SET *)pset;
+struct io_uring_getevents_arg	arg;
+struct __kernel_timespec	ts;
+unsigned			flags;
+int				n;
+
+	if (!set->has_owner)
+	{
+		set->owner = pthread_self();
+		set->has_owner = 1;
+	}
+	if ((n = uring_reap(set, events, max)) > 0 || timeout == 0)
+	{
+		flags = __atomic_load_n(set->sq_flags, __ATOMIC_ACQUIRE);
+		if (uring_unsubmitted(set) > 0 || (flags & IORING_SQ_CQ_OVERFLOW))
+			uring_enter(set->ring_fd, uring_unsubmitted(set), 0,
+				    IORING_ENTER_GETEVENTS, NULL, 0);
+		return n;
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	if (timeout > 0)
+	{
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000L;
+		arg.ts = (__u64)(unsigned long)&ts;
+	}
+	if (uring_enter(set->ring_fd, uring_unsubmitted(set), 1,
+			IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			&arg, sizeof(arg)) == -1 &&
+	    errno != ETIME && errno != EINTR)
+		return -1;
+	return uring_reap(set, events, max);
+}
+
+POLL_ENGINE poll_engine_io_uring = {
+	"io_uring",
+	uring_engine_create,
+	uring_engine_add,
+	uring_engine_modify,
+	uring_engine_remove,
+	uring_engine_wait,
+	uring_engine_destroy
+};
+
+/**
+ * Return the engine of the given name
+ *
+ * @param name	The engine name, NULL for the default engine
+ * @return	The engine or NULL if there is no engine of that name
+ */
+POLL_ENGINE *
+poll_engine_find(char *name)
+{
+	if (name == NULL || strcmp(name, poll_engine_epoll.name) == 0)
+		return &poll_engine_epoll;
+	if (strcmp(name, poll_engine_io_uring.name) == 0)
+		return &poll_engine_io_uring;
+	return NULL;
+}
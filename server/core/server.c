@@ -39,7 +39,7 @@
 
 extern int lm_enabled_logfiles_bitmask;
 
-static SPINLOCK	server_spin = SPINLOCK_INIT;
+static SPINLOCK	server_spin = SPINLOCK_INIT_NAMED("server_spin");
 static SERVER	*allServers = NULL;
 
 /**
@@ -49,7 +49,7 @@
 
 extern int lm_enabled_logfiles_bitmask;
 
-static SPINLOCK	service_spin = SPINLOCK_INIT;
+static SPINLOCK	service_spin = SPINLOCK_INIT_NAMED("service_spin");
 static SERVICE	*allServices = NULL;
 
 /**
@@ -84,8 +84,8 @@ SERVICE 	*service;
 	service->enable_root = 0;
 	service->routerOptions = NULL;
 	service->databases = NULL;
-	spinlock_init(&service->spin);
-	spinlock_init(&service->users_table_spin);
+	spinlock_init_named(&service->spin, "service spin");
+	spinlock_init_named(&service->users_table_spin, "service users_table_spin");
 	memset(&service->rate_limit, 0, sizeof(SERVICE_REFRESH_RATE));
 
 	spinlock_acquire(&service_spin);
@@ -161,7 +161,15 @@ GWPROTOCOL	*funcs;
                 port->listener->session = session_alloc(service, port->listener);
                 
                 if (port->listener->session != NULL) {
+                        DCB *shard = port->listener->next_listener;
+
                         port->listener->session->state = SESSION_STATE_LISTENER;
+                        /*< Per-thread listeners share the listener session */
+                        while (shard)
+                        {
+                                shard->session = port->listener->session;
+                                shard = shard->next_listener;
+                        }
                         listeners += 1;
                 } else {
                         dcb_close(port->listener);
@@ -270,7 +278,10 @@ int		listeners = 0;
 	port = service->ports;
 	while (port)
 	{
-		poll_remove_dcb(port->listener);
+		DCB *shard;
+
+		for (shard = port->listener; shard; shard = shard->next_listener)
+			poll_remove_dcb(shard);
 		port->listener->session->state = SESSION_STATE_LISTENER_STOPPED;
 		listeners++;
 
@@ -297,10 +308,15 @@ int		listeners = 0;
 	port = service->ports;
 	while (port)
 	{
+		DCB *shard;
+
                 if (poll_add_dcb(port->listener) == 0) {
                         port->listener->session->state = SESSION_STATE_LISTENER;
                         listeners++;
                 }
+		for (shard = port->listener->next_listener; shard;
+                     shard = shard->next_listener)
+			poll_add_dcb(shard);
 		port = port->next;
 	}
 
@@ -599,6 +615,7 @@ SERVER	*ptr = service->databases;
 	printf("\tUsers data:        	%p\n", service->users);
 	printf("\tTotal connections:	%d\n", service->stats.n_sessions);
 	printf("\tCurrently connected:	%d\n", service->stats.n_current);
+	printf("\tBuffered data:		%d bytes\n", service->stats.mem_buffered);
 }
 
 /**
@@ -656,6 +673,7 @@ SERVICE	*ptr;
 		dcb_printf(dcb, "\tUsers data:        	%p\n", ptr->users);
 		dcb_printf(dcb, "\tTotal connections:	%d\n", ptr->stats.n_sessions);
 		dcb_printf(dcb, "\tCurrently connected:	%d\n", ptr->stats.n_current);
+		dcb_printf(dcb, "\tBuffered data:		%d bytes\n", ptr->stats.mem_buffered);
 		ptr = ptr->next;
 	}
 	spinlock_release(&service_spin);
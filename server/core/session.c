@@ -39,13 +39,17 @@
 #include <dcb.h>
 #include <spinlock.h>
 #include <atomic.h>
+#include <slab.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
+#include <config.h>
+#include <poll.h>
 
 extern int lm_enabled_logfiles_bitmask;
 
-static SPINLOCK	session_spin = SPINLOCK_INIT;
+static SPINLOCK	session_spin = SPINLOCK_INIT_NAMED("session_spin");
 static SESSION	*allSessions = NULL;
+static SLAB_CACHE *session_cache = NULL;
 
 /**
  * Allocate a new session for a new client of the specified service.
@@ -63,7 +67,9 @@ session_alloc(SERVICE *service, DCB *client_dcb)
 {
         SESSION 	*session;
 
-        session = (SESSION *)calloc(1, sizeof(SESSION));
+        if (session_cache == NULL)
+                session_cache = slab_cache_alloc("SESSION", sizeof(SESSION));
+        session = (SESSION *)slab_alloc(session_cache);
         ss_info_dassert(session != NULL,
                         "Allocating memory for session failed.");
         
@@ -82,7 +88,7 @@ session_alloc(SERVICE *service, DCB *client_dcb)
         session->ses_chk_top = CHK_NUM_SESSION;
         session->ses_chk_tail = CHK_NUM_SESSION;
 #endif
-        spinlock_init(&session->ses_lock);
+        spinlock_init_named(&session->ses_lock, "session ses_lock");
         /*<
          * Prevent backend threads from accessing before session is completely
          * initialized.
@@ -103,6 +109,11 @@ session_alloc(SERVICE *service, DCB *client_dcb)
         session->data = client_dcb->data;
 	client_dcb->session = session;
 	session->refcount = 1;
+	session->mem_throttled = false;
+	/*< The handshake may still be queued for the client */
+	session->stats.mem_buffered = client_dcb->mem_buffered;
+	session->stats.mem_peak = client_dcb->mem_buffered;
+	atomic_add(&service->stats.mem_buffered, client_dcb->mem_buffered);
         /*<
          * This indicates that session is ready to be shared with backend
          * DCBs. Note that this doesn't mean that router is initialized yet!
@@ -179,6 +190,7 @@ session_link_dcb(SESSION *session, DCB *dcb)
 	atomic_add(&session->refcount, 1);
 	dcb->session = session;
 	spinlock_release(&session->ses_lock);
+	session_mem_account(session, dcb->mem_buffered);
 	return true;
 }
 
@@ -208,10 +220,93 @@ int session_unlink_dcb(
                  dcb->session = NULL;
         }
         spinlock_release(&session->ses_lock);
+
+        if (dcb != NULL)
+        {
+                session_mem_account(session, -dcb->mem_buffered);
+        }
         
         return nlink;
 }
 
+/**
+ * Stop or start reading from the client of a session for the memory limit.
+ * Reading is not started while the client waits for a backend write queue
+ * to drain, that restarts it when the queue has drained.
+ *
+ * @param session	The session
+ * @param stop		True to stop reading
+ */
+static void
+session_mem_throttle(SESSION *session, bool stop)
+{
+DCB	*client;
+
+	spinlock_acquire(&session->ses_lock);
+	client = session->client;
+	if (session->mem_throttled != stop &&
+	    client != NULL && client->state == DCB_STATE_POLLING)
+	{
+		session->mem_throttled = stop;
+		if (stop)
+		{
+			session->stats.n_mem_throttled++;
+			poll_stop_read(client);
+		}
+		else if (client->throttled_by == NULL)
+		{
+			poll_start_read(client);
+		}
+		LOGIF(LD, (skygw_log_write(
+			LOGFILE_DEBUG,
+			"%lu [session_mem_throttle] %s reading dcb %p, session "
+			"%p holds %d bytes.",
+			pthread_self(),
+			stop ? "Stopped" : "Started",
+			client,
+			session,
+			session->stats.mem_buffered)));
+	}
+	spinlock_release(&session->ses_lock);
+}
+
+/**
+ * Account bytes of data that are held in buffers for a session, such as
+ * queued writes, partly read packets and session command history, to the
+ * session and its service.
+ *
+ * When the session holds more than the configured session_mem_limit its
+ * client stops reading, so that the data stays in the kernel and TCP
+ * flow control slows the client, until half of the limit is released.
+ *
+ * @param session	The session, may be NULL
+ * @param bytes		The number of bytes taken, negative if released
+ */
+void
+session_mem_account(SESSION *session, int bytes)
+{
+unsigned int	limit;
+int		total;
+
+	if (session == NULL || bytes == 0)
+		return;
+	total = atomic_add(&session->stats.mem_buffered, bytes) + bytes;
+	if (total > session->stats.mem_peak)
+		session->stats.mem_peak = total;
+	atomic_add(&session->service->stats.mem_buffered, bytes);
+
+	limit = config_session_mem_limit();
+	if (bytes > 0)
+	{
+		if (limit != 0 && total > limit && !session->mem_throttled)
+			session_mem_throttle(session, true);
+	}
+	else if (session->mem_throttled && (limit == 0 || total <= limit / 2))
+	{
+		session_mem_throttle(session, false);
+	}
+}
+
 /**
  * Deallocate the specified session
  *
@@ -262,7 +357,10 @@ bool session_free(
                         session->service->router_instance,
                         session->router_session);
         }
-	free(session);
+	/*< Whatever was not released is no longer held for the service */
+	atomic_add(&session->service->stats.mem_buffered,
+		   -session->stats.mem_buffered);
+	slab_free(session_cache, session);
         succp = true;
         
 return_succp :
@@ -390,6 +488,7 @@ SESSION	*ptr;
 		if (ptr->client && ptr->client->remote)
 			dcb_printf(dcb, "\tClient Address:		%s\n", ptr->client->remote);
 		dcb_printf(dcb, "\tConnected:		%s", asctime(localtime(&ptr->stats.connect)));
+		dcb_printf(dcb, "\tBuffered data:		%d bytes\n", ptr->stats.mem_buffered);
 		ptr = ptr->next;
 	}
 	spinlock_release(&session_spin);
@@ -414,6 +513,9 @@ dprintSession(DCB *dcb, SESSION *ptr)
 	if (ptr->client && ptr->client->remote)
 		dcb_printf(dcb, "\tClient Address:		%s\n", ptr->client->remote);
 	dcb_printf(dcb, "\tConnected:		%s", asctime(localtime(&ptr->stats.connect)));
+	dcb_printf(dcb, "\tBuffered data:		%d bytes\n", ptr->stats.mem_buffered);
+	dcb_printf(dcb, "\tPeak buffered data:	%d bytes\n", ptr->stats.mem_peak);
+	dcb_printf(dcb, "\tMemory limit stops:	%d\n", ptr->stats.n_mem_throttled);
 }
 
 /**
@@ -0,0 +1,383 @@
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2014
+ */
+
+/**
+ * @file slab.c  - Caches of fixed size objects
+ *
+ * Freed objects are linked into the free list of the freeing thread through
+ * their first word. A thread allocates from its own free list without any
+ * locking. When the free list of a thread grows beyond SLAB_THREAD_MAX a
+ * batch of objects is moved to the free list shared by all threads, and a
+ * thread with an empty free list takes a batch from the shared list before
+ * falling back to the heap. Objects are zeroed on allocation, so a cache
+ * can be used wherever calloc was used before, unless they are allocated
+ * with slab_alloc_nozero for objects that are fully initialised anyway.
+ *
+ * The usage statistics are counted by each polling thread in an entry of
+ * its own, without atomic operations, so the counting does not share a
+ * cache line between the threads that use a cache. The other threads share
+ * one more entry, which they update with atomic operations.
+ *
+ * Objects are never returned to the heap, a cache keeps as many objects as
+ * were in use at the peak. This also lets the caches of the buffer pools
+ * take new objects from the huge page arena, which never takes them back.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <slab.h>
+#include <arena.h>
+#include <dcb.h>
+#include <poll.h>
+#include <atomic.h>
+
+/**
+ * The free list of a thread for one cache
+ */
+typedef struct {
+	void	*free;		/*< The free objects */
+	int	count;		/*< Number of free objects */
+} SLAB_THREAD;
+
+static	SPINLOCK	slab_spin = SPINLOCK_INIT_NAMED("slab_spin");
+static	SLAB_CACHE	*allCaches = NULL;
+static	int		n_caches = 0;
+static	__thread SLAB_THREAD thread_lists[SLAB_MAX_CACHES];
+
+#define	SLAB_NEXT(obj)	(*(void **)(obj))
+
+/**
+ * Count an event in the statistics entry of the calling thread, with an
+ * atomic add if the thread shares the entry.
+ */
+#define	SLAB_COUNT(cache, field) \
+	do { \
+		int	id = slab_stats_id(cache); \
+		if (id < (cache)->n_stats) \
+			(cache)->stats[id].field++; \
+		else \
+			atomic_add(&(cache)->stats[id].field, 1); \
+	} while (0)
+
+/**
+ * Return the statistics entry of the calling thread. Threads other than the
+ * polling threads, and the polling threads of a cache created before the
+ * statistics were initialised, share the entry after those of the polling
+ * threads.
+ *
+ * @param cache	The slab cache
+ * @return	The index of the statistics to update
+ */
+static int
+slab_stats_id(SLAB_CACHE *cache)
+{
+int	id;
+
+	if (!poll_is_polling_thread())
+		return cache->n_stats;
+	id = stats_thread_id();
+	return id < cache->n_stats ? id : cache->n_stats;
+}
+
+/**
+ * Return the slab cache for objects of the given name and size, the cache
+ * is created on the first call. Modules that are loaded more than once, or
+ * share a source file, get the same cache for the same name.
+ *
+ * @param name	The name of the cache, used for diagnostics
+ * @param size	The size of the objects
+ * @return	The slab cache or NULL if the cache can not be created
+ */
+SLAB_CACHE *
+slab_cache_alloc(char *name, size_t size)
+{
+SLAB_CACHE	*cache;
+
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+
+	spinlock_acquire(&slab_spin);
+	for (cache = allCaches; cache; cache = cache->next)
+	{
+		if (cache->size == size && strcmp(cache->name, name) == 0)
+		{
+			spinlock_release(&slab_spin);
+			return cache;
+		}
+	}
+	if (n_caches >= SLAB_MAX_CACHES ||
+		(cache = (SLAB_CACHE *)calloc(1, sizeof(SLAB_CACHE))) == NULL)
+	{
+		spinlock_release(&slab_spin);
+		return NULL;
+	}
+	cache->n_stats = stats_n_threads();
+	if (posix_memalign((void **)&cache->stats, STATS_CACHE_LINE,
+			(cache->n_stats + 1) * sizeof(SLAB_STATS)) != 0)
+	{
+		spinlock_release(&slab_spin);
+		free(cache);
+		return NULL;
+	}
+	memset(cache->stats, 0, (cache->n_stats + 1) * sizeof(SLAB_STATS));
+	cache->name = strdup(name);
+	cache->size = size;
+	cache->id = n_caches++;
+	spinlock_init_named(&cache->lock, "slab cache lock");
+	cache->shared = NULL;
+	cache->n_shared = 0;
+	cache->next = allCaches;
+	allCaches = cache;
+	spinlock_release(&slab_spin);
+
+	return cache;
+}
+
+/**
+ * Take the new objects of a cache from the buffer arena rather than the
+ * heap, for as long as the arena has room.
+ *
+ * @param cache	The slab cache
+ */
+void
+slab_cache_use_arena(SLAB_CACHE *cache)
+{
+	if (cache != NULL)
+		cache->arena = 1;
+}
+
+/**
+ * Allocate a new object for a cache that has no free objects left
+ *
+ * @param cache	The slab cache
+ * @return	The object, not zeroed, or NULL if no memory is available
+ */
+static void *
+slab_new(SLAB_CACHE *cache)
+{
+void	*obj = NULL;
+
+	if (cache->arena)
+		obj = arena_alloc(cache->size);
+	if (obj == NULL)
+		obj = malloc(cache->size);
+	if (obj != NULL)
+		SLAB_COUNT(cache, n_misses);
+	return obj;
+}
+
+/**
+ * Move a batch of objects from the shared free list of a cache to the
+ * free list of the calling thread.
+ *
+ * @param cache	The slab cache
+ * @param local	The free list of the calling thread
+ */
+static void
+slab_refill(SLAB_CACHE *cache, SLAB_THREAD *local)
+{
+void	*obj;
+int	n = 0;
+
+	spinlock_acquire(&cache->lock);
+	while (n < SLAB_BATCH && (obj = cache->shared) != NULL)
+	{
+		cache->shared = SLAB_NEXT(obj);
+		SLAB_NEXT(obj) = local->free;
+		local->free = obj;
+		n++;
+	}
+	cache->n_shared -= n;
+	spinlock_release(&cache->lock);
+	local->count += n;
+}
+
+/**
+ * Move a batch of objects from the free list of the calling thread to the
+ * shared free list of a cache.
+ *
+ * @param cache	The slab cache
+ * @param local	The free list of the calling thread
+ */
+static void
+slab_flush(SLAB_CACHE *cache, SLAB_THREAD *local)
+{
+void	*head, *tail;
+int	n = 1;
+
+	head = tail = local->free;
+	while (n < SLAB_BATCH && SLAB_NEXT(tail) != NULL)
+	{
+		tail = SLAB_NEXT(tail);
+		n++;
+	}
+	local->free = SLAB_NEXT(tail);
+	local->count -= n;
+
+	spinlock_acquire(&cache->lock);
+	SLAB_NEXT(tail) = cache->shared;
+	cache->shared = head;
+	cache->n_shared += n;
+	spinlock_release(&cache->lock);
+}
+
+/**
+ * Take an object from the free list of the calling thread, refilling the
+ * list from the shared free list if it is empty.
+ *
+ * @param cache	The slab cache
+ * @return	The object or NULL if no free object is left
+ */
+static void *
+slab_take(SLAB_CACHE *cache)
+{
+SLAB_THREAD	*local = &thread_lists[cache->id];
+void		*obj;
+
+	if (local->free == NULL && cache->shared != NULL)
+		slab_refill(cache, local);
+
+	if ((obj = local->free) != NULL)
+	{
+		local->free = SLAB_NEXT(obj);
+		local->count--;
+	}
+	return obj;
+}
+
+/**
+ * Allocate a zeroed object from a slab cache.
+ *
+ * @param cache	The slab cache
+ * @return	The object or NULL if no memory is available or there is no cache
+ */
+void *
+slab_alloc(SLAB_CACHE *cache)
+{
+void	*obj;
+
+	if (cache == NULL)
+		return NULL;
+
+	if ((obj = slab_take(cache)) == NULL &&
+	    (obj = slab_new(cache)) == NULL)
+		return NULL;
+	memset(obj, 0, cache->size);
+	SLAB_COUNT(cache, n_allocs);
+	return obj;
+}
+
+/**
+ * Allocate an object from a slab cache without zeroing it, for large
+ * objects that the caller initialises.
+ *
+ * @param cache	The slab cache
+ * @return	The object or NULL if no memory is available or there is no cache
+ */
+void *
+slab_alloc_nozero(SLAB_CACHE *cache)
+{
+void	*obj;
+
+	if (cache == NULL)
+		return NULL;
+
+	if ((obj = slab_take(cache)) == NULL &&
+	    (obj = slab_new(cache)) == NULL)
+		return NULL;
+	SLAB_COUNT(cache, n_allocs);
+	return obj;
+}
+
+/**
+ * Return an object to a slab cache. Objects may be freed by a thread other
+ * than the one that allocated them. If cache is NULL the object is assumed
+ * to have been allocated from the heap and is freed.
+ *
+ * @param cache	The slab cache the object was allocated from
+ * @param obj	The object to free
+ */
+void
+slab_free(SLAB_CACHE *cache, void *obj)
+{
+SLAB_THREAD	*local;
+
+	if (obj == NULL)
+		return;
+	if (cache == NULL)
+	{
+		free(obj);
+		return;
+	}
+	local = &thread_lists[cache->id];
+	SLAB_NEXT(obj) = local->free;
+	local->free = obj;
+	local->count++;
+	SLAB_COUNT(cache, n_frees);
+
+	if (local->count > SLAB_THREAD_MAX)
+		slab_flush(cache, local);
+}
+
+/**
+ * Sum up the usage statistics of the threads of a slab cache
+ *
+ * @param cache	The slab cache
+ * @param total	The statistics to fill in
+ */
+void
+slab_cache_stats(SLAB_CACHE *cache, SLAB_STATS *total)
+{
+int	i;
+
+	memset(total, 0, sizeof(SLAB_STATS));
+	for (i = 0; i <= cache->n_stats; i++)
+	{
+		total->n_allocs += cache->stats[i].n_allocs;
+		total->n_frees += cache->stats[i].n_frees;
+		total->n_misses += cache->stats[i].n_misses;
+	}
+}
+
+/**
+ * Print the usage statistics of all the slab caches to a DCB
+ *
+ * @param dcb	The DCB to print to
+ */
+void
+dprintAllSlabCaches(DCB *dcb)
+{
+SLAB_CACHE	*cache;
+SLAB_STATS	total;
+
+	dcb_printf(dcb, "%-24s | %6s | %10s | %10s | %8s | %8s\n",
+		"Cache", "Size", "Allocs", "Heap", "In use", "Shared");
+	dcb_printf(dcb, "-------------------------------------------------------------------------------\n");
+	spinlock_acquire(&slab_spin);
+	for (cache = allCaches; cache; cache = cache->next)
+	{
+		slab_cache_stats(cache, &total);
+		dcb_printf(dcb, "%-24s | %6d | %10d | %10d | %8d | %8d\n",
+			cache->name,
+			(int)cache->size,
+			total.n_allocs,
+			total.n_misses,
+			total.n_allocs - total.n_frees,
+			cache->n_shared);
+	}
+	spinlock_release(&slab_spin);
+}
@@ -28,9 +28,51 @@
  * @endverbatim
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
 #include <spinlock.h>
 #include <atomic.h>
 
+#if defined(__i386__) || defined(__x86_64__)
+#define	spinlock_pause()	__asm__ __volatile__("pause" ::: "memory")
+#else
+#define	spinlock_pause()	__asm__ __volatile__("" ::: "memory")
+#endif
+
+/**
+ * The lock classes, a list that is only ever prepended to so that it can be
+ * walked without the lock
+ */
+static	LOCK_PROFILE	*profiles = NULL;
+static	SPINLOCK	profiles_lock = SPINLOCK_INIT;
+
+/**
+ * The acquisitions of named locks made by the thread since the last sample,
+ * and the lock the thread holds for the sample that is being timed. The
+ * profile is kept with it, the lock itself may be freed while it is held.
+ * A sample that is still pending after SPINLOCK_STALE further sample points
+ * is dropped, so that a lock that is never released does not stop the
+ * sampling on the thread.
+ */
+#define	SPINLOCK_STALE	16
+
+static	__thread int		sample_count = 0;
+static	__thread SPINLOCK	*sampled_lock = NULL;
+static	__thread LOCK_PROFILE	*sampled_profile = NULL;
+static	__thread long		sampled_start = 0;
+static	__thread int		sampled_age = 0;
+
+static long
+spinlock_nsecs()
+{
+struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
 /**
  * Initialise a spinlock.
  *
@@ -44,6 +86,141 @@ spinlock_init(SPINLOCK *lock)
 	lock->spins = 0;
 	lock->acquired = 0;
 #endif
+	lock->name = NULL;
+	lock->profile = NULL;
+}
+
+/**
+ * Initialise a spinlock that is profiled as part of a class of locks.
+ * The name is not copied, it is usually a string constant.
+ *
+ * @param lock The spinlock to initialise.
+ * @param name The name of the lock class
+ */
+void
+spinlock_init_named(SPINLOCK *lock, const char *name)
+{
+	spinlock_init(lock);
+	lock->name = name;
+}
+
+/**
+ * Find the profile of a lock class, creating it if this is the first lock
+ * of the class.
+ *
+ * @param name	The name of the lock class
+ * @return	The profile or NULL if out of memory
+ */
+LOCK_PROFILE *
+spinlock_profile(const char *name)
+{
+LOCK_PROFILE	*ptr;
+
+	spinlock_acquire(&profiles_lock);
+	for (ptr = profiles; ptr; ptr = ptr->next)
+	{
+		if (ptr->name == name || strcmp(ptr->name, name) == 0)
+			break;
+	}
+	if (ptr == NULL && (ptr = calloc(1, sizeof(LOCK_PROFILE))) != NULL)
+	{
+		ptr->name = name;
+		ptr->next = profiles;
+		__sync_synchronize();
+		profiles = ptr;
+	}
+	spinlock_release(&profiles_lock);
+	return ptr;
+}
+
+/**
+ * Return the first of the lock classes, the rest follow via the next link
+ */
+LOCK_PROFILE *
+spinlock_profiles()
+{
+	return profiles;
+}
+
+/**
+ * Return the profile of a named lock, it is looked up when the lock is first
+ * profiled. Threads racing to look it up store the same pointer.
+ */
+static LOCK_PROFILE *
+spinlock_get_profile(SPINLOCK *lock)
+{
+	if (lock->profile == NULL)
+		lock->profile = spinlock_profile(lock->name);
+	return lock->profile;
+}
+
+/**
+ * Sample an acquisition of a named lock, every SPINLOCK_SAMPLE acquisition
+ * of the thread is counted and timed until the lock is released. Only one
+ * hold is timed at a time, so nested locks do not disturb each other.
+ */
+static void
+spinlock_sample(SPINLOCK *lock)
+{
+LOCK_PROFILE	*profile;
+
+	if (++sample_count < SPINLOCK_SAMPLE)
+		return;
+	sample_count = 0;
+	if (sampled_lock != NULL && ++sampled_age < SPINLOCK_STALE)
+		return;
+	sampled_lock = NULL;
+	if ((profile = spinlock_get_profile(lock)) == NULL)
+		return;
+	__sync_fetch_and_add(&profile->n_sampled, 1);
+	sampled_lock = lock;
+	sampled_profile = profile;
+	sampled_age = 0;
+	sampled_start = spinlock_nsecs();
+}
+
+/**
+ * Wait for a spinlock that was found locked. The lock is only written when
+ * it looks free, and between the reads the thread backs off exponentially.
+ *
+ * @param lock The spinlock to acquire
+ */
+static void
+spinlock_wait(SPINLOCK *lock)
+{
+LOCK_PROFILE	*profile;
+long		start = 0, wait;
+int		backoff = 1, i;
+
+	if (lock->name)
+		start = spinlock_nsecs();
+	for (;;)
+	{
+		while (*(volatile int *)&lock->lock != 0)
+		{
+			for (i = 0; i < backoff; i++)
+				spinlock_pause();
+			if (backoff < SPINLOCK_MAX_BACKOFF)
+				backoff <<= 1;
+			else
+				sched_yield();
+#ifdef DEBUG
+			atomic_add(&(lock->spins), 1);
+#endif
+		}
+		if (atomic_add(&(lock->lock), 1) == 0)
+			break;
+		atomic_add(&(lock->lock), -1);
+	}
+
+	if (lock->name && (profile = spinlock_get_profile(lock)) != NULL)
+	{
+		wait = spinlock_nsecs() - start;
+		__sync_fetch_and_add(&profile->n_contended, 1);
+		__sync_fetch_and_add(&profile->wait_time, wait);
+		if (wait > profile->wait_max)
+			profile->wait_max = wait;
+	}
 }
 
 /**
@@ -54,17 +231,17 @@ spinlock_init(SPINLOCK *lock)
 void
 spinlock_acquire(SPINLOCK *lock)
 {
-	while (atomic_add(&(lock->lock), 1) != 0)
+	if (atomic_add(&(lock->lock), 1) != 0)
 	{
 		atomic_add(&(lock->lock), -1);
-#ifdef DEBUG
-		atomic_add(&(lock->spins), 1);
-#endif
+		spinlock_wait(lock);
 	}
 #ifdef DEBUG
 	lock->acquired++;
 	lock->owner = THREAD_SHELF();
 #endif
+	if (lock->name)
+		spinlock_sample(lock);
 }
 
 /**
@@ -85,6 +262,8 @@ spinlock_acquire_nowait(SPINLOCK *lock)
 	lock->acquired++;
 	lock->owner = THREAD_SHELF();
 #endif
+	if (lock->name)
+		spinlock_sample(lock);
 	return TRUE;
 }
 
@@ -96,5 +275,15 @@ spinlock_acquire_nowait(SPINLOCK *lock)
 void
 spinlock_release(SPINLOCK *lock)
 {
+long	hold;
+
+	if (sampled_lock == lock)
+	{
+		hold = spinlock_nsecs() - sampled_start;
+		sampled_lock = NULL;
+		__sync_fetch_and_add(&sampled_profile->hold_time, hold);
+		if (hold > sampled_profile->hold_max)
+			sampled_profile->hold_max = hold;
+	}
 	atomic_add(&(lock->lock), -1);
 }
@@ -0,0 +1,333 @@
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2014
+ */
+
+/**
+ * @file statistics.c  - Per thread statistics and histograms
+ *
+ * The statistics of the polling threads are held in an array with one cache
+ * line aligned entry per thread. Threads other than the polling threads use
+ * the entry of thread 0, the few updates they make are not exact.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <statistics.h>
+#include <poll.h>
+#include <dcb.h>
+
+static	THREAD_STATS	*threadStats = NULL;
+static	THREAD_STATS	defaultStats;
+static	int		n_stats_threads = 0;
+
+/**
+ * Allocate the statistics of the polling threads
+ *
+ * @param n_threads	The number of polling threads
+ */
+void
+stats_init(int n_threads)
+{
+	if (threadStats != NULL)
+		return;
+	if (n_threads < 1)
+		n_threads = 1;
+	n_stats_threads = n_threads;
+	if ((threadStats = (THREAD_STATS *)stats_alloc(sizeof(THREAD_STATS))) == NULL)
+	{
+		perror("stats_init");
+		exit(-1);
+	}
+}
+
+/**
+ * Return the number of threads the statistics are kept for
+ *
+ * @return The number of polling threads
+ */
+int
+stats_n_threads()
+{
+	return n_stats_threads > 0 ? n_stats_threads : 1;
+}
+
+/**
+ * Return the index of the per thread statistics of the calling thread
+ *
+ * @return Index in the range 0 to stats_n_threads() - 1
+ */
+int
+stats_thread_id()
+{
+	return poll_current_thread() % stats_n_threads();
+}
+
+/**
+ * Return the statistics of the calling thread
+ *
+ * @return The statistics to update
+ */
+THREAD_STATS *
+stats_thread()
+{
+	if (threadStats == NULL)
+		return &defaultStats;
+	return &threadStats[stats_thread_id()];
+}
+
+/**
+ * Allocate an array of per thread data, one zeroed entry of the given size
+ * for each polling thread. The array is aligned to a cache line, so entries
+ * of a type declared with STATS_ALIGNED do not share cache lines.
+ *
+ * @param size	The size of an entry
+ * @return	The array or NULL if no memory is available
+ */
+void *
+stats_alloc(size_t size)
+{
+void	*ptr;
+size_t	total = size * stats_n_threads();
+
+	if (posix_memalign(&ptr, STATS_CACHE_LINE, total) != 0)
+		return NULL;
+	memset(ptr, 0, total);
+	return ptr;
+}
+
+/**
+ * Sum up the statistics of all the polling threads
+ *
+ * @param total	The statistics to fill in
+ */
+void
+stats_sum(THREAD_STATS *total)
+{
+THREAD_STATS	*ts;
+int		i;
+
+	memset(total, 0, sizeof(THREAD_STATS));
+	if (threadStats == NULL)
+		return;
+	for (i = 0; i < n_stats_threads; i++)
+	{
+		ts = &threadStats[i];
+		total->n_read += ts->n_read;
+		total->n_write += ts->n_write;
+		total->n_error += ts->n_error;
+		total->n_hup += ts->n_hup;
+		total->n_accept += ts->n_accept;
+		total->n_polls += ts->n_polls;
+		total->n_empty += ts->n_empty;
+		total->n_blocked += ts->n_blocked;
+		total->n_wakes += ts->n_wakes;
+		total->wake_latency += ts->wake_latency;
+		if (ts->wake_max > total->wake_max)
+			total->wake_max = ts->wake_max;
+		total->n_coalesced += ts->n_coalesced;
+		total->n_read_stopped += ts->n_read_stopped;
+		total->n_syscalls += ts->n_syscalls;
+		total->n_posted += ts->n_posted;
+		total->n_delivered += ts->n_delivered;
+		total->n_mail_wakes += ts->n_mail_wakes;
+		total->n_deferred += ts->n_deferred;
+		total->n_write_coalesced += ts->n_write_coalesced;
+		total->n_flushed += ts->n_flushed;
+		total->n_accept_handoff += ts->n_accept_handoff;
+		hist_merge(&total->loop_time, &ts->loop_time);
+		hist_merge(&total->events, &ts->events);
+		hist_merge(&total->route_time, &ts->route_time);
+		hist_merge(&total->accept_backlog, &ts->accept_backlog);
+		hist_merge(&total->accept_batch, &ts->accept_batch);
+		hist_merge(&total->handshake_time, &ts->handshake_time);
+	}
+}
+
+/**
+ * Return a monotonic time stamp for measuring intervals
+ *
+ * @return Time in microseconds
+ */
+long
+stats_usecs()
+{
+struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/**
+ * Return the bucket of a histogram a value belongs to
+ *
+ * @param value	The value
+ * @return	The bucket index
+ */
+static int
+hist_bucket(long value)
+{
+int	e, idx;
+
+	if (value < HIST_SUB_BUCKETS)
+		return value < 0 ? 0 : (int)value;
+	e = 63 - __builtin_clzl((unsigned long)value);
+	idx = (e - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS
+		+ (int)((value >> (e - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+	return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+/**
+ * Return the largest value that belongs to a bucket of a histogram
+ *
+ * @param idx	The bucket index
+ * @return	The upper bound of the bucket
+ */
+static long
+hist_bucket_max(int idx)
+{
+int	e, sub;
+
+	if (idx < HIST_SUB_BUCKETS)
+		return idx;
+	e = idx / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+	sub = idx % HIST_SUB_BUCKETS;
+	return ((long)(HIST_SUB_BUCKETS + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+/**
+ * Add a value to a histogram
+ *
+ * @param hist	The histogram
+ * @param value	The value to add
+ */
+void
+hist_add(HISTOGRAM *hist, long value)
+{
+	hist->count[hist_bucket(value)]++;
+	hist->n++;
+	hist->sum += value;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+/**
+ * Add the values of one histogram to another
+ *
+ * @param dst	The histogram to add to
+ * @param src	The histogram to add
+ */
+void
+hist_merge(HISTOGRAM *dst, HISTOGRAM *src)
+{
+int	i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->count[i] += src->count[i];
+	dst->n += src->n;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/**
+ * Return a percentile of the values in a histogram
+ *
+ * @param hist		The histogram
+ * @param percent	The percentile, 0 to 100
+ * @return		The upper bound of the bucket the percentile falls in
+ */
+long
+hist_percentile(HISTOGRAM *hist, int percent)
+{
+long	target, seen = 0;
+long	value;
+int	i;
+
+	if (hist->n == 0)
+		return 0;
+	target = ((long)hist->n * percent + 99) / 100;
+	if (target < 1)
+		target = 1;
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		seen += hist->count[i];
+		if (seen >= target)
+			break;
+	}
+	value = hist_bucket_max(i < HIST_BUCKETS ? i : HIST_BUCKETS - 1);
+	return value < hist->max ? value : hist->max;
+}
+
+/**
+ * Print a summary of a histogram to a DCB
+ *
+ * @param dcb	The DCB to print to
+ * @param title	The name of the histogram
+ * @param hist	The histogram
+ */
+void
+dprintHistogram(DCB *dcb, char *title, HISTOGRAM *hist)
+{
+	dcb_printf(dcb, "%s\n", title);
+	if (hist->n == 0)
+	{
+		dcb_printf(dcb, "\tNo samples\n");
+		return;
+	}
+	dcb_printf(dcb, "\tSamples %d, mean %ld, p50 %ld, p90 %ld, p99 %ld, max %ld\n",
+		hist->n,
+		hist->sum / hist->n,
+		hist_percentile(hist, 50),
+		hist_percentile(hist, 90),
+		hist_percentile(hist, 99),
+		hist->max);
+}
+
+/**
+ * Print the statistics of each polling thread to a DCB
+ *
+ * @param dcb	The DCB to print to
+ */
+void
+dprintThreadStats(DCB *dcb)
+{
+THREAD_STATS	*ts;
+int		i;
+
+	if (threadStats == NULL)
+		return;
+	dcb_printf(dcb, "%-6s | %10s | %10s | %10s | %10s | %10s | %8s | %8s | %8s\n",
+		"Thread", "Polls", "Reads", "Writes", "Accepts", "Syscalls",
+		"Loop p99", "Ev. p99", "Route p99");
+	dcb_printf(dcb, "--------------------------------------------------------------------------------------------------------\n");
+	for (i = 0; i < n_stats_threads; i++)
+	{
+		ts = &threadStats[i];
+		dcb_printf(dcb, "%-6d | %10d | %10d | %10d | %10d | %10d | %8ld | %8ld | %8ld\n",
+			i,
+			ts->n_polls,
+			ts->n_read,
+			ts->n_write,
+			ts->n_accept,
+			ts->n_syscalls,
+			hist_percentile(&ts->loop_time, 99),
+			hist_percentile(&ts->events, 99),
+			hist_percentile(&ts->route_time, 99));
+	}
+	dcb_printf(dcb, "\nLoop and route times are in microseconds.\n");
+}
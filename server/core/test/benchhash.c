@@ -0,0 +1,369 @@
+/*
+ * Benchmark of the hashtables and the MySQL users table
+ *
+ * A table is filled with user@host keys and a number of threads then run a
+ * mix of operations on it for a fixed number of operations per thread. A
+ * read fetches a random key, a write deletes a random key and adds it back,
+ * which is what a users table update does, so the table keeps its size.
+ *
+ * The tables are the chained hashtable and the open addressing hashtable
+ * with string keys, and the MySQL users table, whose lookups go through
+ * mysql_users_fetch as the authentication does. The thread counts are the
+ * powers of two up to the number given and that number itself.
+ *
+ * One line is printed per table, mix and thread count:
+ *
+ *	table=<name> keys=<n> threads=<n> read_pct=<n> ops=<n> ops_per_sec=<n> p50_ns=<n> p90_ns=<n> p99_ns=<n> max_ns=<n>
+ *
+ * The latencies are of one in BENCH_SAMPLE operations, measured with the
+ * monotonic clock, so they include the cost of reading the clock.
+ *
+ * Usage: benchhash [threads] [keys] [ops per thread]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include <hashtable.h>
+#include <users.h>
+#include <dbusers.h>
+#include <statistics.h>
+
+#define BENCH_SAMPLE    8
+
+typedef enum {
+        BENCH_CHAINED,
+        BENCH_OPEN,
+        BENCH_USERS
+} bench_table_t;
+
+static char*    table_names[] = { "chained", "open", "mysql_users" };
+static int      read_pcts[] = { 100, 99, 90, 50 };
+
+/*
+ * The state shared by the threads of one run
+ */
+typedef struct {
+        bench_table_t    type;
+        HASHTABLE*       table;
+        USERS*           users;
+        char**           keys;
+        MYSQL_USER_HOST* uh_keys;
+        int              nkeys;
+        int              read_pct;
+        int              nops;
+        pthread_barrier_t barrier;
+} BENCH;
+
+/*
+ * The result of a thread
+ */
+typedef struct {
+        BENCH*          bench;
+        unsigned int    seed;
+        HISTOGRAM       latency;
+} BENCH_THREAD;
+
+static int
+str_hfun(
+        void* key)
+{
+        unsigned int h = 2166136261u;
+        char*        p;
+
+        for (p = (char *)key; *p; p++)
+        {
+                h = (h ^ (unsigned char)*p) * 16777619;
+        }
+        return (int)h;
+}
+
+static int
+str_keyfun(
+        void* key,
+        char* buf,
+        int   len)
+{
+        int klen = strlen((char *)key);
+
+        if (klen <= len)
+        {
+                memcpy(buf, key, klen);
+        }
+        return klen;
+}
+
+static long
+bench_nsecs()
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static unsigned int
+bench_random(
+        unsigned int* seed)
+{
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 17;
+        *seed ^= *seed << 5;
+        return *seed;
+}
+
+static void
+bench_read(
+        BENCH* bench,
+        int    k)
+{
+        if (bench->type == BENCH_USERS)
+        {
+                mysql_users_fetch(bench->users, &bench->uh_keys[k]);
+        }
+        else
+        {
+                hashtable_fetch(bench->table, bench->keys[k]);
+        }
+}
+
+static void
+bench_write(
+        BENCH* bench,
+        int    k)
+{
+        if (bench->type == BENCH_USERS)
+        {
+                hashtable_delete(bench->users->data, &bench->uh_keys[k]);
+                mysql_users_add(bench->users, &bench->uh_keys[k], "*AAB");
+        }
+        else
+        {
+                hashtable_delete(bench->table, bench->keys[k]);
+                hashtable_add(bench->table, bench->keys[k], bench->keys[k]);
+        }
+}
+
+static void*
+bench_thread(
+        void* arg)
+{
+        BENCH_THREAD* thread = (BENCH_THREAD *)arg;
+        BENCH*        bench = thread->bench;
+        unsigned int  r;
+        long          start = 0;
+        int           i;
+
+        pthread_barrier_wait(&bench->barrier);
+
+        for (i = 0; i < bench->nops; i++)
+        {
+                r = bench_random(&thread->seed);
+
+                if (i % BENCH_SAMPLE == 0)
+                {
+                        start = bench_nsecs();
+                }
+                if ((int)(r % 100) < bench->read_pct)
+                {
+                        bench_read(bench, (r >> 8) % bench->nkeys);
+                }
+                else
+                {
+                        bench_write(bench, (r >> 8) % bench->nkeys);
+                }
+                if (i % BENCH_SAMPLE == 0)
+                {
+                        hist_add(&thread->latency, bench_nsecs() - start);
+                }
+        }
+        return NULL;
+}
+
+static int
+bench_fill(
+        BENCH* bench)
+{
+        int i;
+
+        switch (bench->type) {
+        case BENCH_USERS:
+                if ((bench->users = mysql_users_alloc()) == NULL)
+                {
+                        return 1;
+                }
+                for (i = 0; i < bench->nkeys; i++)
+                {
+                        mysql_users_add(bench->users, &bench->uh_keys[i], "*AAB");
+                }
+                return 0;
+
+        case BENCH_OPEN:
+                bench->table = hashtable_alloc_open(USERS_HASHTABLE_DEFAULT_SIZE,
+                                                    str_hfun,
+                                                    strcmp,
+                                                    str_keyfun);
+                break;
+
+        default:
+                bench->table = hashtable_alloc(USERS_HASHTABLE_DEFAULT_SIZE,
+                                               str_hfun,
+                                               strcmp);
+                break;
+        }
+        if (bench->table == NULL)
+        {
+                return 1;
+        }
+        hashtable_memory_fns(bench->table,
+                             (HASHMEMORYFN)strdup,
+                             (HASHMEMORYFN)strdup,
+                             (HASHMEMORYFN)free,
+                             (HASHMEMORYFN)free);
+        for (i = 0; i < bench->nkeys; i++)
+        {
+                hashtable_add(bench->table, bench->keys[i], bench->keys[i]);
+        }
+        return 0;
+}
+
+static int
+bench_run(
+        BENCH* bench,
+        int    nthreads)
+{
+        pthread_t*    tids;
+        BENCH_THREAD* threads;
+        HISTOGRAM     latency;
+        long          start, elapsed;
+        int           i;
+
+        if (bench_fill(bench) != 0)
+        {
+                fprintf(stderr, "benchhash : failed to allocate the table\n");
+                return 1;
+        }
+        tids = calloc(nthreads, sizeof(pthread_t));
+        threads = calloc(nthreads, sizeof(BENCH_THREAD));
+        pthread_barrier_init(&bench->barrier, NULL, nthreads + 1);
+
+        for (i = 0; i < nthreads; i++)
+        {
+                threads[i].bench = bench;
+                threads[i].seed = 2463534242u + i * 7919;
+                pthread_create(&tids[i], NULL, bench_thread, &threads[i]);
+        }
+        pthread_barrier_wait(&bench->barrier);
+        start = bench_nsecs();
+
+        memset(&latency, 0, sizeof(latency));
+        for (i = 0; i < nthreads; i++)
+        {
+                pthread_join(tids[i], NULL);
+                hist_merge(&latency, &threads[i].latency);
+        }
+        elapsed = bench_nsecs() - start;
+
+        printf("table=%s keys=%d threads=%d read_pct=%d ops=%ld "
+               "ops_per_sec=%.0f p50_ns=%ld p90_ns=%ld p99_ns=%ld max_ns=%ld\n",
+               table_names[bench->type],
+               bench->nkeys,
+               nthreads,
+               bench->read_pct,
+               (long)bench->nops * nthreads,
+               (double)bench->nops * nthreads * 1000000000.0 / elapsed,
+               hist_percentile(&latency, 50),
+               hist_percentile(&latency, 90),
+               hist_percentile(&latency, 99),
+               latency.max);
+        fflush(stdout);
+
+        pthread_barrier_destroy(&bench->barrier);
+        free(threads);
+        free(tids);
+        if (bench->users)
+        {
+                users_free(bench->users);
+                bench->users = NULL;
+        }
+        if (bench->table)
+        {
+                hashtable_free(bench->table);
+                bench->table = NULL;
+        }
+        return 0;
+}
+
+int main(int argc, char** argv)
+{
+        int                maxthreads;
+        int                nkeys = argc > 2 ? atoi(argv[2]) : 100000;
+        int                nops = argc > 3 ? atoi(argv[3]) : 1000000;
+        BENCH              bench;
+        struct sockaddr_in addr;
+        int                type, mix, nthreads, i;
+        int                rc = 0;
+
+        maxthreads = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+        if (maxthreads < 1 || nkeys < 1 || nops < 1)
+        {
+                fprintf(stderr, "Usage: benchhash [threads] [keys] [ops per thread]\n");
+                return 1;
+        }
+
+        /* The keys of a users table loaded from mysql.user */
+        memset(&bench, 0, sizeof(bench));
+        bench.nkeys = nkeys;
+        bench.nops = nops;
+        bench.keys = calloc(nkeys, sizeof(char *));
+        bench.uh_keys = calloc(nkeys, sizeof(MYSQL_USER_HOST));
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        for (i = 0; i < nkeys; i++)
+        {
+                bench.keys[i] = malloc(MYSQL_USER_MAXLEN + INET_ADDRSTRLEN + 2);
+                addr.sin_addr.s_addr = htonl(0x0a000000 | (i & 0xffffff));
+                bench.uh_keys[i].user = malloc(MYSQL_USER_MAXLEN);
+                sprintf(bench.uh_keys[i].user, "app_user_%d", i / 4);
+                memcpy(&bench.uh_keys[i].ipv4, &addr, sizeof(addr));
+                sprintf(bench.keys[i], "%s@", bench.uh_keys[i].user);
+                inet_ntop(AF_INET,
+                          &addr.sin_addr,
+                          bench.keys[i] + strlen(bench.keys[i]),
+                          INET_ADDRSTRLEN);
+        }
+
+        for (type = BENCH_CHAINED; type <= BENCH_USERS; type++)
+        {
+                bench.type = type;
+                for (mix = 0; mix < (int)(sizeof(read_pcts) / sizeof(int)); mix++)
+                {
+                        bench.read_pct = read_pcts[mix];
+                        for (nthreads = 1; ; nthreads *= 2)
+                        {
+                                if (nthreads > maxthreads)
+                                {
+                                        nthreads = maxthreads;
+                                }
+                                rc |= bench_run(&bench, nthreads);
+                                if (nthreads == maxthreads)
+                                {
+                                        break;
+                                }
+                        }
+                }
+        }
+
+        for (i = 0; i < nkeys; i++)
+        {
+                free(bench.keys[i]);
+                free(bench.uh_keys[i].user);
+        }
+        free(bench.keys);
+        free(bench.uh_keys);
+        return rc;
+}
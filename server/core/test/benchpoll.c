@@ -0,0 +1,146 @@
+/*
+ * Benchmark of the poll engines
+ *
+ * A number of socket pairs are added to an event set of each engine and a
+ * byte is passed back and forth over every pair in turn. For each round
+ * trip the benchmark writes to one end, waits for the event and reads the
+ * byte, which is the same work a polling thread does for a query.
+ *
+ * One line is printed per engine:
+ *
+ *	engine=<name> pairs=<n> rounds=<n> syscalls_per_event=<x> engine_syscalls_per_event=<x> io_syscalls_per_event=<x> p50_us=<n> p99_us=<n> max_us=<n>
+ *
+ * The system calls are those of the engine and the write and read of the
+ * socket I/O, syscalls_per_event is their sum.
+ *
+ * or engine=<name> available=0 if the kernel does not support the engine.
+ *
+ * Usage: benchpoll [pairs] [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../../include/poll_engine.h"
+#include "../../include/statistics.h"
+
+struct dcb;
+
+/*
+ * The statistics module is linked without the rest of the gateway
+ */
+int
+poll_current_thread()
+{
+        return 0;
+}
+
+void
+dcb_printf(struct dcb *dcb, const char *fmt, ...)
+{
+}
+
+static int
+bench_engine(
+        POLL_ENGINE* engine,
+        int          npairs,
+        int          nrounds)
+{
+        POLL_SET*          set;
+        struct epoll_event events[16];
+        int                (*pairs)[2];
+        HISTOGRAM          latency;
+        int                syscalls;
+        int                io_syscalls = 0;
+        int                i, j, n, nevents = 0;
+        long               start;
+        char               c = 'x';
+
+        if ((set = engine->create(16)) == NULL)
+        {
+                printf("engine=%s available=0\n", engine->name);
+                return 0;
+        }
+        pairs = calloc(npairs, sizeof(*pairs));
+
+        for (i = 0; i < npairs; i++)
+        {
+                if (socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[i]) == -1 ||
+                    engine->add(set,
+                                pairs[i][0],
+                                EPOLLIN | EPOLLOUT | EPOLLET,
+                                &pairs[i]) == -1)
+                {
+                        perror("benchpoll");
+                        return 1;
+                }
+        }
+        /* Consume the initial write readiness of every socket */
+        while (engine->wait(set, events, 16, 0) > 0)
+                ;
+        memset(&latency, 0, sizeof(latency));
+        syscalls = stats_thread()->n_syscalls;
+
+        for (j = 0; j < nrounds; j++)
+        {
+                for (i = 0; i < npairs; i++)
+                {
+                        start = stats_usecs();
+                        write(pairs[i][1], &c, 1);
+                        io_syscalls++;
+
+                        do {
+                                n = engine->wait(set, events, 16, 1000);
+                        } while (n == 0);
+
+                        if (n < 0 || events[0].data.ptr != &pairs[i])
+                        {
+                                fprintf(stderr, "benchpoll : engine %s "
+                                        "returned an unexpected event\n",
+                                        engine->name);
+                                return 1;
+                        }
+                        read(pairs[i][0], &c, 1);
+                        io_syscalls++;
+                        hist_add(&latency, stats_usecs() - start);
+                        nevents += n;
+                }
+        }
+        syscalls = stats_thread()->n_syscalls - syscalls;
+
+        printf("engine=%s pairs=%d rounds=%d syscalls_per_event=%.2f "
+               "engine_syscalls_per_event=%.2f io_syscalls_per_event=%.2f "
+               "p50_us=%ld p99_us=%ld max_us=%ld\n",
+               engine->name,
+               npairs,
+               nrounds,
+               (double)(syscalls + io_syscalls) / nevents,
+               (double)syscalls / nevents,
+               (double)io_syscalls / nevents,
+               hist_percentile(&latency, 50),
+               hist_percentile(&latency, 99),
+               latency.max);
+
+        for (i = 0; i < npairs; i++)
+        {
+                engine->remove(set, pairs[i][0]);
+                close(pairs[i][0]);
+                close(pairs[i][1]);
+        }
+        free(pairs);
+        engine->destroy(set);
+        return 0;
+}
+
+int main(int argc, char** argv)
+{
+        int npairs = argc > 1 ? atoi(argv[1]) : 64;
+        int nrounds = argc > 2 ? atoi(argv[2]) : 1000;
+        int rc;
+
+        rc = bench_engine(&poll_engine_epoll, npairs, nrounds);
+        rc |= bench_engine(&poll_engine_io_uring, npairs, nrounds);
+        return rc;
+}
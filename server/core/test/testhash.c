@@ -1,11 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "../../include/hashtable.h"
 
 static int hfun(void* key);
 static int cmpfun (void *, void *);
+static int keyfun(void *, char *, int);
 
 static int hfun(
         void* key)
@@ -28,9 +32,22 @@ static int cmpfun(
 }
 
 
+static int keyfun(
+        void* key,
+        char* buf,
+        int   len)
+{
+        if (len >= (int)sizeof(int)) {
+            memcpy(buf, key, sizeof(int));
+        }
+        return sizeof(int);
+}
+
+
 static bool do_hashtest(
-        int argelems,
-        int argsize)
+        int  argelems,
+        int  argsize,
+        bool open)
 {
         bool       succp = true;
         HASHTABLE* h;
@@ -41,14 +58,19 @@ static bool do_hashtest(
         int        longest;
         
         ss_dfprintf(stderr,
-                    "testhash : creating hash table of size %d, including %d "
+                    "testhash : creating %s hash table of size %d, including %d "
                     "elements in total.",
+                    open ? "open" : "chained",
                     argsize,
                     argelems); 
         
         val_arr = (int *)malloc(sizeof(void *)*argelems);
         
-        h = hashtable_alloc(argsize, hfun, cmpfun);
+        if (open) {
+            h = hashtable_alloc_open(argsize, hfun, cmpfun, keyfun);
+        } else {
+            h = hashtable_alloc(argsize, hfun, cmpfun);
+        }
 
         ss_dfprintf(stderr, "\t..done\nAdd %d elements to hash table.", argelems);
         
@@ -63,11 +85,26 @@ static bool do_hashtest(
 
         ss_dfprintf(stderr, "\t..done\nValidate read values.");
         
-        ss_info_dassert(hsize == argsize, "Invalid hash size");
+        ss_info_dassert(hsize >= argsize, "Invalid hash size");
         ss_info_dassert((nelems == argelems) || (nelems == 0 && argsize == 0),
                         "Invalid element count");
         ss_info_dassert(longest <= nelems, "Too large longest list value");
 
+        ss_dfprintf(stderr, "\t\t..done\nFetch and delete the values while the table grows.");
+
+        for (i=0; i<nelems; i++) {
+            ss_info_dassert(hashtable_fetch(h, (void *)&val_arr[i]) == &val_arr[i],
+                            "Value not found");
+        }
+        for (i=0; i<nelems; i+=2) {
+            ss_info_dassert(hashtable_delete(h, (void *)&val_arr[i]) == 1,
+                            "Value not deleted");
+        }
+        for (i=0; i<nelems; i++) {
+            ss_info_dassert((hashtable_fetch(h, (void *)&val_arr[i]) == NULL) == (i % 2 == 0),
+                            "Invalid value after delete");
+        }
+
         ss_dfprintf(stderr, "\t\t..done\n\nTest completed successfully.\n\n");
         
         CHK_HASHTABLE(h);
@@ -77,10 +114,328 @@ return_succp:
         return succp;
 }
 
+#define MT_STABLE      1000    /*< Keys that stay in the table */
+#define MT_CHURN       20000   /*< Keys added and deleted while reading */
+#define MT_ROUNDS      5
+#define MT_READERS     2
+
+typedef struct {
+        HASHTABLE*    h;
+        int*          keys;
+        volatile int  done;
+        int           misses;
+} MT_TEST;
+
+static void* mt_reader(
+        void* arg)
+{
+        MT_TEST* t = (MT_TEST *)arg;
+        int      i;
+
+        while (!t->done) {
+            for (i=0; i<MT_STABLE; i++) {
+                if (hashtable_fetch(t->h, (void *)&t->keys[i]) != &t->keys[i]) {
+                    __sync_fetch_and_add(&t->misses, 1);
+                }
+            }
+        }
+        return NULL;
+}
+
+/**
+ * Fetch a set of keys that stay in the table from several threads while
+ * another thread adds and deletes enough keys to make the table grow or
+ * rebuild several times. Every fetch must find its key, also while the
+ * entries are being moved to the new chains or slots.
+ */
+static bool do_hashtest_mt(
+        bool open)
+{
+        MT_TEST    t;
+        pthread_t  readers[MT_READERS];
+        int        i, r;
+
+        ss_dfprintf(stderr,
+                    "testhash : fetching from %s hash table while adding.",
+                    open ? "open" : "chained");
+
+        t.keys = (int *)malloc(sizeof(int) * (MT_STABLE + MT_CHURN));
+        t.h = open ? hashtable_alloc_open(7, hfun, cmpfun, keyfun)
+                   : hashtable_alloc(7, hfun, cmpfun);
+        t.done = 0;
+        t.misses = 0;
+        for (i=0; i<MT_STABLE + MT_CHURN; i++) {
+            t.keys[i] = i;
+        }
+        for (i=0; i<MT_STABLE; i++) {
+            hashtable_add(t.h, (void *)&t.keys[i], (void *)&t.keys[i]);
+        }
+        for (i=0; i<MT_READERS; i++) {
+            pthread_create(&readers[i], NULL, mt_reader, &t);
+        }
+        for (r=0; r<MT_ROUNDS; r++) {
+            for (i=MT_STABLE; i<MT_STABLE + MT_CHURN; i++) {
+                hashtable_add(t.h, (void *)&t.keys[i], (void *)&t.keys[i]);
+            }
+            for (i=MT_STABLE; i<MT_STABLE + MT_CHURN; i++) {
+                hashtable_delete(t.h, (void *)&t.keys[i]);
+            }
+        }
+        t.done = 1;
+        for (i=0; i<MT_READERS; i++) {
+            pthread_join(readers[i], NULL);
+        }
+        hashtable_free(t.h);
+        free(t.keys);
+
+        ss_dfprintf(stderr, "\t..done, %d misses.\n", t.misses);
+        return t.misses == 0;
+}
+
+static int str_hfun(
+        void* key)
+{
+        unsigned int h = 2166136261u;
+        char*        p;
+
+        for (p = (char *)key; *p; p++) {
+            h = (h ^ (unsigned char)*p) * 16777619;
+        }
+        return (int)h;
+}
+
+
+static int str_keyfun(
+        void* key,
+        char* buf,
+        int   len)
+{
+        int klen = strlen((char *)key);
+
+        if (klen <= len) {
+            memcpy(buf, key, klen);
+        }
+        return klen;
+}
+
+
+static long bench_nsecs(
+        struct timespec* start)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec - start->tv_sec) * 1000000000L +
+                now.tv_nsec - start->tv_nsec;
+}
+
+/** 
+ * @node Benchmark the chained and the open addressing tables side by side
+ * with user@host keys, as the MySQL users table holds them.
+ *
+ * Parameters:
+ * @param nkeys - <usage>
+ *          Number of keys added to the tables
+ *
+ * @param nfetches - <usage>
+ *          Number of lookups of existing keys, as many lookups miss
+ *
+ * @return void
+ */
+static void do_hashbench(
+        int nkeys,
+        int nfetches)
+{
+        HASHTABLE*      h;
+        char**          keys;
+        char            miss[64];
+        struct timespec start;
+        long            add_ns, hit_ns, miss_ns;
+        int             open;
+        int             i;
+        int             found;
+
+        keys = (char **)malloc(nkeys * sizeof(char *));
+        for (i=0; i<nkeys; i++) {
+            keys[i] = (char *)malloc(64);
+            sprintf(keys[i], "user%d@192.168.%d.%d", i, (i >> 8) & 0xff, i & 0xff);
+        }
+        printf("%-8s %10s %12s %12s %12s\n",
+               "table", "keys", "add ns/op", "fetch ns/op", "miss ns/op");
+
+        for (open=0; open<2; open++) {
+            if (open) {
+                h = hashtable_alloc_open(52, str_hfun, strcmp, str_keyfun);
+            } else {
+                h = hashtable_alloc(52, str_hfun, strcmp);
+            }
+            hashtable_memory_fns(h,
+                                 (HASHMEMORYFN)strdup,
+                                 (HASHMEMORYFN)strdup,
+                                 (HASHMEMORYFN)free,
+                                 (HASHMEMORYFN)free);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (i=0; i<nkeys; i++) {
+                hashtable_add(h, keys[i], keys[i]);
+            }
+            add_ns = bench_nsecs(&start);
+
+            found = 0;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (i=0; i<nfetches; i++) {
+                found += hashtable_fetch(h, keys[(int)(((long)i * 7919) % nkeys)]) != NULL;
+            }
+            hit_ns = bench_nsecs(&start);
+            ss_info_dassert(found == nfetches, "Key not found");
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (i=0; i<nfetches; i++) {
+                sprintf(miss, "nouser%d@10.0.0.1", i % nkeys);
+                found += hashtable_fetch(h, miss) != NULL;
+            }
+            miss_ns = bench_nsecs(&start);
+            ss_info_dassert(found == nfetches, "Missing key found");
+
+            printf("%-8s %10d %12ld %12ld %12ld\n",
+                   open ? "open" : "chained",
+                   nkeys,
+                   add_ns / nkeys,
+                   hit_ns / nfetches,
+                   miss_ns / nfetches);
+            hashtable_stats(h);
+            hashtable_free(h);
+        }
+
+        for (i=0; i<nkeys; i++) {
+            free(keys[i]);
+        }
+        free(keys);
+}
+
+#define WAIT_SLOW_KEY  -1         /*< Key whose comparison stalls a reader */
+#define WAIT_SLOW_US   500000     /*< How long the reader stalls */
+#define WAIT_MAX_NS    100000000L /*< Longest the table lock may be held */
+
+static volatile int wait_slow = 0;
+
+/**
+ * Compare like cmpfun, but stall the first comparison of the slow key once
+ * wait_slow is set, which keeps the calling reader inside the table.
+ */
+static int wait_cmpfun(
+        void* v1,
+        void* v2)
+{
+        if (*(int *)v1 == WAIT_SLOW_KEY && wait_slow &&
+            __sync_lock_test_and_set(&wait_slow, 0)) {
+            usleep(WAIT_SLOW_US);
+        }
+        return cmpfun(v1, v2);
+}
+
+/**
+ * Key function that does not keep the slow key inline, so that looking it
+ * up in an open table calls the comparison function.
+ */
+static int wait_keyfun(
+        void* key,
+        char* buf,
+        int   len)
+{
+        if (*(int *)key == WAIT_SLOW_KEY) {
+            return HASHTABLE_INLINE_KEY + 1;
+        }
+        return keyfun(key, buf, len);
+}
+
+typedef struct {
+        HASHTABLE*    h;
+        int*          keys;
+        int           nkeys;
+} WAIT_TEST;
+
+static void* wait_reader(
+        void* arg)
+{
+        WAIT_TEST* t = (WAIT_TEST *)arg;
+
+        hashtable_fetch(t->h, (void *)&t->keys[0]);
+        return NULL;
+}
+
+static void* wait_writer(
+        void* arg)
+{
+        WAIT_TEST* t = (WAIT_TEST *)arg;
+        int        resizes = t->h->n_resizes;
+        int        i;
+
+        for (i=1; i<t->nkeys && t->h->n_resizes == resizes; i++) {
+            hashtable_add(t->h, (void *)&t->keys[i], (void *)&t->keys[i]);
+        }
+        return NULL;
+}
+
+/**
+ * Resize a table while a reader is stalled inside it. The writer that
+ * resizes has to wait for the reader before it frees the old chains or
+ * slots, but it must not hold the table lock meanwhile, so the lock is
+ * taken from here while the writer waits.
+ */
+static bool do_hashtest_wait(
+        bool open)
+{
+        WAIT_TEST       t;
+        pthread_t       reader, writer;
+        struct timespec start;
+        long            held;
+        int             resizes, i;
+
+        ss_dfprintf(stderr,
+                    "testhash : resizing %s hash table during a slow fetch.",
+                    open ? "open" : "chained");
+
+        t.nkeys = 10000;
+        t.keys = (int *)malloc(sizeof(int) * t.nkeys);
+        t.h = open ? hashtable_alloc_open(7, hfun, wait_cmpfun, wait_keyfun)
+                   : hashtable_alloc(7, hfun, wait_cmpfun);
+        t.keys[0] = WAIT_SLOW_KEY;
+        for (i=1; i<t.nkeys; i++) {
+            t.keys[i] = i;
+        }
+        hashtable_add(t.h, (void *)&t.keys[0], (void *)&t.keys[0]);
+        resizes = t.h->n_resizes;
+
+        wait_slow = 1;
+        pthread_create(&reader, NULL, wait_reader, &t);
+        usleep(WAIT_SLOW_US / 10);
+        pthread_create(&writer, NULL, wait_writer, &t);
+        while (t.h->n_resizes == resizes) {
+            usleep(1000);
+        }
+        usleep(WAIT_SLOW_US / 10);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        spinlock_acquire(&t.h->spin);
+        spinlock_release(&t.h->spin);
+        held = bench_nsecs(&start);
+
+        pthread_join(writer, NULL);
+        pthread_join(reader, NULL);
+        hashtable_free(t.h);
+        free(t.keys);
+
+        ss_dfprintf(stderr, "\t..done, lock taken in %ld us.\n", held / 1000);
+        return held < WAIT_MAX_NS;
+}
+
 /** 
  * @node Simple test which creates hashtable and frees it. Size and number of entries
- * sre specified by user and passed as arguments.
+ * sre specified by user and passed as arguments. The test is run for the
+ * chained and the open addressing tables.
  *
+ * Run as testhash bench [keys] [fetches] to benchmark the two tables instead.
  *
  * @return 0 if succeed, 1 if failed.
  *
@@ -88,19 +443,32 @@ return_succp:
  * @details (write detailed description here)
  *
  */
-int main(void)
+int main(
+        int   argc,
+        char* argv[])
 {
         int rc = 1;
+        int open;
 
-        if (!do_hashtest(0, 1))         goto return_rc;
-        if (!do_hashtest(10, 1))        goto return_rc;
-        if (!do_hashtest(1000, 10))     goto return_rc;
-        if (!do_hashtest(10, 0))        goto return_rc;
-        if (!do_hashtest(1500, 17))     goto return_rc;
-        if (!do_hashtest(1, 1))         goto return_rc;
-        if (!do_hashtest(10000, 133))   goto return_rc;
-        if (!do_hashtest(1000, 1000))   goto return_rc;
-        if (!do_hashtest(1000, 100000)) goto return_rc;
+        if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+            do_hashbench(argc > 2 ? atoi(argv[2]) : 100000,
+                         argc > 3 ? atoi(argv[3]) : 1000000);
+            return 0;
+        }
+
+        for (open=0; open<2; open++) {
+            if (!do_hashtest(0, 1, open))         goto return_rc;
+            if (!do_hashtest(10, 1, open))        goto return_rc;
+            if (!do_hashtest(1000, 10, open))     goto return_rc;
+            if (!do_hashtest(10, 0, open))        goto return_rc;
+            if (!do_hashtest(1500, 17, open))     goto return_rc;
+            if (!do_hashtest(1, 1, open))         goto return_rc;
+            if (!do_hashtest(10000, 133, open))   goto return_rc;
+            if (!do_hashtest(1000, 1000, open))   goto return_rc;
+            if (!do_hashtest(1000, 100000, open)) goto return_rc;
+            if (!do_hashtest_mt(open))            goto return_rc;
+            if (!do_hashtest_wait(open))          goto return_rc;
+        }
         
         rc = 0;
 return_rc:
@@ -0,0 +1,394 @@
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2014
+ */
+
+/**
+ * @file timer.c  - Hierarchical timer wheels of the polling threads
+ *
+ * Each wheel is run by its polling thread after every batch of events and
+ * is protected by a spinlock of its own, which the other threads only take
+ * to arm or cancel a timer on that wheel. A wheel with no armed timers costs
+ * one clock read and one test per run.
+ *
+ * Timers armed from threads that are not polling threads use the wheel of
+ * polling thread 0 and may fire up to EPOLL_TIMEOUT late.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <timer.h>
+#include <statistics.h>
+#include <dcb.h>
+
+#define	TIMER_MASK	(TIMER_SLOTS - 1)
+#define	TIMER_RANGE	(1L << (TIMER_SLOT_BITS * TIMER_LEVELS))
+
+static	TIMER_WHEEL	*wheels = NULL;
+static	int		n_wheels = 0;
+
+/**
+ * Return the current time in ticks
+ */
+static long
+timer_now()
+{
+	return stats_usecs() / (1000 * TIMER_TICK);
+}
+
+/**
+ * Return the wheel of a polling thread
+ */
+static TIMER_WHEEL *
+timer_wheel(int thread_id)
+{
+	if (thread_id < 0 || thread_id >= n_wheels)
+		return &wheels[0];
+	return &wheels[thread_id];
+}
+
+/**
+ * Allocate the timer wheels, one for each polling thread. Must be called
+ * after stats_init.
+ */
+void
+timer_wheels_init()
+{
+long	now = timer_now();
+int	i;
+
+	if (wheels != NULL)
+		return;
+	if ((wheels = (TIMER_WHEEL *)stats_alloc(sizeof(TIMER_WHEEL))) == NULL)
+	{
+		perror("timer_wheels_init");
+		exit(-1);
+	}
+	n_wheels = stats_n_threads();
+	for (i = 0; i < n_wheels; i++)
+	{
+		spinlock_init_named(&wheels[i].lock, "timer wheel lock");
+		wheels[i].tick = now;
+	}
+}
+
+/**
+ * Initialise a timer. Must be called before the timer is first armed.
+ *
+ * @param timer	The timer
+ * @param func	The function called when the timer fires
+ * @param data	The argument passed to the function
+ */
+void
+timer_init(TIMER *timer, TIMER_FUNC func, void *data)
+{
+	timer->next = NULL;
+	timer->pprev = NULL;
+	timer->slot = NULL;
+	timer->wheel = NULL;
+	timer->func = func;
+	timer->data = data;
+}
+
+/**
+ * Put a timer into the slot its expiry time belongs to. Timers that have
+ * already expired go into the slot of the next tick.
+ *
+ * Must be called with the lock of the wheel held.
+ */
+static void
+timer_insert(TIMER_WHEEL *wheel, TIMER *timer)
+{
+long	delta = timer->expires - wheel->tick;
+int	level, slot;
+
+	if (delta < 0)
+	{
+		level = 0;
+		slot = wheel->tick & TIMER_MASK;
+	}
+	else
+	{
+		if (delta >= TIMER_RANGE)
+			timer->expires = wheel->tick + TIMER_RANGE - 1;
+		for (level = 0; level < TIMER_LEVELS - 1; level++)
+		{
+			if (delta < (1L << (TIMER_SLOT_BITS * (level + 1))))
+				break;
+		}
+		slot = (timer->expires >> (TIMER_SLOT_BITS * level)) & TIMER_MASK;
+	}
+	timer->slot = &wheel->slots[level][slot];
+	timer->pprev = timer->slot;
+	timer->next = *timer->slot;
+	if (timer->next)
+		timer->next->pprev = &timer->next;
+	*timer->slot = timer;
+	wheel->used[level] |= 1UL << slot;
+}
+
+/**
+ * Take a timer out of its slot.
+ *
+ * Must be called with the lock of the wheel held.
+ */
+static void
+timer_unlink(TIMER_WHEEL *wheel, TIMER *timer)
+{
+int	idx;
+
+	*timer->pprev = timer->next;
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+	if (*timer->slot == NULL)
+	{
+		idx = timer->slot - &wheel->slots[0][0];
+		wheel->used[idx / TIMER_SLOTS] &= ~(1UL << (idx % TIMER_SLOTS));
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+	timer->slot = NULL;
+}
+
+/**
+ * Arm a timer on the wheel of a polling thread. A timer that is already
+ * armed is moved to its new expiry time.
+ *
+ * @param timer		The timer
+ * @param thread_id	The polling thread that runs the timer
+ * @param msecs		Milliseconds until the timer fires
+ */
+void
+timer_arm(TIMER *timer, int thread_id, long msecs)
+{
+TIMER_WHEEL	*wheel;
+
+	if (wheels == NULL)
+		return;
+	timer_cancel(timer);
+	wheel = timer_wheel(thread_id);
+	spinlock_acquire(&wheel->lock);
+	timer->expires = timer_now() + (msecs + TIMER_TICK - 1) / TIMER_TICK;
+	timer->wheel = wheel;
+	timer_insert(wheel, timer);
+	wheel->n_armed++;
+	spinlock_release(&wheel->lock);
+}
+
+/**
+ * Cancel a timer. Cancelling a timer that is not armed has no effect. If
+ * the timer is firing in another thread the callback may still be running
+ * when this function returns.
+ *
+ * @param timer	The timer
+ */
+void
+timer_cancel(TIMER *timer)
+{
+TIMER_WHEEL	*wheel = timer->wheel;
+
+	if (wheel == NULL)
+		return;
+	spinlock_acquire(&wheel->lock);
+	if (timer->wheel == wheel)
+	{
+		timer_unlink(wheel, timer);
+		timer->wheel = NULL;
+		wheel->n_armed--;
+	}
+	spinlock_release(&wheel->lock);
+}
+
+/**
+ * Return whether a timer is armed
+ *
+ * @param timer	The timer
+ * @return	Non-zero if the timer is armed
+ */
+int
+timer_armed(TIMER *timer)
+{
+	return timer->wheel != NULL;
+}
+
+/**
+ * Move the timers of the current slot of an upper level down to the levels
+ * below it.
+ *
+ * Must be called with the lock of the wheel held.
+ *
+ * @return The index of the slot
+ */
+static int
+timer_cascade(TIMER_WHEEL *wheel, int level)
+{
+int	slot = (wheel->tick >> (TIMER_SLOT_BITS * level)) & TIMER_MASK;
+TIMER	*timer, *next;
+
+	timer = wheel->slots[level][slot];
+	wheel->slots[level][slot] = NULL;
+	wheel->used[level] &= ~(1UL << slot);
+	while (timer)
+	{
+		next = timer->next;
+		timer_insert(wheel, timer);
+		wheel->n_cascaded++;
+		timer = next;
+	}
+	return slot;
+}
+
+/**
+ * Fire the timers of a polling thread that have expired. Called by the
+ * polling thread after each batch of events.
+ *
+ * @param thread_id	The polling thread
+ */
+void
+timer_run(int thread_id)
+{
+TIMER_WHEEL	*wheel;
+TIMER		*timer;
+long		now;
+int		slot, level;
+unsigned long	bits;
+
+	if (wheels == NULL)
+		return;
+	wheel = timer_wheel(thread_id);
+	now = timer_now();
+	spinlock_acquire(&wheel->lock);
+	while (wheel->tick <= now)
+	{
+		if (wheel->n_armed == 0)
+		{
+			wheel->tick = now + 1;
+			break;
+		}
+		slot = wheel->tick & TIMER_MASK;
+		if (slot == 0)
+		{
+			for (level = 1; level < TIMER_LEVELS; level++)
+			{
+				if (timer_cascade(wheel, level) != 0)
+					break;
+			}
+		}
+		else if (wheel->slots[0][slot] == NULL)
+		{
+			/*<
+			 * Skip the empty slots up to the next timer or turn,
+			 * but not past now as later timers go into the slot of
+			 * the next tick to run.
+			 */
+			bits = wheel->used[0] >> slot;
+			wheel->tick += bits ? __builtin_ctzl(bits) : TIMER_SLOTS - slot;
+			if (wheel->tick > now + 1)
+				wheel->tick = now + 1;
+			continue;
+		}
+		while ((timer = wheel->slots[0][slot]) != NULL)
+		{
+			timer_unlink(wheel, timer);
+			timer->wheel = NULL;
+			wheel->n_armed--;
+			wheel->n_fired++;
+			spinlock_release(&wheel->lock);
+			timer->func(timer, timer->data);
+			spinlock_acquire(&wheel->lock);
+		}
+		wheel->tick++;
+	}
+	spinlock_release(&wheel->lock);
+}
+
+/**
+ * Return how long a polling thread may block before its wheel has to run.
+ *
+ * @param thread_id	The polling thread
+ * @param max		The longest time to return in milliseconds
+ * @return		The time in milliseconds
+ */
+int
+timer_next_timeout(int thread_id, int max)
+{
+TIMER_WHEEL	*wheel;
+long		delta, timeout;
+unsigned long	bits;
+int		slot, level;
+
+	if (wheels == NULL)
+		return max;
+	wheel = timer_wheel(thread_id);
+	if (wheel->n_armed == 0)
+		return max;
+	spinlock_acquire(&wheel->lock);
+	slot = wheel->tick & TIMER_MASK;
+	for (level = 1; level < TIMER_LEVELS; level++)
+	{
+		if (wheel->used[level] != 0)
+			break;
+	}
+	if (slot == 0 && level < TIMER_LEVELS)
+	{
+		/*< A cascade is due, it may bring a timer into this tick */
+		delta = 0;
+	}
+	else if ((bits = wheel->used[0] >> slot) != 0)
+	{
+		delta = __builtin_ctzl(bits);
+	}
+	else
+	{
+		/*<
+		 * The next timer is beyond the current turn of the first level,
+		 * wake up at the end of the turn if a cascade may bring it closer.
+		 */
+		delta = TIMER_SLOTS - slot;
+		if (level == TIMER_LEVELS && wheel->used[0] != 0)
+			delta += __builtin_ctzl(wheel->used[0]);
+	}
+	timeout = (wheel->tick + delta - timer_now()) * TIMER_TICK;
+	spinlock_release(&wheel->lock);
+
+	if (timeout < 0)
+		return 0;
+	return timeout < max ? (int)timeout : max;
+}
+
+/**
+ * Print the state of the timer wheels to a DCB
+ *
+ * @param dcb	The DCB to print to
+ */
+void
+dprintTimers(DCB *dcb)
+{
+int	i;
+
+	if (wheels == NULL)
+		return;
+	dcb_printf(dcb, "%-6s | %10s | %10s | %10s\n",
+		"Thread", "Armed", "Fired", "Cascaded");
+	dcb_printf(dcb, "------------------------------------------------\n");
+	for (i = 0; i < n_wheels; i++)
+	{
+		dcb_printf(dcb, "%-6d | %10d | %10d | %10d\n",
+			i,
+			wheels[i].n_armed,
+			wheels[i].n_fired,
+			wheels[i].n_cascaded);
+	}
+}
@@ -0,0 +1,61 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2014
+ */
+#include <stddef.h>
+
+struct dcb;
+
+/**
+ * @file arena.h	The huge page arena for buffer data
+ *
+ * The arena is one region of memory reserved at startup and backed by huge
+ * pages where the kernel provides them, so that the data of the many
+ * network buffers is covered by few TLB entries. The slab caches of the
+ * buffer pools carve their objects from the arena; the objects are kept
+ * on the free lists of the caches and never returned, so the arena needs
+ * no free list of its own. Allocations the arena can not serve fall back
+ * to the heap.
+ */
+
+#define	ARENA_ALIGN		64		/**< Alignment of the objects */
+#define	ARENA_HUGE_PAGE		(2 * 1024 * 1024) /**< Size of a huge page */
+
+/**
+ * How the arena memory is backed
+ */
+typedef enum {
+	ARENA_NONE = 0,		/**< There is no arena */
+	ARENA_HUGETLB,		/**< Reserved huge pages, MAP_HUGETLB */
+	ARENA_THP,		/**< Transparent huge pages, MADV_HUGEPAGE */
+	ARENA_PAGES		/**< Normal pages, huge pages are unavailable */
+} arena_mode_t;
+
+/**
+ * The statistics of the arena
+ */
+typedef struct {
+	int		n_allocs;	/**< Objects carved from the arena */
+	int		n_fallbacks;	/**< Objects that went to the heap instead */
+} ARENA_STATS;
+
+extern void	arena_init(size_t);
+extern void	*arena_alloc(size_t);
+extern int	arena_contains(void *);
+extern void	dprintArena(struct dcb *);
+#endif
@@ -43,6 +43,9 @@
  */
 #include <skygw_debug.h>
 
+struct dcb;
+struct slab_cache;
+struct gwbuf_info;
 
 typedef enum 
 {
@@ -51,6 +54,20 @@ typedef enum
         GWBUF_TYPE_MYSQL     = 0x2
 } gwbuf_type_t;
 
+/**
+ * The facts about a packet that the stages a packet goes through may record
+ * for the stages after them, so that the packet is parsed only once.
+ */
+typedef enum
+{
+	GWBUF_INFO_PACKET_LEN = 0,	/*< Length of the packet payload */
+	GWBUF_INFO_COMMAND,		/*< The MySQL command of the packet */
+	GWBUF_INFO_QUERY_TYPE,		/*< Type from the query classifier */
+	GWBUF_INFO_CANONICAL_HASH,	/*< Hash of the canonical statement */
+	GWBUF_INFO_TIMESTAMP,		/*< Time the packet was read in usecs */
+	GWBUF_INFO_MAX
+} gwbuf_info_t;
+
 /**
  * A structure to encapsulate the data in a form that the data itself can be
  * shared between multiple GWBUF's without the need to make multiple copies
@@ -59,6 +76,7 @@ typedef enum
 typedef struct  {
 	unsigned char	*data;			/*< Physical memory that was allocated */
 	int		refcount;		/*< Reference count on the buffer */
+	struct slab_cache *cache;		/*< Pool of the memory, NULL if from the heap */
 } SHARED_BUF;
 
 /**
@@ -68,12 +86,18 @@ typedef struct  {
  * or written to a descriptor. The use of linked lists of buffers with
  * flexible data pointers is designed to minimise the need for data to
  * be copied within the gateway.
+ *
+ * The first buffer of a packet may refer to a block of facts about the
+ * packet. The block belongs to the packet, not to the data, so packets
+ * split from the same read have blocks of their own, and it is shared by
+ * the clones of the buffer.
  */
 typedef struct gwbuf {
 	struct gwbuf	*next;	/*< Next buffer in a linked chain of buffers */
 	void		*start;	/*< Start of the valid data */
 	void		*end;	/*< First byte after the valid data */
 	SHARED_BUF	*sbuf;  /*< The shared buffer with the real data */
+	struct gwbuf_info *info; /*< Facts about the packet, NULL if none */
 	int		command;/*< The command type for the queue */
 	gwbuf_type_t    gwbuf_type; /*< buffer's data type information */
 } GWBUF;
@@ -94,6 +118,16 @@ typedef struct gwbuf {
 #define GWBUF_CONSUME(b, bytes)	(b)->start += bytes
 
 #define GWBUF_TYPE(b) (b)->gwbuf_type
+
+/**
+ * A read position in a linked list of buffers. A cursor lets a packet be
+ * parsed without assuming that it sits in the first buffer of the list,
+ * bytes are only copied when a value spans two buffers.
+ */
+typedef struct {
+	GWBUF		*buf;		/*< The buffer the position is in */
+	unsigned int	offset;		/*< Offset of the position in the buffer */
+} GWBUF_CURSOR;
 /*<
  * Function prototypes for the API to maniplate the buffers
  */
@@ -106,4 +140,23 @@ extern unsigned int	gwbuf_length(GWBUF *head);
 extern GWBUF            *gwbuf_clone_portion(GWBUF *head, size_t offset, size_t len);
 extern GWBUF            *gwbuf_clone_transform(GWBUF *head, gwbuf_type_t type);
 extern bool             gwbuf_set_type(GWBUF *head, gwbuf_type_t type);
+extern void		dprintBufferPools(struct dcb *dcb);
+extern unsigned int	gwbuf_copy_data(GWBUF *head, unsigned int offset,
+				unsigned int len, unsigned char *dest);
+extern GWBUF		*gwbuf_split(GWBUF **head, unsigned int length);
+extern GWBUF		*gwbuf_mysql_next_packet(GWBUF **head);
+extern void		gwbuf_set_info(GWBUF *buf, gwbuf_info_t type, long value);
+extern bool		gwbuf_get_info(GWBUF *buf, gwbuf_info_t type, long *value);
+extern int		gwbuf_mysql_command(GWBUF *buf);
+extern long		gwbuf_mysql_packet_len(GWBUF *buf);
+extern void		gwbuf_cursor_init(GWBUF_CURSOR *cur, GWBUF *head);
+extern int		gwbuf_cursor_skip(GWBUF_CURSOR *cur, unsigned int len);
+extern unsigned int	gwbuf_cursor_peek(GWBUF_CURSOR *cur, unsigned int len,
+				unsigned char *dest);
+extern unsigned int	gwbuf_cursor_read(GWBUF_CURSOR *cur, unsigned int len,
+				unsigned char *dest);
+extern int		gwbuf_cursor_read_lenenc(GWBUF_CURSOR *cur,
+				unsigned long *val);
+extern unsigned char	*gwbuf_cursor_contiguous(GWBUF_CURSOR *cur,
+				unsigned int len, unsigned char *scratch);
 #endif
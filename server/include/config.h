@@ -55,9 +55,35 @@ typedef struct	config_context {
  */
 typedef struct {
 	int			n_threads;	/**< Number of polling threads */
+	int			epoll_per_thread; /**< One epoll set per polling thread */
+	int			poll_spin_time;	/**< usecs to poll before blocking */
+	unsigned int		writeq_high_water; /**< Write queue size that stops the peer */
+	unsigned int		writeq_low_water; /**< Write queue size that restarts the peer */
+	char			*poll_engine;	/**< The I/O event engine, NULL for epoll */
+	int			client_auth_timeout; /**< Seconds to authenticate a client */
+	int			client_idle_timeout; /**< Seconds a client may be idle */
+	int			backend_connect_timeout; /**< Seconds to connect to a backend */
+	int			query_timeout;	/**< Seconds to wait for a reply */
+	int			deferred_flush;	/**< Flush writes at the end of a batch of events */
+	char			*accept_balance; /**< Spreading of new clients over the threads */
+	unsigned int		session_mem_limit; /**< Buffered bytes that stop a client reading */
+	int			buffer_arena_size; /**< Megabytes of huge page arena for buffers */
 } GATEWAY_CONF;
 
 extern int	config_load(char *);
 extern int	config_reload();
 extern int	config_threadcount();
+extern int	config_epoll_per_thread();
+extern int	config_poll_spin_time();
+extern unsigned int	config_writeq_high_water();
+extern unsigned int	config_writeq_low_water();
+extern char	*config_poll_engine();
+extern int	config_client_auth_timeout();
+extern int	config_client_idle_timeout();
+extern int	config_backend_connect_timeout();
+extern int	config_query_timeout();
+extern int	config_deferred_flush();
+extern char	*config_accept_balance();
+extern unsigned int	config_session_mem_limit();
+extern int	config_buffer_arena_size();
 #endif
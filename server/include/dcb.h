@@ -20,8 +20,11 @@
 #include <spinlock.h>
 #include <buffer.h>
 #include <gwbitmask.h>
+#include <slab.h>
+#include <timer.h>
 #include <skygw_utils.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 struct session;
 struct server;
@@ -96,9 +99,15 @@ typedef struct gw_protocol {
  */
 typedef struct dcbstats {
 	int		n_reads;	/*< Number of reads on this descriptor */
-	int		n_writes;	/*< Number of writes on this descriptor */
+	int		n_writes;	/*< Number of write system calls on this descriptor */
 	int		n_accepts;	/*< Number of accepts on this descriptor */
 	int		n_buffered;	/*< Number of buffered writes */
+	long		n_bytes_written; /*< Number of bytes written */
+	int		n_high_water;	/*< Number of times the write queue passed the high water mark */
+	int		n_low_water;	/*< Number of times the write queue drained to the low water mark */
+	int		n_throttled;	/*< Number of times reading was stopped for a full peer */
+	int		n_timeouts;	/*< Number of timeouts */
+	long		n_bytes_spliced; /*< Number of bytes spliced to the peer */
 } DCBSTATS;
 
 /**
@@ -113,15 +122,16 @@ typedef struct dcbstats {
  * processing an event that will access the DCB.
  *
  * We solve this issue by making the dcb_free routine merely mark a DCB as a zombie and
- * place it on a special zombie list. Before placing the DCB on the zombie list we create
- * a bitmask with a bit set in it for each active polling thread. Each thread will call
- * a routine to process the zombie list at the end of the polling loop. This routine
- * will clear the bit value that corresponds to the calling thread. Once the bitmask
- * is completely cleared the DCB can finally be freed and removed from the zombie list.
+ * place it on a special zombie list, tagged with the current reclamation epoch. Each
+ * thread will call a routine to process the zombie list at the end of the polling loop,
+ * when it holds no references to DCBs, and so records that it has passed the current
+ * epoch. Once every polling thread has passed an epoch the zombies of the previous
+ * epoch can finally be freed and removed from the zombie list.
  */
 typedef struct {
-	GWBITMASK	bitmask;	/*< The bitmask of threads */
+	int		epoch;		/*< The epoch in which the DCB became a zombie */
 	struct dcb	*next;		/*< Next pointer for the zombie list */
+	int		n_mail;		/*< Messages for the DCB not yet delivered */
 } DCBMM;
 
 /* DCB states */
@@ -158,22 +168,25 @@ typedef struct dcb {
 #endif
         dcb_role_t      dcb_role;
         SPINLOCK        dcb_initlock;
-#if 1
-        simple_mutex_t  dcb_read_lock;
-        simple_mutex_t  dcb_write_lock;
-        bool            dcb_read_active;
-        bool            dcb_write_active;
-#endif
+        __uint32_t      evq_events;     /*< Pending events and DCB_EVQ_ACTIVE */
 	int	 	fd;		/**< The descriptor */
 	dcb_state_t	state;		/**< Current descriptor state */
 	char		*remote;	/**< Address of remote end */
 	struct sockaddr_in ipv4;	/**< remote end IPv4 address */
 	void		*protocol;	/**< The protocol specific state */
+	SLAB_CACHE	*protocol_cache; /**< Cache of protocol, NULL if from the heap */
 	struct session	*session;	/**< The owning session */
 	GWPROTOCOL	func;		/**< The functions for this descriptor */
 
 	SPINLOCK	writeqlock;	/**< Write Queue spinlock */
 	GWBUF		*writeq;	/**< Write Data Queue */
+	unsigned int	writeqlen;	/**< Number of bytes in the write queue */
+	bool		high_water;	/**< The write queue is above the high water mark */
+	int		mem_buffered;	/**< Bytes of data held in buffers for the DCB */
+	struct dcb	*throttled;	/**< DCBs that stopped reading until writeq drains */
+	struct dcb	*throttled_by;	/**< The DCB this DCB waits for to drain */
+	struct dcb	*next_throttled; /**< Next DCB waiting for throttled_by */
+	bool		read_stopped;	/**< EPOLLIN is not reported, changed atomically */
 	SPINLOCK	delayqlock;	/**< Delay Backend Write Queue spinlock */
 	GWBUF		*delayq;	/**< Delay Backend Write Data Queue */
 	SPINLOCK	authlock;	/**< Generic Authorization spinlock */
@@ -183,8 +196,18 @@ typedef struct dcb {
 	struct dcb	*next;		/**< Next DCB in the chain of allocated DCB's */
 	struct service	*service;	/**< The related service */
 	void		*data;		/**< Specific client data */
+	SLAB_CACHE	*data_cache;	/**< Cache of data, NULL if from the heap */
 	DCBMM		memdata;	/**< The data related to DCB memory management */
 	int		command;	/**< Specific client command type */
+	int		thread_id;	/**< The polling thread that owns the DCB */
+	struct dcb	*next_listener;	/**< Next per-thread listener on the same port */
+	TIMER		timer;		/**< Timeout of the current protocol phase */
+	bool		spliced;	/**< Data read is spliced to splice_peer */
+	struct dcb	*splice_peer;	/**< The DCB spliced data is written to */
+	int		splice_pipe[2];	/**< Pipe holding the data for the peer */
+	int		splice_pending;	/**< Bytes in the pipe, protected by the peer writeqlock */
+	bool		flush_pending;	/**< Written data waits for dcb_flush_deferred */
+	struct dcb	*next_deferred;	/**< Next DCB in the deferred list of a thread */
 #if defined(SS_DEBUG)
         skygw_chk_t     dcb_chk_tail;
 #endif
@@ -200,6 +223,12 @@ int           fail_accept_errno;
 #endif
 
 /* A few useful macros */
+/**
+ * Set in the pending events of a DCB while a thread processes its events.
+ * The bit of EPOLLET, which epoll never reports.
+ */
+#define	DCB_EVQ_ACTIVE			0x80000000U
+
 #define	DCB_SESSION(x)			(x)->session
 #define DCB_PROTOCOL(x, type)		(type *)((x)->protocol)
 #define	DCB_ISZOMBIE(x)			((x)->state == DCB_STATE_ZOMBIE)
@@ -212,14 +241,23 @@ int             gw_write(
         int         fd, 
         const void* buf, 
         size_t      nbytes);
+int             gw_writev(
+#if defined(SS_DEBUG)
+        DCB*                dcb,
+#endif
+        int                 fd,
+        const struct iovec* iov,
+        int                 iovcnt);
 int             dcb_write(DCB *, GWBUF *);
 DCB             *dcb_alloc(dcb_role_t);
 void            dcb_free(DCB *);
 DCB             *dcb_connect(struct server *, struct session *, const char *);	
 int             dcb_read(DCB *, GWBUF **);
+int             dcb_read_data(DCB *, GWBUF **, bool *);
 int             dcb_drain_writeq(DCB *);
 void            dcb_close(DCB *);
 DCB		*dcb_process_zombies(int);		/* Process Zombies */
+void		dcb_process_zombies_done();		/* Thread leaves zombie processing */
 void		printAllDCBs();				/* Debug to print all DCB in the system */
 void		printDCB(DCB *);			/* Debug print routine */
 void		dprintAllDCBs(DCB *);			/* Debug to print all DCB in the system */
@@ -229,6 +267,14 @@ void		dcb_printf(DCB *, const char *, ...);	/* DCB version of printf */
 int		dcb_isclient(DCB *);			/* the DCB is the client of the session */
 void		dcb_hashtable_stats(DCB *, void *);	/**< Print statisitics */
 void            dcb_add_to_zombieslist(DCB* dcb);
+void		dcb_set_timeout(DCB *, long);		/* Arm or cancel the timeout */
+int		dcb_post_write(DCB *, GWBUF *);		/* Write from any thread */
+int		dcb_splice_start(DCB *, DCB *);		/* Splice two DCBs together */
+void		dcb_splice(DCB *);			/* Move read data to the peer */
+void		dcb_splice_write_ready(DCB *);		/* Move pending data to the DCB */
+void		dcb_defer_writes(bool);			/* Defer the writes of the thread */
+void		dcb_flush_deferred();			/* Write the deferred data */
+void		dcb_mem_account(DCB *, int);		/* Account buffered bytes */
 
 bool dcb_set_state(
         DCB*         dcb,
@@ -48,8 +48,64 @@ typedef struct hashentry {
 	void			*key;	/**< The value of the key or NULL if empty entry */
 	void			*value;	/**< The value associated with key */
 	struct	hashentry	*next;	/**< The overflow chain */
+	struct	hashentry	*retired; /**< The list of entries waiting to be freed */
+	int			moved;	/**< The key and value now belong to a copy */
 } HASHENTRIES;
 
+#define	HASHTABLE_READER_SLOTS	16	/**< Reader counts per table */
+#define	HASHTABLE_RETIRE_BATCH	32	/**< Least deleted entries freed together */
+#define	HASHTABLE_MAX_LOAD	2	/**< Entries per chain that make the table grow */
+#define	HASHTABLE_MIGRATE_STEP	4	/**< Chains migrated by each add or delete */
+
+/**
+ * The number of readers inside the table. The readers of a thread always use
+ * the same slot, the slots are in cache lines of their own so that readers
+ * on different threads do not share the line they update.
+ */
+typedef struct {
+	int		count[2];	/**< Readers that entered in each epoch parity */
+} __attribute__((aligned(64))) HASHREADERS;
+
+/**
+ * The chains of a hashtable. While the table grows the entries are moved
+ * from the old chains to the new ones a few chains at a time. The state
+ * is never changed once readers can see it, growing publishes a new state.
+ */
+typedef struct hashstate {
+	int		size;			/**< The number of chains */
+	HASHENTRIES	**entries;		/**< The chains */
+	int		old_size;		/**< The number of old chains */
+	HASHENTRIES	**old_entries;		/**< The chains being migrated or NULL */
+} HASHSTATE;
+
+#define	HASHTABLE_GROUP		16	/**< Slots whose tags are matched at once */
+#define	HASHTABLE_INLINE_KEY	47	/**< Longest key kept in the slot */
+
+/**
+ * A slot of an open addressing hashtable, one cache line. The key is also
+ * kept in the slot as the bytes returned by the key function of the table if
+ * it is short enough, a lookup then compares the bytes in the slot and does
+ * not follow the key pointer.
+ */
+typedef struct {
+	void		*key;			/**< The key */
+	void		*value;			/**< The value associated with key */
+	unsigned char	klen;			/**< Length of kdata, 0xff if not inline */
+	char		kdata[HASHTABLE_INLINE_KEY]; /**< The inline key */
+} HASHSLOT;
+
+/**
+ * The slots of an open addressing hashtable. The control byte of a slot is
+ * empty, deleted or seven bits of the hash value of its key. A slot is
+ * filled once and only becomes free again when the table is rebuilt.
+ */
+typedef struct {
+	int		n_groups;		/**< Groups of slots, a power of two */
+	int		n_used;			/**< Slots that are not empty */
+	unsigned char	*ctrl;			/**< The control bytes of the slots */
+	HASHSLOT	*slots;			/**< The slots */
+} HASHOPEN;
+
 /**
  * HASHTABLE iterator - used to walk the hashtable in a thread safe
  * way
@@ -66,6 +122,14 @@ typedef struct hashiterator {
  */
 typedef void *(*HASHMEMORYFN)(void *);
 
+/**
+ * The type definition for the key function of an open addressing table. The
+ * function writes the bytes that identify the key to the buffer and returns
+ * their number, which may be larger than the buffer if the key is too long to
+ * be kept inline.
+ */
+typedef int (*HASHKEYFN)(void *, char *, int);
+
 /**
  * The general purpose hashtable struct.
  */
@@ -73,17 +137,28 @@ typedef struct hashtable {
 #if defined(SS_DEBUG)
         skygw_chk_t     ht_chk_top;
 #endif
-	int		hashsize;			/**< The number of HASHENTRIES */
-	HASHENTRIES	**entries;			/**< The entries themselves */
+	HASHSTATE	*state;				/**< The chains of the table */
+	HASHOPEN	*open;				/**< The slots of an open table */
+	HASHKEYFN	keyfn;				/**< Inline key function of an open table */
+	int		n_entries;			/**< The number of entries */
+	int		migrate_pos;			/**< The next old chain to migrate */
+	int		migrate_after;			/**< Waits started before the resize */
+	int		n_resizes;			/**< The number of times the table grew */
+	int		n_migrated;			/**< Old chains migrated in total */
 	int		(*hashfn)(void *);		/**< The hash function */
 	int		(*cmpfn)(void *, void *);	/**< The key comparison function */
 	HASHMEMORYFN	kcopyfn;			/**< Optional key copy function */
 	HASHMEMORYFN	vcopyfn;			/**< Optional value copy function */
 	HASHMEMORYFN	kfreefn;			/**< Optional key free function */
 	HASHMEMORYFN	vfreefn;			/**< Optional value free function */
-	SPINLOCK	spin;				/**< Internal spinlock for the hashtable */
-	int		n_readers;			/**< Number of clients reading the table */
-	int		writelock;			/**< The table is locked by a writer */
+	SPINLOCK	spin;				/**< Serialises the writers */
+	SPINLOCK	sync;				/**< Serialises the waits for readers */
+	HASHREADERS	*readers;			/**< Readers inside the table */
+	int		epoch;				/**< Selects the count new readers use */
+	int		sync_started;			/**< Waits for the readers started */
+	int		sync_done;			/**< Waits for the readers completed */
+	HASHENTRIES	*retired;			/**< Deleted entries not yet freed */
+	int		n_retired;			/**< Length of the retired list */
 #if defined(SS_DEBUG)
         skygw_chk_t     ht_chk_tail;
 #endif
@@ -91,6 +166,8 @@ typedef struct hashtable {
 
 extern HASHTABLE	*hashtable_alloc(int, int (*hashfn)(), int (*cmpfn)());
 				/**< Allocate a hashtable */
+extern HASHTABLE	*hashtable_alloc_open(int, int (*hashfn)(), int (*cmpfn)(), HASHKEYFN);
+				/**< Allocate an open addressing hashtable */
 extern void		hashtable_memory_fns(HASHTABLE *, HASHMEMORYFN, HASHMEMORYFN, HASHMEMORYFN, HASHMEMORYFN);
 				/**< Provide an interface to control key/value memory
 				 * manipulation
@@ -34,11 +34,24 @@
 #define	MAX_EVENTS	1000
 #define	EPOLL_TIMEOUT	1000	/**< The epoll timeout in milliseconds */
 
+typedef	void	(*POLL_MAIL_FUNC)(void *, void *);
+
 extern	void		poll_init();
 extern	int		poll_add_dcb(DCB *);
 extern	int		poll_remove_dcb(DCB *);
 extern	void		poll_waitevents(void *);
 extern	void		poll_shutdown();
+extern	void		poll_wake();
+extern	void		poll_stop_read(DCB *);
+extern	void		poll_start_read(DCB *);
+extern	DCB		*poll_reading_dcb();
+extern	void		poll_fake_event(DCB *, __uint32_t);
+extern	int		poll_post(int, POLL_MAIL_FUNC, void *, void *);
 extern	GWBITMASK	*poll_bitmask();
+extern	int		poll_n_epoll_sets();
+extern	int		poll_current_thread();
+extern	bool		poll_is_polling_thread();
+extern	int		poll_accept_thread();
+extern	void		poll_accept_done(int);
 extern	void		dprintPollStats(DCB *);
 #endif
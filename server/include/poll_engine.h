@@ -0,0 +1,68 @@
+#ifndef _POLL_ENGINE_H
+#define _POLL_ENGINE_H
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2014
+ */
+#include <sys/epoll.h>
+
+/**
+ * @file poll_engine.h	The I/O event engines used by the polling threads
+ *
+ * An engine reports the readiness of descriptors in sets, the polling
+ * system creates one set per polling thread or one set shared by all the
+ * threads. The events and the event array use the epoll definitions for
+ * every engine.
+ *
+ * The flags that select how a descriptor is reported are:
+ *
+ * @verbatim
+ *	EPOLLET		Report a readiness change once
+ *	EPOLLONESHOT	Report one set of events, then disarm the descriptor
+ *	neither		Report the events for as long as they are pending
+ * @endverbatim
+ */
+
+typedef void	POLL_SET;
+
+/**
+ * The entry points of an engine
+ *
+ * @verbatim
+ *	create		Create an empty set
+ *	add		Add a descriptor and its user data to a set
+ *	modify		Change the events or user data of a descriptor
+ *	remove		Remove a descriptor from a set
+ *	wait		Wait up to timeout milliseconds for events, 0 does not
+ *			block and -1 blocks until an event arrives
+ *	destroy		Close a set and release its resources, the set must
+ *			no longer be waited on
+ * @endverbatim
+ */
+typedef struct poll_engine {
+	char		*name;
+	POLL_SET	*(*create)(int);
+	int		(*add)(POLL_SET *, int, __uint32_t, void *);
+	int		(*modify)(POLL_SET *, int, __uint32_t, void *);
+	int		(*remove)(POLL_SET *, int);
+	int		(*wait)(POLL_SET *, struct epoll_event *, int, int);
+	void		(*destroy)(POLL_SET *);
+} POLL_ENGINE;
+
+extern POLL_ENGINE	*poll_engine_find(char *);
+extern POLL_ENGINE	poll_engine_epoll;
+extern POLL_ENGINE	poll_engine_io_uring;
+#endif
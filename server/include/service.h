@@ -68,6 +68,7 @@ typedef struct {
 	time_t		started;	/**< The time when the service was started */
 	int		n_sessions;	/**< Number of sessions created on service since start */
 	int		n_current;	/**< Current number of sessions */
+	int		mem_buffered;	/**< Bytes of data held by the sessions */
 } SERVICE_STATS;
 
 /**
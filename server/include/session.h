@@ -47,6 +47,9 @@ struct service;
  */
 typedef struct {
 	time_t		connect;	/**< Time when the session was started */
+	int		mem_buffered;	/**< Bytes of data the session holds in buffers */
+	int		mem_peak;	/**< Largest number of bytes held at once */
+	int		n_mem_throttled; /**< Times the client stopped for the memory limit */
 } SESSION_STATS;
 
 typedef enum {
@@ -78,6 +81,7 @@ typedef struct session {
 	struct service	*service;	/**< The service this session is using */
 	struct session	*next;		/**< Linked list of all sessions */
 	int		refcount;	/**< Reference count on the session */
+	bool		mem_throttled;	/**< Client reading stopped by the memory limit */
 #if defined(SS_DEBUG)
         skygw_chk_t     ses_chk_tail;
 #endif
@@ -93,4 +97,5 @@ void	dprintAllSessions(struct dcb *);
 void	dprintSession(struct dcb *, SESSION *);
 char	*session_state(int);
 bool	session_link_dcb(SESSION *, struct dcb *);
+void	session_mem_account(SESSION *, int);
 #endif
@@ -0,0 +1,74 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2014
+ */
+#include <stddef.h>
+#include <spinlock.h>
+#include <statistics.h>
+
+struct dcb;
+
+/**
+ * @file slab.h	Caches of fixed size objects
+ *
+ * A slab cache keeps the freed objects of one type for reuse, so that the
+ * objects created for each connection, such as DCBs and sessions, do not
+ * have to be allocated from the heap in steady state. Every thread has a
+ * free list of its own for each cache, objects move in batches between the
+ * thread free lists and a free list shared by all threads.
+ */
+
+#define	SLAB_MAX_CACHES		32	/**< Maximum number of slab caches */
+#define	SLAB_THREAD_MAX		64	/**< Max. free objects kept by a thread */
+#define	SLAB_BATCH		32	/**< Objects moved to or from the shared list */
+
+/**
+ * The statistics of a slab cache, kept per polling thread and summed up
+ * when they are displayed
+ */
+typedef struct {
+	int		n_allocs;	/**< Number of allocations */
+	int		n_frees;	/**< Number of frees */
+	int		n_misses;	/**< Allocations served from the heap */
+} STATS_ALIGNED SLAB_STATS;
+
+/**
+ * A cache of fixed size objects
+ */
+typedef struct slab_cache {
+	char		*name;		/**< Name of the cache for diagnostics */
+	size_t		size;		/**< Size of the objects */
+	int		id;		/**< Index of the thread free lists */
+	SPINLOCK	lock;		/**< Protects the shared free list */
+	void		*shared;	/**< Free list shared by the threads */
+	int		n_shared;	/**< Objects in the shared free list */
+	SLAB_STATS	*stats;		/**< Usage statistics of each thread */
+	int		n_stats;	/**< Polling threads in stats, the entry
+					  *  after them is for all other threads */
+	int		arena;		/**< New objects come from the buffer arena */
+	struct slab_cache *next;	/**< Next cache in the list of all caches */
+} SLAB_CACHE;
+
+extern SLAB_CACHE	*slab_cache_alloc(char *, size_t);
+extern void		*slab_alloc(SLAB_CACHE *);
+extern void		*slab_alloc_nozero(SLAB_CACHE *);
+extern void		slab_free(SLAB_CACHE *, void *);
+extern void		slab_cache_use_arena(SLAB_CACHE *);
+extern void		slab_cache_stats(SLAB_CACHE *, SLAB_STATS *);
+extern void		dprintAllSlabCaches(struct dcb *);
+#endif
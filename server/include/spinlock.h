@@ -27,10 +27,39 @@
  * generally wasteful as any blocked threads will spin, consuming CPU cycles, waiting
  * for the lock to be released. However they are useful in that they do not involve
  * system calls and are light weight when the expected wait time for a lock is low.
+ *
+ * A thread that finds the lock taken waits for it to look free, executing PAUSE
+ * instructions with an exponential backoff between the reads and yielding the
+ * processor once the backoff reaches SPINLOCK_MAX_BACKOFF.
+ *
+ * Locks given a name are profiled in production builds. All the locks with the
+ * same name share one LOCK_PROFILE, so the DCB write queue locks show as one
+ * lock class. Every contended acquisition is counted and timed, the uncontended
+ * ones are sampled, one in SPINLOCK_SAMPLE acquisitions of a thread, to count
+ * the acquisitions and to time how long the lock is held.
  */
 #include <thread.h>
 #include <stdbool.h>
 
+struct dcb;
+
+#define	SPINLOCK_MAX_BACKOFF	256	/**< Most PAUSEs between two reads of a lock */
+#define	SPINLOCK_SAMPLE		64	/**< One in this many acquisitions is timed */
+
+/**
+ * The profile of a class of named locks
+ */
+typedef struct lock_profile {
+	const char		*name;		/**< The name of the locks */
+	long			n_sampled;	/**< Sampled acquisitions */
+	long			n_contended;	/**< Acquisitions that had to wait */
+	long			wait_time;	/**< Nanoseconds waited in contended acquisitions */
+	long			wait_max;	/**< Longest wait in nanoseconds */
+	long			hold_time;	/**< Nanoseconds the sampled acquisitions held the lock */
+	long			hold_max;	/**< Longest sampled hold in nanoseconds */
+	struct lock_profile	*next;		/**< The next lock class */
+} LOCK_PROFILE;
+
 typedef struct spinlock {
 	int		lock;
 #if DEBUG
@@ -38,6 +67,8 @@ typedef struct spinlock {
 	int		acquired;
 	THREAD		owner;
 #endif
+	const char	*name;		/**< The lock class, NULL if not profiled */
+	LOCK_PROFILE	*profile;	/**< The profile, looked up on first use */
 } SPINLOCK;
 
 #ifndef TRUE
@@ -48,15 +79,21 @@ typedef struct spinlock {
 #endif
 
 #if DEBUG
-#define SPINLOCK_INIT { 0, 0, 0, NULL }
+#define SPINLOCK_INIT { 0, 0, 0, NULL, NULL, NULL }
+#define SPINLOCK_INIT_NAMED(n) { 0, 0, 0, NULL, n, NULL }
 #else
-#define SPINLOCK_INIT { 0 }
+#define SPINLOCK_INIT { 0, NULL, NULL }
+#define SPINLOCK_INIT_NAMED(n) { 0, n, NULL }
 #endif
 
 #define SPINLOCK_IS_LOCKED(l) ((l)->lock != 0 ? true : false)
 	
 extern void	spinlock_init(SPINLOCK *lock);
+extern void	spinlock_init_named(SPINLOCK *lock, const char *name);
 extern void	spinlock_acquire(SPINLOCK *lock);
 extern int	spinlock_acquire_nowait(SPINLOCK *lock);
 extern void	spinlock_release(SPINLOCK *lock);
+extern LOCK_PROFILE *spinlock_profile(const char *name);
+extern LOCK_PROFILE *spinlock_profiles();
+extern void	dprintLocks(struct dcb *);
 #endif
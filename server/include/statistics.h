@@ -0,0 +1,98 @@
+#ifndef _STATISTICS_H
+#define _STATISTICS_H
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2014
+ */
+#include <stddef.h>
+
+struct dcb;
+
+/**
+ * @file statistics.h	Per thread statistics
+ *
+ * Counters that are updated on every event are kept per polling thread,
+ * each thread in a cache line of its own, and are only summed up when they
+ * are displayed. A thread updates its own counters without atomic operations.
+ *
+ * The histograms record values in buckets of logarithmic width, every power
+ * of two is split into HIST_SUB_BUCKETS linear buckets, which keeps the
+ * error of a percentile within 25% over the whole range of values.
+ */
+
+#define	STATS_CACHE_LINE	64	/**< Alignment of the per thread data */
+#define	STATS_ALIGNED		__attribute__((aligned(STATS_CACHE_LINE)))
+
+#define	HIST_SUB_BITS		2
+#define	HIST_SUB_BUCKETS	(1 << HIST_SUB_BITS)
+#define	HIST_BUCKETS		(HIST_SUB_BUCKETS * 32)	/**< Values up to 2^32 */
+
+/**
+ * A histogram of values
+ */
+typedef struct {
+	int		count[HIST_BUCKETS];	/**< Number of values per bucket */
+	int		n;			/**< Number of values */
+	long		sum;			/**< Sum of the values */
+	long		max;			/**< The largest value */
+} HISTOGRAM;
+
+/**
+ * The statistics of a polling thread
+ */
+typedef struct {
+	int		n_read;		/**< Number of read events   */
+	int		n_write;	/**< Number of write events  */
+	int		n_error;	/**< Number of error events  */
+	int		n_hup;		/**< Number of hangup events */
+	int		n_accept;	/**< Number of accept events */
+	int		n_polls;	/**< Number of poll cycles   */
+	int		n_empty;	/**< Number of polls that found no events */
+	int		n_blocked;	/**< Number of polls that blocked */
+	int		n_wakes;	/**< Number of wake ups via poll_wake */
+	long		wake_latency;	/**< Sum of the wake up latencies in usecs */
+	long		wake_max;	/**< Longest wake up latency in usecs */
+	int		n_coalesced;	/**< Events left to the thread already processing the DCB */
+	int		n_read_stopped;	/**< Number of times reading was stopped */
+	int		n_syscalls;	/**< System calls made by the event engine */
+	int		n_posted;	/**< Messages posted by the thread */
+	int		n_delivered;	/**< Messages delivered to the thread */
+	int		n_mail_wakes;	/**< Mailboxes signalled by the thread */
+	int		n_deferred;	/**< Writes left for the flush at the end of the batch */
+	int		n_write_coalesced; /**< Deferred writes added to a pending flush */
+	int		n_flushed;	/**< DCBs flushed at the end of a batch */
+	int		n_accept_handoff; /**< Clients handed to another thread */
+	HISTOGRAM	loop_time;	/**< Time to process the events of a poll in usecs */
+	HISTOGRAM	events;		/**< Number of events returned by a poll */
+	HISTOGRAM	route_time;	/**< Time to route a query in usecs */
+	HISTOGRAM	accept_backlog;	/**< Connections in the listen backlog on accept */
+	HISTOGRAM	accept_batch;	/**< Connections accepted per accept event */
+	HISTOGRAM	handshake_time;	/**< Time from accept to handshake sent in usecs */
+} STATS_ALIGNED THREAD_STATS;
+
+extern void		stats_init(int);
+extern int		stats_n_threads();
+extern int		stats_thread_id();
+extern THREAD_STATS	*stats_thread();
+extern void		stats_sum(THREAD_STATS *);
+extern void		*stats_alloc(size_t);
+extern long		stats_usecs();
+extern void		hist_add(HISTOGRAM *, long);
+extern void		hist_merge(HISTOGRAM *, HISTOGRAM *);
+extern long		hist_percentile(HISTOGRAM *, int);
+extern void		dprintHistogram(struct dcb *, char *, HISTOGRAM *);
+extern void		dprintThreadStats(struct dcb *);
+#endif
@@ -0,0 +1,87 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+/*
+ * This file is distributed as part of the SkySQL Gateway.  It is free
+ * software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation,
+ * version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Copyright SkySQL Ab 2014
+ */
+#include <spinlock.h>
+
+struct dcb;
+
+/**
+ * @file timer.h	Timers run by the polling threads
+ *
+ * Every polling thread has a hierarchical timer wheel that it runs after
+ * each batch of events. A timer is embedded in the object it belongs to, so
+ * arming, cancelling and firing a timer never allocate memory, and arming
+ * and cancelling take constant time.
+ *
+ * The wheel has TIMER_LEVELS levels of TIMER_SLOTS slots. A slot of the
+ * first level covers one tick of TIMER_TICK milliseconds, a slot of every
+ * further level covers a whole turn of the level below it. Timers in the
+ * upper levels are moved down a level each time the level below completes
+ * a turn. Timers further in the future than the wheel covers, about 4.6
+ * hours, fire at the end of the wheel.
+ *
+ * A timer fires in the polling thread whose wheel it was armed on. The
+ * callback is called without any lock held, a timer may be armed again or
+ * cancelled from within its callback.
+ */
+
+#define	TIMER_TICK		1	/**< Length of a tick in milliseconds */
+#define	TIMER_SLOT_BITS		6
+#define	TIMER_SLOTS		(1 << TIMER_SLOT_BITS)
+#define	TIMER_LEVELS		4
+
+struct timer;
+
+typedef void	(*TIMER_FUNC)(struct timer *, void *);
+
+/**
+ * A timer
+ */
+typedef struct timer {
+	struct timer	*next;		/**< Next timer in the slot */
+	struct timer	**pprev;	/**< Link that points to this timer */
+	long		expires;	/**< Tick the timer fires at */
+	struct timer	**slot;		/**< The slot the timer is in */
+	struct timer_wheel *wheel;	/**< The wheel the timer is armed on, NULL if not armed */
+	TIMER_FUNC	func;		/**< Called when the timer fires */
+	void		*data;		/**< Passed to the callback */
+} TIMER;
+
+/**
+ * The timer wheel of a polling thread
+ */
+typedef struct timer_wheel {
+	SPINLOCK	lock;		/**< Protects the slots */
+	long		tick;		/**< The next tick to run */
+	int		n_armed;	/**< Number of armed timers */
+	unsigned long	used[TIMER_LEVELS]; /**< Bitmap of the non-empty slots */
+	TIMER		*slots[TIMER_LEVELS][TIMER_SLOTS];
+	int		n_fired;	/**< Number of timers fired */
+	int		n_cascaded;	/**< Number of timers moved down a level */
+} TIMER_WHEEL;
+
+extern void	timer_init(TIMER *, TIMER_FUNC, void *);
+extern void	timer_arm(TIMER *, int, long);
+extern void	timer_cancel(TIMER *);
+extern int	timer_armed(TIMER *);
+extern void	timer_wheels_init();
+extern void	timer_run(int);
+extern int	timer_next_timeout(int, int);
+extern void	dprintTimers(struct dcb *);
+#endif
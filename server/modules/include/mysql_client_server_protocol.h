@@ -124,6 +124,8 @@ typedef struct {
                                                          * created or received */
 	unsigned	long tid;                       /*< MySQL Thread ID, in
                                                          * handshake */
+	GWBUF		*pending;                       /*< Incomplete packet waiting
+                                                         * for the rest of its data */
 #if defined(SS_DEBUG)
         skygw_chk_t     protocol_chk_tail;
 #endif
@@ -303,5 +305,5 @@ int  gw_generate_random_str(char *output, int len);
 char *gw_strend(register const char *s);
 int  setnonblocking(int fd);
 int	setipaddress(struct in_addr *a, char *p);
-int  gw_read_gwbuff(DCB *dcb, GWBUF **head, int b);
+int  gw_read_gwbuff(DCB *dcb, GWBUF **head);
 GWBUF* gw_MySQL_get_next_stmt(GWBUF** p_readbuf);
@@ -30,6 +30,7 @@
  * @endverbatim
  */
 #include <dcb.h>
+#include <statistics.h>
 
 /**
  * Internal structure used to define the set of backend servers we are routing
@@ -61,12 +62,16 @@ typedef struct router_client_session {
 } ROUTER_CLIENT_SES;
 
 /**
- * The statistics for this router instance
+ * The statistics for this router instance, kept per polling thread
  */
 typedef struct {
 	int		n_sessions;	/*< Number sessions created     */
 	int		n_queries;	/*< Number of queries forwarded */
-} ROUTER_STATS;
+	int		n_spliced;	/*< Number of sessions spliced  */
+} STATS_ALIGNED ROUTER_STATS;
+
+/** The statistics of the calling thread */
+#define	ROUTER_THREAD_STATS(inst)	(&(inst)->stats[stats_thread_id()])
 
 
 /**
@@ -79,7 +84,8 @@ typedef struct router_instance {
 	BACKEND		  **servers;    /*< List of backend servers                  */
 	unsigned int	  bitmask;	/*< Bitmask to apply to server->status       */
 	unsigned int	  bitvalue;	/*< Required value of server->status         */
-	ROUTER_STATS	  stats;	/*< Statistics for this router               */
+	int		  splice;	/*< Splice sessions after the first reply    */
+	ROUTER_STATS	  *stats;	/*< Per thread statistics for this router    */
 	struct router_instance
                           *next;
 } ROUTER_INSTANCE;
@@ -30,6 +30,7 @@
  */
 
 #include <dcb.h>
+#include <statistics.h>
 
 /**
  * Internal structure used to define the set of backend servers we are routing
@@ -69,6 +70,8 @@ typedef struct mysql_sescmd_st {
 #endif
 	rses_property_t*   my_sescmd_prop;       /*< parent property */
         GWBUF*             my_sescmd_buf;        /*< query buffer */
+        SESSION*           my_sescmd_session;    /*< session the buffer is
+                                                  * accounted to */
         unsigned char      my_sescmd_packet_type;/*< packet type */
 	bool               my_sescmd_is_replied; /*< is cmd replied to client */
 #if defined(SS_DEBUG)
@@ -122,6 +125,7 @@ struct router_client_session {
 	/*< cursor is pointer and status variable to current session command */
 	sescmd_cursor_t  rses_cursor[BE_COUNT];
         int              rses_capabilities; /*< input type, for example */
+        SESSION*         rses_session;   /*< the client session              */
         struct router_client_session* next;
 #if defined(SS_DEBUG)
         skygw_chk_t      rses_chk_tail;
@@ -129,7 +133,7 @@ struct router_client_session {
 };
 
 /**
- * The statistics for this router instance
+ * The statistics for this router instance, kept per polling thread
  */
 typedef struct {
 	int		n_sessions;	/*< Number sessions created        */
@@ -137,7 +141,10 @@ typedef struct {
 	int		n_master;	/*< Number of stmts sent to master */
 	int		n_slave;	/*< Number of stmts sent to slave  */
 	int		n_all;		/*< Number of stmts sent to all    */
-} ROUTER_STATS;
+} STATS_ALIGNED ROUTER_STATS;
+
+/** The statistics of the calling thread */
+#define	ROUTER_THREAD_STATS(inst)	(&(inst)->stats[stats_thread_id()])
 
 
 /**
@@ -151,7 +158,7 @@ typedef struct router_instance {
 	BACKEND*                master;      /*< NULL or pointer                    */
         unsigned int	        bitmask;     /*< Bitmask to apply to server->status */
 	unsigned int	        bitvalue;    /*< Required value of server->status   */
-	ROUTER_STATS            stats;       /*< Statistics for this router         */
+	ROUTER_STATS*           stats;       /*< Per thread statistics for this router */
         struct router_instance* next;        /*< Next router on the list            */
 } ROUTER_INSTANCE;
 
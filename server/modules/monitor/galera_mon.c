@@ -119,7 +119,7 @@ MYSQL_MONITOR *handle;
 		handle->shutdown = 0;
 		handle->defaultUser = NULL;
 		handle->defaultPasswd = NULL;
-		spinlock_init(&handle->lock);
+		spinlock_init_named(&handle->lock, "galera_mon lock");
 	}
 	handle->tid = thread_start(monitorMain, handle);
 	return handle;
@@ -124,7 +124,7 @@ MYSQL_MONITOR *handle;
             handle->shutdown = 0;
             handle->defaultUser = NULL;
             handle->defaultPasswd = NULL;
-            spinlock_init(&handle->lock);
+            spinlock_init_named(&handle->lock, "mysql_mon lock");
         }
         handle->tid = thread_start(monitorMain, handle);
         return handle;
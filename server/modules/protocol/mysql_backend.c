@@ -20,6 +20,7 @@
 #include <skygw_types.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
+#include <config.h>
 /*
  * MySQL Protocol module for handling the protocol between the gateway
  * and the backend MySQL database.
@@ -243,6 +244,7 @@ static int gw_read_backend_event(DCB *dcb) {
                                 switch (receive_rc) {
                                 case -1:
                                         backend_protocol->state = MYSQL_AUTH_FAILED;
+                                        dcb_set_timeout(dcb, 0);
 
                                         LOGIF(LE, (skygw_log_write_flush(
                                                 LOGFILE_ERROR,
@@ -253,6 +255,7 @@ static int gw_read_backend_event(DCB *dcb) {
                                         break;
                                 case 1:
                                         backend_protocol->state = MYSQL_IDLE;
+                                        dcb_set_timeout(dcb, 0);
                                         
                                         LOGIF(LD, (skygw_log_write_flush(
                                                 LOGFILE_DEBUG,
@@ -296,6 +299,9 @@ static int gw_read_backend_event(DCB *dcb) {
                                                 0,
                                                 "Connection to backend lost.");
                                         // consume all the delay queue
+                                        dcb_mem_account(
+                                                dcb,
+                                                -(int)gwbuf_length(dcb->delayq));
 				       while ((dcb->delayq = gwbuf_consume(
                                                 dcb->delayq,
                                                 GWBUF_LENGTH(dcb->delayq))) != NULL);
@@ -396,6 +402,8 @@ static int gw_read_backend_event(DCB *dcb) {
                         rc = 0;
                         goto return_rc;
                 }
+                /*< The backend has started to reply */
+                dcb_set_timeout(dcb, 0);
                 router = session->service->router;
                 router_instance = session->service->router_instance;
                 rsession = session->router_session;
@@ -558,13 +566,16 @@ gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
                 {
                         size_t   len;
                         char*    str;
-                        uint8_t* packet = (uint8_t *)queue->start;
-                        uint8_t* startpoint;
+                        uint8_t  packet[4];
                         
+                        gwbuf_copy_data(queue, 0, sizeof(packet), packet);
                         len = (size_t)MYSQL_GET_PACKET_LEN(packet);
-                        startpoint = &packet[5];
                         str = (char *)malloc(len+1);
-                        snprintf(str, len+1, "%s", startpoint);
+                        len = (len == 0 ? 0 : gwbuf_copy_data(queue,
+                                                              5,
+                                                              len-1,
+                                                              (uint8_t *)str));
+                        str[len] = '\0';
                         LOGIF(LE, (skygw_log_write_flush(
                                 LOGFILE_ERROR,
                                 "Error : Routing query \"%s\" failed due to "
@@ -591,6 +602,7 @@ gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue)
                                 dcb->fd,
                                 STRPROTOCOLSTATE(backend_protocol->state))));
                         spinlock_release(&dcb->authlock);
+                        dcb_set_timeout(dcb, config_query_timeout() * 1000);
                         rc = dcb_write(dcb, queue);
                         goto return_rc;
                         break;
@@ -775,7 +787,11 @@ static int gw_create_backend_connection(
                                 session->client->fd)));
 			break;
 	} /*< switch */
-        
+
+        /*< The connection and authentication must complete in time */
+        if (fd != -1)
+                dcb_set_timeout(backend_dcb,
+                                config_backend_connect_timeout() * 1000);
 return_fd:
 	return fd;
 }
@@ -820,6 +836,10 @@ gw_backend_close(DCB *dcb)
 static void backend_set_delayqueue(DCB *dcb, GWBUF *queue) {
 	spinlock_acquire(&dcb->delayqlock);
 
+	if (queue != NULL) {
+		dcb_mem_account(dcb, gwbuf_length(queue));
+	}
+
 	if (dcb->delayq) {
 		/* Append data */
 		dcb->delayq = gwbuf_append(dcb->delayq, queue);
@@ -851,6 +871,11 @@ static int backend_write_delayqueue(DCB *dcb)
 	dcb->delayq = NULL;
 
 	spinlock_release(&dcb->delayqlock);
+
+	if (localq != NULL) {
+		/*< What can not be sent is accounted to the write queue */
+		dcb_mem_account(dcb, -(int)gwbuf_length(localq));
+	}
         rc = dcb_write(dcb, localq);
 
         if (rc == 0) {
@@ -36,17 +36,28 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <mysql_client_server_protocol.h>
 #include <gw.h>
+#include <statistics.h>
+#include <config.h>
+#include <netinet/tcp.h>
+
+#define	GW_ACCEPT_BATCH	32	/*< Connections accepted before they are set up */
 
 extern int lm_enabled_logfiles_bitmask;
 
 static char *version_str = "V1.0.0";
+static SLAB_CACHE *session_data_cache = NULL;
 
 static int gw_MySQLAccept(DCB *listener);
+static void gw_MySQLAcceptClient(DCB *listener, int c_sock, struct sockaddr *client_conn, long start);
+static void gw_MySQLAcceptPosted(void *arg1, void *arg2);
+static void gw_MySQLAcceptSetup(DCB *client_dcb, long start);
 static int gw_MySQLListener(DCB *listener, char *config_bind);
+static int gw_MySQLListenerShards(DCB *listener, struct sockaddr_in *serv_addr);
 static int gw_read_client_event(DCB* dcb);
 static int gw_write_client_event(DCB *dcb);
 static int gw_MySQLWrite_client(DCB *dcb, GWBUF *queue);
@@ -61,7 +72,9 @@ static int route_by_statement(
         ROUTER*         router_instance, 
         ROUTER_OBJECT*  router,
         void*           rsession,
-        GWBUF*          read_buf);
+        MySQLProtocol*  protocol,
+        GWBUF*          read_buf,
+        long            read_time);
 
 /*
  * The "module object" for the mysqld client protocol module.
@@ -378,8 +391,13 @@ static int gw_mysql_do_authentication(DCB *dcb, GWBUF *queue) {
 
         protocol = DCB_PROTOCOL(dcb, MySQLProtocol);
         CHK_PROTOCOL(protocol);
-	client_data = (MYSQL_session *)calloc(1, sizeof(MYSQL_session));
+	if (session_data_cache == NULL)
+		session_data_cache = slab_cache_alloc("MYSQL_session",
+						      sizeof(MYSQL_session));
+	if ((client_data = (MYSQL_session *)slab_alloc(session_data_cache)) == NULL)
+		return 1;
 	dcb->data = client_data; 
+	dcb->data_cache = session_data_cache;
 
 	stage1_hash = client_data->client_sha1;
 	username = client_data->user;
@@ -479,6 +497,11 @@ static int gw_mysql_do_authentication(DCB *dcb, GWBUF *queue) {
 int
 gw_MySQLWrite_client(DCB *dcb, GWBUF *queue)
 {
+MySQLProtocol	*protocol = DCB_PROTOCOL(dcb, MySQLProtocol);
+
+	/*< The client is idle again from the last reply on */
+	if (protocol != NULL && protocol->state == MYSQL_IDLE)
+		dcb_set_timeout(dcb, config_client_idle_timeout() * 1000);
 	return dcb_write(dcb, queue);
 }
 
@@ -494,61 +517,11 @@ int gw_read_client_event(DCB* dcb) {
 	ROUTER         *router_instance = NULL;
 	void           *rsession = NULL;
 	MySQLProtocol  *protocol = NULL;
-	int             b = -1;
         int             rc = 0;
 
         CHK_DCB(dcb);
         protocol = DCB_PROTOCOL(dcb, MySQLProtocol);
         CHK_PROTOCOL(protocol);
-        /**
-         * Check how many bytes are readable in dcb->fd.
-         */
-        if (ioctl(dcb->fd, FIONREAD, &b) != 0) {
-                int eno = errno;
-                errno = 0;
-
-                LOGIF(LE, (skygw_log_write(
-                        LOGFILE_ERROR,
-                        "%lu [gw_read_client_event] ioctl FIONREAD for fd "
-                        "%d failed. errno %d, %s. dcb->state = %d",
-                        pthread_self(),
-                        dcb->fd,
-                        eno,
-                        strerror(eno),
-                        dcb->state)));
-                rc = 1;
-                goto return_rc;
-        }
-        
-	/*
-	 * Handle the closed client socket.
-	 */
-
-	if (b == 0) {
-		char c;
-		int l_errno = 0;
-		int r = -1;
-
-		rc = 0;
-
-		/* try to read 1 byte, without consuming the socket buffer */
-		r = recv(dcb->fd, &c, sizeof(char), MSG_PEEK);
-		l_errno = errno;
-
-		if (r <= 0) {
-			if ( (l_errno == EAGAIN) || (l_errno == EWOULDBLOCK)) {
-				goto return_rc;
-			}
-
-			// close client socket and the sessioA too
-			dcb->func.close(dcb);
-		} else {
-			// do nothing if reading 1 byte
-		}
-
-		goto return_rc;
-	}
-
 	switch (protocol->state) {
         case MYSQL_AUTH_SENT:
                 /*
@@ -561,11 +534,11 @@ int gw_read_client_event(DCB* dcb) {
                 int    auth_val = -1;
                 //////////////////////////////////////////////////////
                 // read and handle errors & close, or return if busy
-                // note: if b == 0 error handling is not
-                // triggered, just return
-                // without closing
+                // note: if nothing was read error handling is not
+                // triggered, just return without closing.
+                // A closed client socket is closed here too.
                 //////////////////////////////////////////////////////
-                rc = gw_read_gwbuff(dcb, &gw_buffer, b); 
+                rc = gw_read_gwbuff(dcb, &gw_buffer); 
                 
                 if (rc != 0) {
                         goto return_rc;
@@ -625,11 +598,10 @@ int gw_read_client_event(DCB* dcb) {
                  * Read all the data that is available into a chain of buffers
                  */
         {
-                int      len = -1;
                 uint8_t  cap = 0;
                 GWBUF   *read_buffer = NULL;
-                uint8_t *ptr_buff = NULL;
                 int      mysql_command = -1;
+                long     read_time;
                 bool     stmt_input; /*< router input type */
                 
                 session = dcb->session;
@@ -646,20 +618,26 @@ int gw_read_client_event(DCB* dcb) {
                 //////////////////////////////////////////////////////
                 // read and handle errors & close, or return if busy
                 //////////////////////////////////////////////////////
-                rc = gw_read_gwbuff(dcb, &read_buffer, b); 
+                rc = gw_read_gwbuff(dcb, &read_buffer); 
                 
                 if (rc != 0) {
                         goto return_rc;
                 }
-                /* Now, we are assuming in the first buffer there is
-                 * the information form mysql command */
-                len = GWBUF_LENGTH(read_buffer);
-                ptr_buff = GWBUF_DATA(read_buffer);
-                
-                /* get mysql commang at fifth byte */
-                if (ptr_buff) {
-                        mysql_command = ptr_buff[4];
-                }                
+                read_time = stats_usecs();
+                /*< The client is not idle while its query is served */
+                dcb_set_timeout(dcb, 0);
+                /*< Complete the packet left over from the previous read */
+                if (protocol->pending != NULL)
+                {
+                        dcb_mem_account(dcb,
+                                        -(int)gwbuf_length(protocol->pending));
+                        read_buffer = gwbuf_append(protocol->pending,
+                                                   read_buffer);
+                        protocol->pending = NULL;
+                }
+                /*< The command is recorded for the router to reuse */
+                mysql_command = gwbuf_mysql_command(read_buffer);
+                gwbuf_set_info(read_buffer, GWBUF_INFO_TIMESTAMP, read_time);
                 /**
                  * Without rsession there is no access to backend.
                  * COM_QUIT : close client dcb
@@ -688,7 +666,12 @@ int gw_read_client_event(DCB* dcb) {
                         }
                         rc = 1;
                         /** Free buffer */
-                        read_buffer = gwbuf_consume(read_buffer, len);                
+                        while (read_buffer != NULL)
+                        {
+                                read_buffer = gwbuf_consume(
+                                        read_buffer,
+                                        GWBUF_LENGTH(read_buffer));
+                        }
                         goto return_rc;
                 }
                 /** Ask what type of input the router expects */
@@ -749,7 +732,15 @@ int gw_read_client_event(DCB* dcb) {
                                 rc = route_by_statement(router_instance,
                                                         router,
                                                         rsession,
-                                                        read_buffer);       
+                                                        protocol,
+                                                        read_buffer,
+                                                        read_time);       
+                                if (protocol->pending != NULL)
+                                {
+                                        dcb_mem_account(
+                                                dcb,
+                                                gwbuf_length(protocol->pending));
+                                }
                         }
                         else
                         {
@@ -758,6 +749,8 @@ int gw_read_client_event(DCB* dcb) {
                                                 rsession,
                                                 read_buffer);
                         }
+                        hist_add(&stats_thread()->route_time,
+                                 stats_usecs() - read_time);
                                        
                         /** succeed */
                         if (rc == 1) {
@@ -907,6 +900,16 @@ int gw_MySQLListener(
 
 	// socket options
 	setsockopt(l_so, SOL_SOCKET, SO_REUSEADDR, (char *)&one, sizeof(one));
+#if defined(SO_REUSEPORT)
+	/**
+	 * With an epoll set per polling thread each thread listens on a
+	 * socket of its own and the kernel spreads the connections.
+	 */
+	if (current_addr->sa_family == AF_INET && poll_n_epoll_sets() > 1)
+	{
+		setsockopt(l_so, SOL_SOCKET, SO_REUSEPORT, (char *)&one, sizeof(one));
+	}
+#endif
 
 	// set NONBLOCKING mode
 	setnonblocking(l_so);
@@ -979,70 +982,186 @@ int gw_MySQLListener(
 #endif
 	listen_dcb->func.accept = gw_MySQLAccept;
 
+	if (current_addr->sa_family == AF_INET && poll_n_epoll_sets() > 1)
+	{
+		gw_MySQLListenerShards(listen_dcb, &serv_addr);
+	}
 	return 1;
 }
 
-
-/** 
- * @node (write brief function description here) 
+/**
+ * Create a listener for each of the other polling threads when every
+ * polling thread has an epoll set of its own. The sockets are bound to
+ * the same address with SO_REUSEPORT, the kernel balances the incoming
+ * connections across them and each client is served by the thread that
+ * accepted it.
  *
- * Parameters:
- * @param listener - <usage>
- *          <description>
+ * The extra listeners are chained to the first one in next_listener. If
+ * a listener can not be created the remaining threads do not accept
+ * connections themselves but still serve the backends of their sessions.
  *
- * @return 0 in success, 1 in failure
+ * @param listen_dcb	The listener of polling thread 0
+ * @param serv_addr	The address the listener is bound to
+ * @return		The number of extra listeners created
+ */
+static int
+gw_MySQLListenerShards(
+        DCB                *listen_dcb,
+        struct sockaddr_in *serv_addr)
+{
+#if defined(SO_REUSEPORT)
+        DCB  *shard_dcb;
+        DCB  *prev = listen_dcb;
+        int  l_so;
+        int  one = 1;
+        int  n_shards = 0;
+        int  i;
+
+        for (i = 1; i < poll_n_epoll_sets(); i++)
+        {
+                if ((l_so = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+                {
+                        break;
+                }
+                setsockopt(l_so, SOL_SOCKET, SO_REUSEADDR, (char *)&one, sizeof(one));
+                setsockopt(l_so, SOL_SOCKET, SO_REUSEPORT, (char *)&one, sizeof(one));
+                setnonblocking(l_so);
+
+                if (bind(l_so, (struct sockaddr *)serv_addr, sizeof(*serv_addr)) < 0 ||
+                    listen(l_so, 10 * SOMAXCONN) != 0 ||
+                    (shard_dcb = dcb_alloc(DCB_ROLE_SERVICE_LISTENER)) == NULL)
+                {
+                        close(l_so);
+                        break;
+                }
+                memcpy(&shard_dcb->func, &listen_dcb->func, sizeof(GWPROTOCOL));
+                shard_dcb->fd = l_so;
+                shard_dcb->thread_id = i;
+
+                if (poll_add_dcb(shard_dcb) == -1)
+                {
+                        shard_dcb->fd = -1;
+                        close(l_so);
+                        dcb_set_state(shard_dcb, DCB_STATE_DISCONNECTED, NULL);
+                        dcb_free(shard_dcb);
+                        break;
+                }
+#if defined(SS_DEBUG)
+                conn_open[l_so] = true;
+#endif
+                prev->next_listener = shard_dcb;
+                prev = shard_dcb;
+                n_shards += 1;
+        }
+
+        if (n_shards + 1 < poll_n_epoll_sets())
+        {
+                int eno = errno;
+                errno = 0;
+                LOGIF(LE, (skygw_log_write_flush(
+                        LOGFILE_ERROR,
+                        "Error : Only %d of %d polling threads listen for "
+                        "MySQL connections, creating a listener failed due "
+                        "%d, %s.",
+                        n_shards + 1,
+                        poll_n_epoll_sets(),
+                        eno,
+                        strerror(eno))));
+        }
+        return n_shards;
+#else
+        return 0;
+#endif
+}
+
+
+/**
+ * Record the number of connections waiting in the backlog of a listener
+ * when the listener reports new connections. For a listening TCP socket
+ * tcpi_unacked holds the length of the accept queue.
  *
- * 
- * @details (write detailed description here)
+ * @param listener	The listener DCB
+ */
+static void
+gw_MySQLAcceptBacklog(DCB *listener)
+{
+#if defined(TCP_INFO)
+        struct tcp_info info;
+        socklen_t       len = sizeof(info);
+
+        if (getsockopt(listener->fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0)
+        {
+                hist_add(&stats_thread()->accept_backlog, info.tcpi_unacked);
+        }
+#endif
+}
+
+/**
+ * Accept the connections waiting on a listener. The backlog is drained in
+ * batches of up to GW_ACCEPT_BATCH connections with accept4, which makes
+ * the sockets non-blocking at no extra cost. Each connection of a batch is
+ * then handed to the polling thread chosen by poll_accept_thread, which
+ * sends the handshake and serves the client.
  *
+ * @param listener	The listener DCB
+ * @return		1 once the backlog has been drained or accept failed
  */
 int gw_MySQLAccept(DCB *listener)
 {
         int                rc = 0;
-        DCB                *client_dcb;
-        MySQLProtocol      *protocol;
-        int                c_sock;
-	struct sockaddr    client_conn;
-	socklen_t          client_len = sizeof(struct sockaddr_storage);
-        int                sendbuf = GW_BACKEND_SO_SNDBUF;
-        socklen_t          optlen = sizeof(sendbuf);
+        int                c_sock[GW_ACCEPT_BATCH];
+	struct sockaddr_storage client_conn[GW_ACCEPT_BATCH];
+	socklen_t          client_len;
+        int                n_socks;
+        int                n_accepted = 0;
         int                eno = 0;
         int                i = 0;
+        int                j;
+        int                fd;
+        long               start;
                 
         CHK_DCB(listener);
+        gw_MySQLAcceptBacklog(listener);
         
-	while (1) {
-
-    retry_accept:
+	while (rc == 0) {
+                n_socks = 0;
 
+                while (n_socks < GW_ACCEPT_BATCH) {
 #if defined(SS_DEBUG)
-                if (fail_next_accept > 0)
-                {
-                        c_sock = -1;
-                        eno = fail_accept_errno;
-                        fail_next_accept -= 1;
-                } else {
-                        fail_accept_errno = 0;          
+                        if (fail_next_accept > 0)
+                        {
+                                fd = -1;
+                                eno = fail_accept_errno;
+                                fail_next_accept -= 1;
+                        } else {
+                                fail_accept_errno = 0;          
 #endif /* SS_DEBUG */
-                        // new connection from client
-		        c_sock = accept(listener->fd,
-                                        (struct sockaddr *) &client_conn,
-                                        &client_len);
-                        eno = errno;
-                        errno = 0;
+                                // new connection from client
+                                client_len = sizeof(struct sockaddr_storage);
+                                fd = accept4(listener->fd,
+                                             (struct sockaddr *)&client_conn[n_socks],
+                                             &client_len,
+                                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+                                eno = errno;
+                                errno = 0;
 #if defined(SS_DEBUG)
-                }
+                        }
 #endif /* SS_DEBUG */
-                        
-                if (c_sock == -1) {
-                        
+                        if (fd != -1)
+                        {
+                                /* reset counter */
+                                i = 0;
+                                c_sock[n_socks++] = fd;
+                                continue;
+                        }
+                        rc = 1;
+
                         if (eno == EAGAIN || eno == EWOULDBLOCK)
                         {
                                 /**
                                  * We have processed all incoming connections.
                                  */
-                                rc = 1;
-                                goto return_rc;
+                                break;
                         }
                         else if (eno == ENFILE || eno == EMFILE)
                         {
@@ -1071,10 +1190,10 @@ int gw_MySQLAccept(DCB *listener)
                                 usleep(100*i*i);
                                 
                                 if (i<10) {
-                                        goto retry_accept;
+                                        rc = 0;
+                                        continue;
                                 }
-                                rc = 1;
-                                goto return_rc;
+                                break;
                         }
                         else
                         {
@@ -1093,128 +1212,188 @@ int gw_MySQLAccept(DCB *listener)
                                         "Failed to accept new client connection.",
                                         eno,
                                         strerror(eno))));
-                                rc = 1;
-                                goto return_rc;
+                                break;
                         } /* if (eno == ..) */
-		} /* if (c_sock == -1) */
-                /* reset counter */
-                i = 0;
-                
-                listener->stats.n_accepts++;
+                } /* while (n_socks < GW_ACCEPT_BATCH) */
+
+                start = stats_usecs();
+                for (j = 0; j < n_socks; j++)
+                {
+                        gw_MySQLAcceptClient(listener,
+                                             c_sock[j],
+                                             (struct sockaddr *)&client_conn[j],
+                                             start);
+                }
+                n_accepted += n_socks;
+        } /**< while (rc == 0) */
+
+        hist_add(&stats_thread()->accept_batch, n_accepted);
+        return rc;
+}
+
+/**
+ * Create the DCB of an accepted client connection and hand it to the
+ * polling thread that is to serve it.
+ *
+ * @param listener	The listener DCB
+ * @param c_sock	The socket of the client
+ * @param client_conn	The address of the client
+ * @param start		Time of the accept in usecs
+ */
+static void
+gw_MySQLAcceptClient(
+        DCB             *listener,
+        int             c_sock,
+        struct sockaddr *client_conn,
+        long            start)
+{
+        DCB                *client_dcb;
+        int                sendbuf = GW_BACKEND_SO_SNDBUF;
+        socklen_t          optlen = sizeof(sendbuf);
+
+        listener->stats.n_accepts++;
 #if defined(SS_DEBUG)
-                LOGIF(LD, (skygw_log_write_flush(
-                        LOGFILE_DEBUG,
-                        "%lu [gw_MySQLAccept] Accepted fd %d.",
-                        pthread_self(),
-                        c_sock)));
-                conn_open[c_sock] = true;
+        LOGIF(LD, (skygw_log_write_flush(
+                LOGFILE_DEBUG,
+                "%lu [gw_MySQLAccept] Accepted fd %d.",
+                pthread_self(),
+                c_sock)));
+        conn_open[c_sock] = true;
 #endif
-                /* set nonblocking  */
-                setsockopt(c_sock, SOL_SOCKET, SO_SNDBUF, &sendbuf, optlen);
-                setnonblocking(c_sock);
-                
-                client_dcb = dcb_alloc(DCB_ROLE_REQUEST_HANDLER);
-
-		if (client_dcb == NULL) {
-			LOGIF(LE, (skygw_log_write_flush(
-				LOGFILE_ERROR,
-				"%lu [gw_MySQLAccept] Failed to create "
-				"dcb object for client connection.",
-				pthread_self())));
-			rc = 1;
-			goto return_rc;
-		}
+        setsockopt(c_sock, SOL_SOCKET, SO_SNDBUF, &sendbuf, optlen);
+        
+        client_dcb = dcb_alloc(DCB_ROLE_REQUEST_HANDLER);
 
-                client_dcb->service = listener->session->service;
-                client_dcb->fd = c_sock;
-
-		// get client address
-		if ( client_conn.sa_family == AF_UNIX) {
-			// client address
-			client_dcb->remote = strdup("localhost_from_socket");
-			// set localhost IP for user authentication
-  			(client_dcb->ipv4).sin_addr.s_addr = 0x0100007F;
-		} else {
-  			/* client IPv4 in raw data*/
-			memcpy(&client_dcb->ipv4, (struct sockaddr_in *)&client_conn, sizeof(struct sockaddr_in));	
-			/* client IPv4 in string representation */
-			client_dcb->remote = (char *)calloc(INET_ADDRSTRLEN+1, sizeof(char));
-			if (client_dcb->remote != NULL) {
-				inet_ntop(AF_INET, &(client_dcb->ipv4).sin_addr, client_dcb->remote, INET_ADDRSTRLEN);
-			}
-		}
+        if (client_dcb == NULL) {
+                LOGIF(LE, (skygw_log_write_flush(
+                        LOGFILE_ERROR,
+                        "%lu [gw_MySQLAccept] Failed to create "
+                        "dcb object for client connection.",
+                        pthread_self())));
+                close(c_sock);
+                return;
+        }
 
-                protocol = mysql_protocol_init(client_dcb, c_sock);
+        client_dcb->service = listener->session->service;
+        client_dcb->fd = c_sock;
 
-                ss_dassert(protocol != NULL);
-                
-                if (protocol == NULL) {
-                        /** delete client_dcb */
-                        dcb_close(client_dcb);
-                        LOGIF(LE, (skygw_log_write_flush(
-                                LOGFILE_ERROR,
-                                "%lu [gw_MySQLAccept] Failed to create "
-                                "protocol object for client connection.",
-                                pthread_self())));
-                        rc = 1;
-                        goto return_rc;
+        // get client address
+        if ( client_conn->sa_family == AF_UNIX) {
+                // client address
+                client_dcb->remote = strdup("localhost_from_socket");
+                // set localhost IP for user authentication
+                (client_dcb->ipv4).sin_addr.s_addr = 0x0100007F;
+        } else {
+                /* client IPv4 in raw data*/
+                memcpy(&client_dcb->ipv4, (struct sockaddr_in *)client_conn, sizeof(struct sockaddr_in));	
+                /* client IPv4 in string representation */
+                client_dcb->remote = (char *)calloc(INET_ADDRSTRLEN+1, sizeof(char));
+                if (client_dcb->remote != NULL) {
+                        inet_ntop(AF_INET, &(client_dcb->ipv4).sin_addr, client_dcb->remote, INET_ADDRSTRLEN);
                 }
-                client_dcb->protocol = protocol;
-                // assign function poiters to "func" field
-                memcpy(&client_dcb->func, &MyObject, sizeof(GWPROTOCOL));
-                //send handshake to the client_dcb
-                MySQLSendHandshake(client_dcb);
+        }
 
-                // client protocol state change
-                protocol->state = MYSQL_AUTH_SENT;
+        /**
+         * The thread is recorded in thread_id until the DCB is added to
+         * the event set, which makes the thread the owner.
+         */
+        client_dcb->thread_id = poll_accept_thread();
 
-                /**
-                 * Set new descriptor to event set. At the same time,
-                 * change state to DCB_STATE_POLLING so that
-                 * thread which wakes up sees correct state.
-                 */
-                if (poll_add_dcb(client_dcb) == -1)
-                {
-                        /* Send a custom error as MySQL command reply */
-                        mysql_send_custom_error(
-                                client_dcb,
-                                1,
-                                0,
-                                "MaxScale internal error.");
-                        
-                        /** delete client_dcb */
-                        dcb_close(client_dcb);
-
-                        /** Previous state is recovered in poll_add_dcb. */
-                        LOGIF(LE, (skygw_log_write_flush(
-                                LOGFILE_ERROR,
-                                "%lu [gw_MySQLAccept] Failed to add dcb %p for "
-                                "fd %d to epoll set.",
-                                pthread_self(),
-                                client_dcb,
-                                client_dcb->fd)));
-                        rc = 1;
-                        goto return_rc;
-                }
-                else
-                {
-                        LOGIF(LD, (skygw_log_write(
-                                LOGFILE_DEBUG,
-                                "%lu [gw_MySQLAccept] Added dcb %p for fd "
-                                "%d to epoll set.",
-                                pthread_self(),
-                                client_dcb,
-                                client_dcb->fd)));
-                }
-        } /**< while 1 */
-#if defined(SS_DEBUG)
-        if (rc == 0) {
-                CHK_DCB(client_dcb);
-                CHK_PROTOCOL(((MySQLProtocol *)client_dcb->protocol));
+        if (client_dcb->thread_id == poll_current_thread() ||
+            poll_post(client_dcb->thread_id,
+                      gw_MySQLAcceptPosted,
+                      client_dcb,
+                      (void *)start) != 0)
+        {
+                gw_MySQLAcceptSetup(client_dcb, start);
         }
-#endif
-return_rc:
-        return rc;
+}
+
+/**
+ * Set up a client handed to a polling thread by gw_MySQLAcceptClient
+ *
+ * @param arg1	The client DCB
+ * @param arg2	Time of the accept in usecs
+ */
+static void
+gw_MySQLAcceptPosted(void *arg1, void *arg2)
+{
+        gw_MySQLAcceptSetup((DCB *)arg1, (long)arg2);
+}
+
+/**
+ * Send the handshake to a new client and add its DCB to the event set of
+ * the calling polling thread, which then serves the client and the
+ * backends of its session.
+ *
+ * @param client_dcb	The client DCB
+ * @param start		Time of the accept in usecs
+ */
+static void
+gw_MySQLAcceptSetup(DCB *client_dcb, long start)
+{
+        MySQLProtocol      *protocol;
+
+        poll_accept_done(client_dcb->thread_id);
+        protocol = mysql_protocol_init(client_dcb, client_dcb->fd);
+
+        ss_dassert(protocol != NULL);
+        
+        if (protocol == NULL) {
+                /** delete client_dcb */
+                dcb_close(client_dcb);
+                LOGIF(LE, (skygw_log_write_flush(
+                        LOGFILE_ERROR,
+                        "%lu [gw_MySQLAccept] Failed to create "
+                        "protocol object for client connection.",
+                        pthread_self())));
+                return;
+        }
+        client_dcb->protocol = protocol;
+        // assign function poiters to "func" field
+        memcpy(&client_dcb->func, &MyObject, sizeof(GWPROTOCOL));
+        //send handshake to the client_dcb
+        MySQLSendHandshake(client_dcb);
+
+        // client protocol state change
+        protocol->state = MYSQL_AUTH_SENT;
+
+        /**
+         * Set new descriptor to event set. At the same time,
+         * change state to DCB_STATE_POLLING so that
+         * thread which wakes up sees correct state.
+         */
+        if (poll_add_dcb(client_dcb) == -1)
+        {
+                /* Send a custom error as MySQL command reply */
+                mysql_send_custom_error(
+                        client_dcb,
+                        1,
+                        0,
+                        "MaxScale internal error.");
+                
+                /** delete client_dcb */
+                dcb_close(client_dcb);
+
+                /** Previous state is recovered in poll_add_dcb. */
+                LOGIF(LE, (skygw_log_write_flush(
+                        LOGFILE_ERROR,
+                        "%lu [gw_MySQLAccept] Failed to add dcb %p for "
+                        "fd %d to epoll set.",
+                        pthread_self(),
+                        client_dcb,
+                        client_dcb->fd)));
+                return;
+        }
+        LOGIF(LD, (skygw_log_write(
+                LOGFILE_DEBUG,
+                "%lu [gw_MySQLAccept] Added dcb %p for fd "
+                "%d to epoll set.",
+                pthread_self(),
+                client_dcb,
+                client_dcb->fd)));
+        dcb_set_timeout(client_dcb, config_client_auth_timeout() * 1000);
+        hist_add(&stats_thread()->handshake_time, stats_usecs() - start);
 }
 
 static int gw_error_client_event(DCB *dcb) {
@@ -1222,9 +1401,9 @@ static int gw_error_client_event(DCB *dcb) {
         ROUTER_OBJECT* router;
         void*          router_instance;
         void*          rsession;
+        MySQLProtocol* protocol = (MySQLProtocol *)dcb->protocol;
 
 #if defined(SS_DEBUG)
-        MySQLProtocol* protocol = (MySQLProtocol *)dcb->protocol;
         if (dcb->state == DCB_STATE_POLLING ||
             dcb->state == DCB_STATE_NOPOLLING ||
             dcb->state == DCB_STATE_ZOMBIE)
@@ -1246,6 +1425,17 @@ static int gw_error_client_event(DCB *dcb) {
                 rsession = session->router_session;
                 router->closeSession(router_instance, rsession);
         }
+        /** Free the partial statement that never got completed */
+        if (protocol != NULL && protocol->pending != NULL)
+        {
+                dcb_mem_account(dcb, -(int)gwbuf_length(protocol->pending));
+        }
+        while (protocol != NULL && protocol->pending != NULL)
+        {
+                protocol->pending = gwbuf_consume(
+                        protocol->pending,
+                        GWBUF_LENGTH(protocol->pending));
+        }
         dcb_close(dcb);
 	return 1;
 }
@@ -1257,8 +1447,8 @@ gw_client_close(DCB *dcb)
         ROUTER_OBJECT* router;
         void*          router_instance;
         void*          rsession;
-#if defined(SS_DEBUG)
         MySQLProtocol* protocol = (MySQLProtocol *)dcb->protocol;
+#if defined(SS_DEBUG)
         if (dcb->state == DCB_STATE_POLLING ||
             dcb->state == DCB_STATE_NOPOLLING ||
             dcb->state == DCB_STATE_ZOMBIE)
@@ -1280,6 +1470,17 @@ gw_client_close(DCB *dcb)
         
                 router->closeSession(router_instance, rsession);
         }
+        /** Free the partial statement that never got completed */
+        if (protocol != NULL && protocol->pending != NULL)
+        {
+                dcb_mem_account(dcb, -(int)gwbuf_length(protocol->pending));
+        }
+        while (protocol != NULL && protocol->pending != NULL)
+        {
+                protocol->pending = gwbuf_consume(
+                        protocol->pending,
+                        GWBUF_LENGTH(protocol->pending));
+        }
         dcb_close(dcb);
         
 	return 1;
@@ -1338,35 +1539,31 @@ return_rc:
 
 /**
  * Detect if buffer includes partial mysql packet or multiple packets.
- * Store partial packet to pendingqueue. Send complete packets one by one
- * to router.
+ * Store partial packet to protocol's pending buffer. Send complete packets
+ * one by one to router, with the time they were read recorded in them.
  */
 static int route_by_statement(
         ROUTER*         router_instance, 
         ROUTER_OBJECT*  router,
         void*           rsession,
-        GWBUF*          readbuf)
+        MySQLProtocol*  protocol,
+        GWBUF*          readbuf,
+        long            read_time)
 {
-        int            rc = -1;
-        DCB*           master_dcb;
+        int            rc = 1;
         GWBUF*         stmtbuf;
-        uint8_t*       payload;
-        static size_t  len;
         
-        do 
+        while ((stmtbuf = gw_MySQL_get_next_stmt(&readbuf)) != NULL)
         {
-                stmtbuf = gw_MySQL_get_next_stmt(&readbuf);
-                ss_dassert(stmtbuf != NULL);
                 CHK_GWBUF(stmtbuf);
-                
-                payload = (uint8_t *)GWBUF_DATA(stmtbuf);
-                /**
-                 * If message is longer than read data, suspend routing and
-                 * add statement buffer to wait queue.
-                 */
+                gwbuf_set_info(stmtbuf, GWBUF_INFO_TIMESTAMP, read_time);
                 rc = router->routeQuery(router_instance, rsession, stmtbuf);
         }
-        while (readbuf != NULL);
+        /**
+         * If message is longer than read data, keep the partial statement
+         * until the rest of it is read.
+         */
+        protocol->pending = readbuf;
         
         return rc;
 }
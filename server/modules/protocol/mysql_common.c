@@ -41,6 +41,8 @@ extern int gw_write_backend_event(DCB *dcb);
 extern int gw_MySQLWrite_backend(DCB *dcb, GWBUF *queue);
 extern int gw_error_backend_event(DCB *dcb);
 
+static SLAB_CACHE *protocol_cache = NULL;
+
 
 /** 
  * Creates MySQL protocol structure 
@@ -61,7 +63,10 @@ MySQLProtocol* mysql_protocol_init(
 {
         MySQLProtocol* p;
         
-	p = (MySQLProtocol *) calloc(1, sizeof(MySQLProtocol));
+        if (protocol_cache == NULL)
+                protocol_cache = slab_cache_alloc("MySQLProtocol",
+                                                  sizeof(MySQLProtocol));
+	p = (MySQLProtocol *) slab_alloc(protocol_cache);
         ss_dassert(p != NULL);
         
         if (p == NULL) {
@@ -84,6 +89,8 @@ MySQLProtocol* mysql_protocol_init(
         /*< Assign fd with protocol */
         p->fd = fd;
 	p->owner_dcb = dcb;
+        /*< The DCB returns the protocol to the cache when it is freed */
+	dcb->protocol_cache = protocol_cache;
         CHK_PROTOCOL(p);
 return_p:
         return p;
@@ -1280,53 +1287,21 @@ mysql_send_auth_error (DCB *dcb, int packet_number, int in_affected_rows, const
 
 /**
  * Remove the first mysql statement from buffer. Return pointer to the removed
- * statement or NULL if buffer is empty.
- * 
- * Clone buf, calculate the length of included mysql stmt, and point the 
- * statement with cloned buffer. Move the start pointer of buf accordingly
- * so that it only cover the remaining buffer.
+ * statement or NULL if buffer is empty or does not hold a complete statement.
  * 
+ * The statement may span several buffers of the chain and may share its last
+ * buffer with the next statement. Buffers are moved to the statement or
+ * cloned, the data is not copied. *p_readbuf is set to the rest of the chain.
  */
 GWBUF* gw_MySQL_get_next_stmt(
         GWBUF** p_readbuf)
 {
-        GWBUF*         stmtbuf;
-        size_t         buflen;
-        size_t         strlen;
-        uint8_t*       packet;
-        
         if (*p_readbuf == NULL)
         {
-                stmtbuf = NULL;
-                goto return_stmtbuf;
+                return NULL;
         }                
         CHK_GWBUF(*p_readbuf);
         
-        if (GWBUF_EMPTY(*p_readbuf))
-        {
-                stmtbuf = NULL;
-                goto return_stmtbuf;
-        }
-        buflen = GWBUF_LENGTH((*p_readbuf));
-        packet = GWBUF_DATA((*p_readbuf));
-        strlen = MYSQL_GET_PACKET_LEN(packet);
-
-        if (strlen+4 == buflen)
-        {
-                stmtbuf = *p_readbuf;
-                *p_readbuf = NULL;
-                goto return_stmtbuf;
-        }
-        /** vraa :Multi-packet stmt is not supported as of 7.3.14 */
-        if (strlen-1 > buflen-5)
-        {
-                stmtbuf = NULL;
-                goto return_stmtbuf;
-        }
-        stmtbuf = gwbuf_clone_portion(*p_readbuf, 0, strlen+4);
-        *p_readbuf = gwbuf_consume(*p_readbuf, strlen+4);
-        
-return_stmtbuf:
-        return stmtbuf;
+        return gwbuf_mysql_next_packet(p_readbuf);
 }
 
@@ -96,7 +96,7 @@ ModuleInit()
                            LOGFILE_MESSAGE,
                            "Initialise debug CLI router module %s.\n",
                            version_str)));
-	spinlock_init(&instlock);
+	spinlock_init_named(&instlock, "debugcli instlock");
 	instances = NULL;
 }
 
@@ -132,7 +132,7 @@ CLI_INSTANCE	*inst;
 		return NULL;
 
 	inst->service = service;
-	spinlock_init(&inst->lock);
+	spinlock_init_named(&inst->lock, "debugcli lock");
 	inst->sessions = NULL;
 
 
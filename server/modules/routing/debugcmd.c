@@ -52,6 +52,9 @@
 #include <server.h>
 #include <spinlock.h>
 #include <dcb.h>
+#include <slab.h>
+#include <statistics.h>
+#include <timer.h>
 #include <poll.h>
 #include <users.h>
 #include <dbusers.h>
@@ -86,6 +89,8 @@ static	void	telnetdShowUsers(DCB *);
  * The subcommands of the show command
  */
 struct subcommand showoptions[] = {
+	{ "buffers",	0, dprintBufferPools,	"Show the buffer pools, their hit rates and the buffer arena",
+				{0, 0, 0} },
         { "dcbs",	0, dprintAllDCBs,	"Show all descriptor control blocks (network connections)",
 				{0, 0, 0} },
 	{ "dcb",	1, dprintDCB,		"Show a single descriptor control block e.g. show dcb 0x493340",
@@ -94,6 +99,8 @@ struct subcommand showoptions[] = {
 				{ARG_TYPE_ADDRESS, 0, 0} },
 	{ "epoll",	0, dprintPollStats,	"Show the poll statistics",
 				{0, 0, 0} },
+	{ "locks",	0, dprintLocks,		"Show the most contended locks, their wait and hold times",
+				{0, 0, 0} },
 	{ "modules",	0, dprintAllModules,	"Show all currently loaded modules",
 				{0, 0, 0} },
 	{ "monitors",	0, monitorShowAll,	"Show the monitors that are configured",
@@ -108,6 +115,12 @@ struct subcommand showoptions[] = {
 				{ARG_TYPE_ADDRESS, 0, 0} },
 	{ "sessions",	0, dprintAllSessions, 	"Show all active sessions in MaxScale",
 				{0, 0, 0} },
+	{ "slabs",	0, dprintAllSlabCaches,	"Show the object caches and their usage",
+				{0, 0, 0} },
+	{ "threads",	0, dprintThreadStats,	"Show the statistics of each polling thread",
+				{0, 0, 0} },
+	{ "timers",	0, dprintTimers,	"Show the timer wheels of the polling threads",
+				{0, 0, 0} },
 	{ "users",	0, telnetdShowUsers,	"Show statistics and user names for the debug interface",
 				{ARG_TYPE_ADDRESS, 0, 0} },
 	{ NULL,		0, NULL,		NULL,
@@ -38,6 +38,11 @@
  * as slaves. If neither option is specified the router will connect to either
  * masters or slaves.
  *
+ * The "splice" option makes the router step out of a session once the
+ * backend has sent its first reply. From then on the data of the session is
+ * moved between the client and backend sockets by the kernel, without being
+ * read into the gateway, and the queries are no longer counted.
+ *
  * @verbatim
  * Revision History
  *
@@ -78,6 +83,7 @@
 #include <spinlock.h>
 #include <readconnection.h>
 #include <dcb.h>
+#include <slab.h>
 #include <spinlock.h>
 
 #include <skygw_types.h>
@@ -132,6 +138,7 @@ static void rses_end_locked_router_action(
 
 static SPINLOCK	instlock;
 static ROUTER_INSTANCE *instances;
+static SLAB_CACHE      *rses_cache;
 
 /**
  * Implementation of the mandatory version entry point
@@ -154,8 +161,9 @@ ModuleInit()
         LOGIF(LM, (skygw_log_write(
                            LOGFILE_MESSAGE,
                            "Initialise readconnroute router module %s.\n", version_str)));
-        spinlock_init(&instlock);
+        spinlock_init_named(&instlock, "readconn instlock");
 	instances = NULL;
+	rses_cache = slab_cache_alloc("readconnroute session", sizeof(ROUTER_CLIENT_SES));
 }
 
 /**
@@ -193,7 +201,7 @@ int		i, n;
         }
 
 	inst->service = service;
-	spinlock_init(&inst->lock);
+	spinlock_init_named(&inst->lock, "readconn router lock");
 
 	/*
 	 * We need an array of the backend servers in the instance structure so
@@ -204,8 +212,11 @@ int		i, n;
 		n++;
 
 	inst->servers = (BACKEND **)calloc(n + 1, sizeof(BACKEND *));
-	if (!inst->servers)
+	inst->stats = (ROUTER_STATS *)stats_alloc(sizeof(ROUTER_STATS));
+	if (!inst->servers || !inst->stats)
 	{
+		free(inst->servers);
+		free(inst->stats);
 		free(inst);
 		return NULL;
 	}
@@ -217,6 +228,7 @@ int		i, n;
 			for (i = 0; i < n; i++)
 				free(inst->servers[i]);
 			free(inst->servers);
+			free(inst->stats);
 			free(inst);
 			return NULL;
 		}
@@ -231,6 +243,7 @@ int		i, n;
 	 */
 	inst->bitmask = 0;
 	inst->bitvalue = 0;
+	inst->splice = 0;
 	if (options)
 	{
 		for (i = 0; options[i]; i++)
@@ -250,6 +263,10 @@ int		i, n;
 				inst->bitmask |= (SERVER_JOINED);
 				inst->bitvalue |= SERVER_JOINED;
 			}
+			else if (!strcasecmp(options[i], "splice"))
+			{
+				inst->splice = 1;
+			}
 			else
 			{
                             LOGIF(LE, (skygw_log_write(
@@ -299,7 +316,7 @@ int			master_host = -1;
                 inst)));
 
 
-	client_rses = (ROUTER_CLIENT_SES *)calloc(1, sizeof(ROUTER_CLIENT_SES));
+	client_rses = (ROUTER_CLIENT_SES *)slab_alloc(rses_cache);
 
         if (client_rses == NULL) {
                 return NULL;
@@ -397,7 +414,7 @@ int			master_host = -1;
                       	  "Error : Failed to create new routing session. "
                       	  "Couldn't find eligible candidate server. Freeing "
                        	 "allocated resources.")));
-			free(client_rses);
+			slab_free(rses_cache, client_rses);
 			return NULL;
 		}
 	}
@@ -427,10 +444,10 @@ int			master_host = -1;
         if (client_rses->backend_dcb == NULL)
 	{
                 atomic_add(&candidate->current_connection_count, -1);
-		free(client_rses);
+		slab_free(rses_cache, client_rses);
 		return NULL;
 	}
-	inst->stats.n_sessions++;
+	ROUTER_THREAD_STATS(inst)->n_sessions++;
 
 	/**
          * Add this session to the list of active sessions.
@@ -501,7 +518,7 @@ static void freeSession(
                 router_cli_ses->backend->server->port,
                 prev_val-1)));
 
-        free(router_cli_ses);
+        slab_free(rses_cache, router_cli_ses);
 }
 
 
@@ -558,14 +575,13 @@ routeQuery(ROUTER *instance, void *router_session, GWBUF *queue)
 {
         ROUTER_INSTANCE	  *inst = (ROUTER_INSTANCE *)instance;
         ROUTER_CLIENT_SES *router_cli_ses = (ROUTER_CLIENT_SES *)router_session;
-        uint8_t           *payload = GWBUF_DATA(queue);
         int               mysql_command;
         int               rc;
         DCB*              backend_dcb;
         bool              rses_is_closed;
        
-	inst->stats.n_queries++;
-	mysql_command = MYSQL_GET_COMMAND(payload);
+	ROUTER_THREAD_STATS(inst)->n_queries++;
+	mysql_command = gwbuf_mysql_command(queue);
 
         /** Dirty read for quick check if router is closed. */
         if (router_cli_ses->rses_closed)
@@ -606,7 +622,7 @@ routeQuery(ROUTER *instance, void *router_session, GWBUF *queue)
                         queue);
 		break;
         default:
-                rc = backend_dcb->func.write(backend_dcb, queue);
+                rc = dcb_post_write(backend_dcb, queue);
                 break;
         }
         
@@ -634,7 +650,8 @@ diagnostics(ROUTER *router, DCB *dcb)
 {
 ROUTER_INSTANCE	  *router_inst = (ROUTER_INSTANCE *)router;
 ROUTER_CLIENT_SES *session;
-int		  i = 0;
+ROUTER_STATS	  stats;
+int		  i = 0, j;
 
 	spinlock_acquire(&router_inst->lock);
 	session = router_inst->connections;
@@ -645,11 +662,21 @@ int		  i = 0;
 	}
 	spinlock_release(&router_inst->lock);
 	
+	memset(&stats, 0, sizeof(stats));
+	for (j = 0; j < stats_n_threads(); j++)
+	{
+		stats.n_sessions += router_inst->stats[j].n_sessions;
+		stats.n_queries += router_inst->stats[j].n_queries;
+		stats.n_spliced += router_inst->stats[j].n_spliced;
+	}
 	dcb_printf(dcb, "\tNumber of router sessions:   	%d\n",
-                   router_inst->stats.n_sessions);
+                   stats.n_sessions);
 	dcb_printf(dcb, "\tCurrent no. of router sessions:	%d\n", i);
 	dcb_printf(dcb, "\tNumber of queries forwarded:   	%d\n",
-                   router_inst->stats.n_queries);
+                   stats.n_queries);
+	if (router_inst->splice)
+		dcb_printf(dcb, "\tNumber of spliced sessions:   	%d\n",
+			   stats.n_spliced);
 }
 
 /**
@@ -669,13 +696,24 @@ clientReply(
         GWBUF  *queue,
         DCB    *backend_dcb)
 {
+	ROUTER_INSTANCE	*inst = (ROUTER_INSTANCE *)instance;
 	DCB *client = NULL;
 
 	client = backend_dcb->session->client;
 
 	ss_dassert(client != NULL);
 
-	client->func.write(client, queue);
+	dcb_post_write(client, queue);
+
+	/*<
+	 * The backend has authenticated and replied, the rest of the session
+	 * can bypass the gateway.
+	 */
+	if (inst->splice && !backend_dcb->spliced &&
+	    dcb_splice_start(client, backend_dcb) == 0)
+	{
+		ROUTER_THREAD_STATS(inst)->n_spliced++;
+	}
 }
 
 /**
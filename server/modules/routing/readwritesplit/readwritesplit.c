@@ -29,6 +29,7 @@
 #include <log_manager.h>
 #include <query_classifier.h>
 #include <dcb.h>
+#include <slab.h>
 #include <spinlock.h>
 
 extern int lm_enabled_logfiles_bitmask;
@@ -159,6 +160,7 @@ static void tracelog_routed_query(
 
 static SPINLOCK	        instlock;
 static ROUTER_INSTANCE* instances;
+static SLAB_CACHE      *rses_cache;
 
 /**
  * Implementation of the mandatory version entry point
@@ -181,8 +183,9 @@ ModuleInit()
         LOGIF(LM, (skygw_log_write_flush(
                            LOGFILE_MESSAGE,
                            "Initializing statemend-based read/write split router module.")));
-        spinlock_init(&instlock);
+        spinlock_init_named(&instlock, "rwsplit instlock");
         instances = NULL;
+        rses_cache = slab_cache_alloc("readwritesplit session", sizeof(ROUTER_CLIENT_SES));
 }
 
 /**
@@ -220,7 +223,7 @@ static ROUTER* createInstance(
                 return NULL; 
         } 
         router->service = service;
-        spinlock_init(&router->lock);
+        spinlock_init_named(&router->lock, "rwsplit router lock");
         
         /** Calculate number of servers */
         server = service->databases;
@@ -229,9 +232,12 @@ static ROUTER* createInstance(
                 n++;
         }
         router->servers = (BACKEND **)calloc(n + 1, sizeof(BACKEND *));
+        router->stats = (ROUTER_STATS *)stats_alloc(sizeof(ROUTER_STATS));
         
-        if (router->servers == NULL)
+        if (router->servers == NULL || router->stats == NULL)
         {
+                free(router->servers);
+                free(router->stats);
                 free(router);
                 return NULL;
         }
@@ -259,6 +265,7 @@ static ROUTER* createInstance(
                                 free(router->servers[i]);
                         }
                         free(router->servers);
+                        free(router->stats);
                         free(router);
                         return NULL;
                 }
@@ -333,7 +340,7 @@ static void* newSession(
         bool                succp;
 
         client_rses =
-                (ROUTER_CLIENT_SES *)calloc(1, sizeof(ROUTER_CLIENT_SES));
+                (ROUTER_CLIENT_SES *)slab_alloc(rses_cache);
 
         if (client_rses == NULL)
         {
@@ -341,7 +348,8 @@ static void* newSession(
                 return NULL;
         }
         memset(local_backend, 0, BE_COUNT*sizeof(void*));
-        spinlock_init(&client_rses->rses_lock);
+        spinlock_init_named(&client_rses->rses_lock, "rwsplit rses_lock");
+        client_rses->rses_session = session;
 #if defined(SS_DEBUG)
         client_rses->rses_chk_top = CHK_NUM_ROUTER_SES;
         client_rses->rses_chk_tail = CHK_NUM_ROUTER_SES;
@@ -372,7 +380,7 @@ static void* newSession(
 
         /** Both Master and Slave must be found */
         if (!succp) {
-                free(client_rses);
+                slab_free(rses_cache, client_rses);
                 return NULL;
         }
         /**
@@ -385,7 +393,7 @@ static void* newSession(
         
 	if (client_rses->rses_dcb[BE_SLAVE] == NULL) {
                 ss_dassert(session->refcount == 1);
-		free(client_rses);
+		slab_free(rses_cache, client_rses);
 		return NULL;
 	}
 	/**
@@ -399,7 +407,7 @@ static void* newSession(
 	{
                 /** Close slave connection first. */
                 client_rses->rses_dcb[BE_SLAVE]->func.close(client_rses->rses_dcb[BE_SLAVE]);
-		free(client_rses);
+		slab_free(rses_cache, client_rses);
 		return NULL;
 	}
         /**
@@ -411,7 +419,7 @@ static void* newSession(
         
         client_rses->rses_backend[BE_SLAVE] = local_backend[BE_SLAVE];
         client_rses->rses_backend[BE_MASTER] = local_backend[BE_MASTER];
-        router->stats.n_sessions += 1;
+        ROUTER_THREAD_STATS(router)->n_sessions++;
 
         client_rses->rses_capabilities = RCAP_TYPE_STMT_INPUT;
         /**
@@ -534,7 +542,7 @@ static void freeSession(
          * all the memory and other resources associated
          * to the client session.
          */
-	free(router_cli_ses);
+	slab_free(rses_cache, router_cli_ses);
         return;
 }
 
@@ -561,11 +569,8 @@ static int routeQuery(
         GWBUF*  querybuf)
 {
         skygw_query_type_t qtype    = QUERY_TYPE_UNKNOWN;
-        GWBUF*             plainsqlbuf = NULL;
         char*              querystr = NULL;
-        char*              startpos;
         unsigned char      packet_type;
-        uint8_t*           packet;
         int                ret = 0;
         DCB*               master_dcb = NULL;
         DCB*               slave_dcb  = NULL;
@@ -599,8 +604,8 @@ static int routeQuery(
                 rses_end_locked_router_action(router_cli_ses);
         }
         
-        packet = GWBUF_DATA(querybuf);
-        packet_type = packet[4];
+        /*< Set by the protocol when it split the statement off */
+        packet_type = (unsigned char)gwbuf_mysql_command(querybuf);
         
         if (rses_is_closed || (master_dcb == NULL && slave_dcb == NULL))
         {
@@ -616,8 +621,7 @@ static int routeQuery(
                                                  "route to"))));
                 goto return_ret;
         }
-        inst->stats.n_queries++;
-        startpos = (char *)&packet[5];
+        ROUTER_THREAD_STATS(inst)->n_queries++;
         
         switch(packet_type) {
                 case COM_QUIT:        /**< 1 QUIT will close all sessions */
@@ -635,14 +639,19 @@ static int routeQuery(
                         break;
 
                 case COM_QUERY:
-                        plainsqlbuf = gwbuf_clone_transform(querybuf, 
-                                                            GWBUF_TYPE_PLAINSQL);
-                        len = GWBUF_LENGTH(plainsqlbuf);
-                        /** unnecessary if buffer includes additional terminating null */
+                        /**
+                         * The classifier needs a terminated string, copy
+                         * the query text once from wherever it is in the
+                         * chain.
+                         */
+                        len = gwbuf_mysql_packet_len(querybuf);
                         querystr = (char *)malloc(len+1);
-                        memcpy(querystr, startpos, len);
-                        memset(&querystr[len], 0, 1);
-                        //                         querystr = (char *)GWBUF_DATA(plainsqlbuf);
+                        len = (len == 0 ? 0 : gwbuf_copy_data(
+                                                querybuf,
+                                                5,
+                                                len-1,
+                                                (unsigned char *)querystr));
+                        querystr[len] = '\0';
                         /*
                         querystr = master_dcb->func.getquerystr(
                                         (void *) gwbuf_clone(querybuf), 
@@ -684,8 +693,8 @@ static int routeQuery(
                                                 master_dcb, 
                                                 gwbuf_clone(querybuf)));
                 
-                ret = master_dcb->func.write(master_dcb, querybuf);
-                atomic_add(&inst->stats.n_master, 1);
+                ret = dcb_post_write(master_dcb, querybuf);
+                ROUTER_THREAD_STATS(inst)->n_master++;
                 
                 goto return_ret;
                 break;
@@ -707,11 +716,11 @@ static int routeQuery(
                 
                 if (transaction_active)
                 {
-                        ret = master_dcb->func.write(master_dcb, querybuf);
+                        ret = dcb_post_write(master_dcb, querybuf);
                 }
                 else
                 {
-                        ret = slave_dcb->func.write(slave_dcb, querybuf);
+                        ret = dcb_post_write(slave_dcb, querybuf);
                 }
                 LOGIF(LT, (skygw_log_write_flush(
                         LOGFILE_TRACE,
@@ -719,7 +728,7 @@ static int routeQuery(
                         pthread_self())));                
                 
                 
-                atomic_add(&inst->stats.n_slave, 1);
+                ROUTER_THREAD_STATS(inst)->n_slave++;
                 goto return_ret;
                 break;
 
@@ -764,8 +773,8 @@ static int routeQuery(
                         int rc;
                         int rc2;
 
-                        rc = master_dcb->func.write(master_dcb, gwbuf_clone(querybuf));
-                        rc2 = slave_dcb->func.write(slave_dcb, querybuf);
+                        rc = dcb_post_write(master_dcb, gwbuf_clone(querybuf));
+                        rc2 = dcb_post_write(slave_dcb, querybuf);
 
                         if (rc == 1 && rc == rc2)
                         {
@@ -812,7 +821,7 @@ static int routeQuery(
                 /** Unlock router session */
                 rses_end_locked_router_action(router_cli_ses);
                 
-                atomic_add(&inst->stats.n_all, 1);
+                ROUTER_THREAD_STATS(inst)->n_all++;
                 goto return_ret;
                 break;
 
@@ -822,12 +831,12 @@ static int routeQuery(
                                                 "routeQuery", 
                                                 master_dcb, 
                                                 gwbuf_clone(querybuf)));
-                ret = master_dcb->func.write(master_dcb, querybuf);
+                ret = dcb_post_write(master_dcb, querybuf);
                 LOGIF(LT, (skygw_log_write_flush(
                         LOGFILE_TRACE,
                         "%lu [routeQuery:rwsplit] Routed.",
                         pthread_self())));                
-                atomic_add(&inst->stats.n_master, 1);
+                ROUTER_THREAD_STATS(inst)->n_master++;
                 goto return_ret;
                 break;
                 
@@ -838,12 +847,12 @@ static int routeQuery(
                                                 "routeQuery", 
                                                 master_dcb, 
                                                 gwbuf_clone(querybuf)));
-                ret = master_dcb->func.write(master_dcb, querybuf);
+                ret = dcb_post_write(master_dcb, querybuf);
                 LOGIF(LT, (skygw_log_write_flush(
                         LOGFILE_TRACE,
                         "%lu [routeQuery:rwsplit] Routed.",
                         pthread_self())));                
-                atomic_add(&inst->stats.n_master, 1);
+                ROUTER_THREAD_STATS(inst)->n_master++;
                 goto return_ret;
                 break;
 
@@ -864,17 +873,13 @@ static int routeQuery(
                                                 master_dcb, 
                                                 gwbuf_clone(querybuf)));
                 
-                ret = master_dcb->func.write(master_dcb, querybuf);
-                atomic_add(&inst->stats.n_master, 1);
+                ret = dcb_post_write(master_dcb, querybuf);
+                ROUTER_THREAD_STATS(inst)->n_master++;
                 goto return_ret;
                 break;
         } /*< switch by query type */      
 
 return_ret:
-        if (plainsqlbuf != NULL)
-        {
-                gwbuf_free(plainsqlbuf);
-        }
         if (querystr != NULL)
         {
                 free(querystr);
@@ -959,7 +964,8 @@ diagnostic(ROUTER *instance, DCB *dcb)
 {
         ROUTER_CLIENT_SES *router_cli_ses;
         ROUTER_INSTANCE	  *router = (ROUTER_INSTANCE *)instance;
-        int		  i = 0;
+        ROUTER_STATS	  stats;
+        int		  i = 0, j;
 
 	spinlock_acquire(&router->lock);
 	router_cli_ses = router->connections;
@@ -969,25 +975,34 @@ diagnostic(ROUTER *instance, DCB *dcb)
 		router_cli_ses = router_cli_ses->next;
 	}
 	spinlock_release(&router->lock);
-	
+
+	memset(&stats, 0, sizeof(stats));
+	for (j = 0; j < stats_n_threads(); j++)
+	{
+		stats.n_sessions += router->stats[j].n_sessions;
+		stats.n_queries += router->stats[j].n_queries;
+		stats.n_master += router->stats[j].n_master;
+		stats.n_slave += router->stats[j].n_slave;
+		stats.n_all += router->stats[j].n_all;
+	}
 	dcb_printf(dcb,
                    "\tNumber of router sessions:           	%d\n",
-                   router->stats.n_sessions);
+                   stats.n_sessions);
 	dcb_printf(dcb,
                    "\tCurrent no. of router sessions:      	%d\n",
                    i);
 	dcb_printf(dcb,
                    "\tNumber of queries forwarded:          	%d\n",
-                   router->stats.n_queries);
+                   stats.n_queries);
 	dcb_printf(dcb,
                    "\tNumber of queries forwarded to master:	%d\n",
-                   router->stats.n_master);
+                   stats.n_master);
 	dcb_printf(dcb,
                    "\tNumber of queries forwarded to slave: 	%d\n",
-                   router->stats.n_slave);
+                   stats.n_slave);
 	dcb_printf(dcb,
                    "\tNumber of queries forwarded to all:   	%d\n",
-                   router->stats.n_all);
+                   stats.n_all);
 }
 
 /**
@@ -1093,7 +1108,7 @@ static void clientReply(
         if (writebuf != NULL && client_dcb != NULL)
         {
                 /** Write reply to client DCB */
-                client_dcb->func.write(client_dcb, writebuf);
+                dcb_post_write(client_dcb, writebuf);
 
                 LOGIF(LT, (skygw_log_write_flush(
                         LOGFILE_TRACE,
@@ -1432,6 +1447,10 @@ static mysql_sescmd_t* mysql_sescmd_init (
         /** Set session command buffer */
         sescmd->my_sescmd_buf  = sescmd_buf;
         sescmd->my_sescmd_packet_type = packet_type;
+        /** The history is held for as long as the router session lives */
+        sescmd->my_sescmd_session = rses->rses_session;
+        session_mem_account(sescmd->my_sescmd_session,
+                            gwbuf_length(sescmd_buf));
         
         return sescmd;
 }
@@ -1441,6 +1460,8 @@ static void mysql_sescmd_done(
 	mysql_sescmd_t* sescmd)
 {
 	CHK_RSES_PROP(sescmd->my_sescmd_prop);
+        session_mem_account(sescmd->my_sescmd_session,
+                            -(int)gwbuf_length(sescmd->my_sescmd_buf));
 	gwbuf_free(sescmd->my_sescmd_buf);
         memset(sescmd, 0, sizeof(mysql_sescmd_t));
 }
@@ -1471,8 +1492,9 @@ static GWBUF* sescmd_cursor_process_replies(
         sescmd_cursor_t* scur)
 {
         const size_t    headerlen = 4; /*< mysql packet header */
-        uint8_t*        packet;
+        uint8_t         packet[3];
         size_t          packetlen;
+        GWBUF*          discard;
         mysql_sescmd_t* scmd;        
         
         ss_dassert(SPINLOCK_IS_LOCKED(&(scur->scmd_cur_rses->rses_lock)));
@@ -1495,9 +1517,15 @@ static GWBUF* sescmd_cursor_process_replies(
                          * already replied. 
                          */
                         CHK_GWBUF(replybuf);
-                        packet = (uint8_t *)GWBUF_DATA(replybuf);
+                        gwbuf_copy_data(replybuf, 0, headerlen-1, packet);
                         packetlen = packet[0]+packet[1]*256+packet[2]*256*256;
-                        replybuf = gwbuf_consume(replybuf, packetlen+headerlen);
+                        discard = gwbuf_split(&replybuf, packetlen+headerlen);
+                        
+                        while (discard != NULL)
+                        {
+                                discard = gwbuf_consume(discard,
+                                                        GWBUF_LENGTH(discard));
+                        }
                         
                         LOGIF(LT, (skygw_log_write_flush(
                                 LOGFILE_TRACE,
@@ -1669,7 +1697,7 @@ static bool execute_sescmd_in_backend(
                 case COM_QUERY:
                 case COM_INIT_DB:
                 default:
-                        rc = dcb->func.write(
+                        rc = dcb_post_write(
                                 dcb, 
                                 sescmd_cursor_clone_querybuf(scur));
                         break;
@@ -1773,12 +1801,10 @@ static void tracelog_routed_query(
         DCB*               dcb,
         GWBUF*             buf)
 {
-        uint8_t*       packet = GWBUF_DATA(buf);
-        unsigned char  packet_type = packet[4];
-        size_t         len;
-        size_t         buflen = GWBUF_LENGTH(buf);
+        int            packet_type = gwbuf_mysql_command(buf);
+        long           len = gwbuf_mysql_packet_len(buf);
+        size_t         buflen = gwbuf_length(buf);
         char*          querystr;
-        char*          startpos = (char *)&packet[5];
         backend_type_t be_type;
                 
         if (rses->rses_dcb[BE_MASTER] == dcb)
@@ -1795,15 +1821,14 @@ static void tracelog_routed_query(
         }
         if (GWBUF_TYPE(buf) == GWBUF_TYPE_MYSQL)
         {
-                len  = packet[0];
-                len += 256*packet[1];
-                len += 256*256*packet[2];
-                
-                if (packet_type == '\x03') 
+                if (packet_type == '\x03' && len > 0) 
                 {
                         querystr = (char *)malloc(len);
-                        memcpy(querystr, startpos, len-1);
-                        querystr[len-1] = '\0';
+                        len = gwbuf_copy_data(buf,
+                                              5,
+                                              len-1,
+                                              (unsigned char *)querystr);
+                        querystr[len] = '\0';
                         LOGIF(LT, (skygw_log_write_flush(
                                 LOGFILE_TRACE,
                                 "%lu [%s] %d bytes long buf, \"%s\" -> %s:%d %s dcb %p",
@@ -129,8 +129,14 @@ static slist_cursor_t* slist_get_cursor(
 
 static bool file_write_header(skygw_file_t* file);
 static void simple_mutex_free_memory(simple_mutex_t* sm);
+static simple_mutex_stats_t* simple_mutex_stats_get(const char* name);
+static long simple_mutex_nsecs(void);
 static void mlist_free_memory(mlist_t* ml, char* name);
 static void thread_free_memory(skygw_thread_t* th, char* name);
+
+/** Statistics of the simple mutexes by name, only ever prepended to */
+static simple_mutex_stats_t* simple_mutex_stats = NULL;
+static pthread_mutex_t       simple_mutex_stats_lock = PTHREAD_MUTEX_INITIALIZER;
 /** End of static function declarations */
 
 int atomic_add(
@@ -1248,6 +1254,9 @@ simple_mutex_t* simple_mutex_init(
         sm->sm_chk_tail = CHK_NUM_SIMPLE_MUTEX;
 #endif
         sm->sm_name = strndup(name, PATH_MAX);
+        sm->sm_stats = simple_mutex_stats_get(name);
+        sm->sm_n_locked = 0;
+        sm->sm_hold_start = 0;
         
         /** Create pthread mutex */
         err = pthread_mutex_init(&sm->sm_mutex, NULL);
@@ -1309,6 +1318,51 @@ return_err:
         return err;
 }
 
+/**
+ * Find the statistics of the simple mutexes with the given name, creating
+ * them for the first mutex of the name.
+ */
+static simple_mutex_stats_t* simple_mutex_stats_get(
+        const char* name)
+{
+        simple_mutex_stats_t* sms;
+
+        pthread_mutex_lock(&simple_mutex_stats_lock);
+
+        for (sms = simple_mutex_stats; sms != NULL; sms = sms->sms_next) {
+                if (strcmp(sms->sms_name, name) == 0) {
+                        break;
+                }
+        }
+        if (sms == NULL &&
+            (sms = (simple_mutex_stats_t *)calloc(1, sizeof(simple_mutex_stats_t))) != NULL)
+        {
+                sms->sms_name = strndup(name, PATH_MAX);
+                sms->sms_next = simple_mutex_stats;
+                __sync_synchronize();
+                simple_mutex_stats = sms;
+        }
+        pthread_mutex_unlock(&simple_mutex_stats_lock);
+        return sms;
+}
+
+/**
+ * Return the statistics of the first simple mutex name, the others follow
+ * via sms_next.
+ */
+simple_mutex_stats_t* simple_mutex_stats_first(void)
+{
+        return simple_mutex_stats;
+}
+
+static long simple_mutex_nsecs(void)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
 static void simple_mutex_free_memory(
         simple_mutex_t* sm)
 {
@@ -1324,7 +1378,10 @@ int simple_mutex_lock(
         simple_mutex_t* sm,
         bool            block)
 {
-        int err;
+        int                   err;
+        long                  start = 0;
+        long                  wait;
+        simple_mutex_stats_t* sms;
 
         /**
          * Leaving the following serves as a reminder. It may assert
@@ -1333,7 +1390,11 @@ int simple_mutex_lock(
          * ss_dassert(sm->sm_lock_thr != pthread_self());
          */
         if (block) {
-                err = pthread_mutex_lock(&sm->sm_mutex);
+                /** Only a lock that has to wait is timed */
+                if ((err = pthread_mutex_trylock(&sm->sm_mutex)) == EBUSY) {
+                        start = simple_mutex_nsecs();
+                        err = pthread_mutex_lock(&sm->sm_mutex);
+                }
         } else {
                 err = pthread_mutex_trylock(&sm->sm_mutex);
         }
@@ -1352,6 +1413,26 @@ int simple_mutex_lock(
                  */
                 sm->sm_locked = true;
                 sm->sm_lock_thr = pthread_self();
+                /**
+                 * The counters of the mutex are protected by the mutex,
+                 * the statistics are shared by the mutexes of the name.
+                 */
+                if ((sms = sm->sm_stats) != NULL) {
+                        if (start != 0) {
+                                wait = simple_mutex_nsecs() - start;
+                                __sync_fetch_and_add(&sms->sms_n_contended, 1);
+                                __sync_fetch_and_add(&sms->sms_wait_time, wait);
+                                if (wait > sms->sms_wait_max) {
+                                        sms->sms_wait_max = wait;
+                                }
+                        }
+                        if (++sm->sm_n_locked == SIMPLE_MUTEX_SAMPLE) {
+                                sm->sm_n_locked = 0;
+                                __sync_fetch_and_add(&sms->sms_n_locked,
+                                                     SIMPLE_MUTEX_SAMPLE);
+                                sm->sm_hold_start = simple_mutex_nsecs();
+                        }
+                }
         }
         return err;
 }
@@ -1359,13 +1440,22 @@ int simple_mutex_lock(
 int simple_mutex_unlock(
         simple_mutex_t* sm)
 {
-        int err;
+        int  err;
+        long hold;
         /**
          * Leaving the following serves as a reminder. It may assert
          * any given time because sm_lock_thr is not protected.
          *
          * ss_dassert(sm->sm_lock_thr == pthread_self());
          */
+        if (sm->sm_hold_start != 0) {
+                hold = simple_mutex_nsecs() - sm->sm_hold_start;
+                sm->sm_hold_start = 0;
+                __sync_fetch_and_add(&sm->sm_stats->sms_hold_time, hold);
+                if (hold > sm->sm_stats->sms_hold_max) {
+                        sm->sm_stats->sms_hold_max = hold;
+                }
+        }
         err = pthread_mutex_unlock(&sm->sm_mutex);
 
         if (err != 0) {
@@ -23,15 +23,37 @@ typedef struct skygw_file_st    skygw_file_t;
 typedef struct skygw_thread_st  skygw_thread_t;
 typedef struct skygw_message_st skygw_message_t;
 
+#define SIMPLE_MUTEX_SAMPLE 64 /**< one in this many locks of a mutex is timed */
+
+/**
+ * Lock statistics shared by all the simple mutexes with the same name.
+ * Contended locks are all counted and timed, the holding times are of
+ * one in SIMPLE_MUTEX_SAMPLE locks of a mutex. The structures are never
+ * freed, so the list can be read while mutexes come and go.
+ */
+typedef struct simple_mutex_stats_st {
+        char*                         sms_name;
+        long                          sms_n_locked;    /**< locks, counted in samples */
+        long                          sms_n_contended; /**< locks that had to wait */
+        long                          sms_wait_time;   /**< nsecs waited when contended */
+        long                          sms_wait_max;
+        long                          sms_hold_time;   /**< nsecs held by sampled locks */
+        long                          sms_hold_max;
+        struct simple_mutex_stats_st* sms_next;
+} simple_mutex_stats_t;
+
 typedef struct simple_mutex_st {
-        skygw_chk_t      sm_chk_top;
-        pthread_mutex_t  sm_mutex;
-        pthread_t        sm_lock_thr;
-        bool             sm_locked;
-        int              sm_enabled; /**< defined as in to minimize mutexing */
-        bool             sm_flat;
-        char*            sm_name;
-        skygw_chk_t      sm_chk_tail;
+        skygw_chk_t           sm_chk_top;
+        pthread_mutex_t       sm_mutex;
+        pthread_t             sm_lock_thr;
+        bool                  sm_locked;
+        int                   sm_enabled; /**< defined as in to minimize mutexing */
+        bool                  sm_flat;
+        char*                 sm_name;
+        simple_mutex_stats_t* sm_stats;      /**< statistics of the mutexes of this name */
+        int                   sm_n_locked;   /**< locks since the last sample */
+        long                  sm_hold_start; /**< nsecs when the sampled lock was taken */
+        skygw_chk_t           sm_chk_tail;
 } simple_mutex_t;
 
 typedef struct skygw_rwlock_st {
@@ -163,6 +185,7 @@ simple_mutex_t* simple_mutex_init(simple_mutex_t* mutexptr, const char* name);
 int simple_mutex_done(simple_mutex_t* sm);
 int simple_mutex_lock(simple_mutex_t* sm, bool block);
 int simple_mutex_unlock(simple_mutex_t* sm);
+simple_mutex_stats_t* simple_mutex_stats_first(void);
 
 /** Skygw message routines */
 skygw_message_t* skygw_message_init(void);